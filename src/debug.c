@@ -49,6 +49,8 @@
 #include <readline/history.h>
 #endif
 
+#include <SDL.h>
+
 #include "error.h"
 #include "trs.h"
 #include "web_debugger.h"
@@ -64,19 +66,25 @@
 #define DISASSEMBLE_OFF_FLAG	(0x8)
 #define BREAK_ONCE_FLAG		(0x10)
 #define WATCHPOINT_FLAG		(0x20)
+#define IOBREAK_FLAG		(0x40)
 
 static Uint8 *traps;
 static int num_traps;
 static int print_instructions;
 static int stop_signaled;
 static unsigned int num_watchpoints = 0;
+static int watch_running;
+static int watch_address = -1;
+static int watch_value;
+static int watch_access;
 
 static struct
 {
     int   valid;
     int   address;
     int   flag;
-    Uint8 byte; /* used only by watchpoints */
+    int   length; /* used only by watchpoints */
+    int   access; /* MEM_WATCH_* or IOPORT_* flags */
 } trap_table[MAX_TRAPS];
 
 
@@ -193,6 +201,8 @@ static char *trap_name(int flag)
 	return "temporary breakpoint";
       case WATCHPOINT_FLAG:
 	return "watchpoint";
+      case IOBREAK_FLAG:
+	return "I/O breakpoint";
       default:
 	return "unknown trap";
     }
@@ -212,6 +222,73 @@ static void show_zbxinfo(void)
 #endif
 }
 
+/*
+ * Let the CPU loop stop by itself at PC traps, without single-stepping,
+ * and mark the pages watched by mem_read and mem_write.
+ */
+static void arm_traps(void)
+{
+    int i, page;
+
+    z80_breakpoints = (num_traps > (int)num_watchpoints) ? traps : NULL;
+
+    memset(mem_watch_pages, 0, sizeof(mem_watch_pages));
+    /* Keep the trace bits of -ioports */
+    for(i = 0; i < 256; ++i)
+	trs_io_ports[i] &= ~(IOPORT_BREAK_IN | IOPORT_BREAK_OUT);
+    for(i = 0; i < MAX_TRAPS; ++i)
+    {
+	if(trap_table[i].valid && trap_table[i].flag == IOBREAK_FLAG)
+	{
+	    trs_io_ports[trap_table[i].address] |= trap_table[i].access;
+	}
+	else if(trap_table[i].valid && trap_table[i].flag == WATCHPOINT_FLAG)
+	{
+	    for(page = trap_table[i].address >> 8;
+		page <= (trap_table[i].address + trap_table[i].length - 1) >> 8;
+		++page)
+	    {
+		mem_watch_pages[page] |= trap_table[i].access;
+	    }
+	}
+    }
+}
+
+/* Called by z80_in and z80_out for every access to a break port */
+void debug_io(int port, int value, int access)
+{
+    if(!watch_running || watch_address >= 0) return;
+
+    watch_address = port;
+    watch_value = value;
+    watch_access = access;
+    if (trs_continuous > 0) trs_continuous = 0;
+}
+
+/* Called by mem_read and mem_write for every access to a watched page */
+void debug_watch(int address, int value, int access)
+{
+    int i;
+
+    if(!watch_running || watch_address >= 0) return;
+
+    for(i = 0; i < MAX_TRAPS; ++i)
+    {
+	if(trap_table[i].valid && trap_table[i].flag == WATCHPOINT_FLAG &&
+	   (trap_table[i].access & access) &&
+	   address >= trap_table[i].address &&
+	   address < trap_table[i].address + trap_table[i].length)
+	{
+	    /* Finish the current instruction, then stop */
+	    watch_address = address;
+	    watch_value = value;
+	    watch_access = access;
+	    if (trs_continuous > 0) trs_continuous = 0;
+	    return;
+	}
+    }
+}
+
 static void clear_all_traps(void)
 {
     int i;
@@ -219,12 +296,14 @@ static void clear_all_traps(void)
     {
 	if(trap_table[i].valid)
 	{
-	    traps[trap_table[i].address] &= ~(trap_table[i].flag);
+	    if(trap_table[i].flag < WATCHPOINT_FLAG)
+		traps[trap_table[i].address] &= ~(trap_table[i].flag);
 	    trap_table[i].valid = 0;
 	}
     }
     num_traps = 0;
     num_watchpoints = 0;
+    arm_traps();
 }
 
 static void print_traps(void)
@@ -237,8 +316,27 @@ static void print_traps(void)
 	{
 	    if(trap_table[i].valid)
 	    {
-		printf("[%d] %.4x (%s)\n", i, trap_table[i].address,
-		       trap_name(trap_table[i].flag));
+		if(trap_table[i].flag == IOBREAK_FLAG)
+		{
+		    printf("[%d] port %.2x (%s%s%s)\n", i, trap_table[i].address,
+			   (trap_table[i].access & IOPORT_BREAK_IN) ? "in " : "",
+			   (trap_table[i].access & IOPORT_BREAK_OUT) ? "out " : "",
+			   trap_name(trap_table[i].flag));
+		}
+		else if(trap_table[i].flag == WATCHPOINT_FLAG)
+		{
+		    printf("[%d] %.4x-%.4x (%s%s%s)\n", i,
+			   trap_table[i].address,
+			   trap_table[i].address + trap_table[i].length - 1,
+			   (trap_table[i].access & MEM_WATCH_READ) ? "read " : "",
+			   (trap_table[i].access & MEM_WATCH_WRITE) ? "write " : "",
+			   trap_name(trap_table[i].flag));
+		}
+		else
+		{
+		    printf("[%d] %.4x (%s)\n", i, trap_table[i].address,
+			   trap_name(trap_table[i].flag));
+		}
 	    }
 	}
     }
@@ -248,35 +346,76 @@ static void print_traps(void)
     }
 }
 
-static void set_trap(int address, int flag)
+static int add_trap(int address, int flag)
 {
     int i;
 
     if(num_traps == MAX_TRAPS)
     {
 	printf("Cannot set more than %d traps.\n", MAX_TRAPS);
+	return -1;
     }
-    else
+
+    i = 0;
+    while(trap_table[i].valid) ++i;
+
+    trap_table[i].valid = 1;
+    trap_table[i].address = address;
+    trap_table[i].flag = flag;
+    trap_table[i].length = 1;
+    trap_table[i].access = 0;
+    num_traps++;
+    return i;
+}
+
+static void set_trap(int address, int flag)
+{
+    int i;
+
+    if((i = add_trap(address, flag)) >= 0)
     {
-	i = 0;
-	while(trap_table[i].valid) ++i;
-
-	trap_table[i].valid = 1;
-	trap_table[i].address = address;
-	trap_table[i].flag = flag;
-	if (trap_table[i].flag == WATCHPOINT_FLAG) {
-	    /* Initialize the byte field to current memory contents. */
-	    trap_table[i].byte = mem_read(address);
-	    /* Increment number of set watchpoints. */
-	    num_watchpoints++;
-	}
+	/* Only traps on the PC go into the map checked by the CPU */
 	traps[address] |= flag;
-	num_traps++;
+	arm_traps();
 
 	printf("Set %s [%d] at %.4x\n", trap_name(flag), i, address);
     }
 }
 
+static void set_watchpoint(int address, int length, int access)
+{
+    int i;
+
+    if(length < 1 || address + length > ADDRESS_SPACE)
+    {
+	puts("Invalid watchpoint range.");
+    }
+    else if((i = add_trap(address, WATCHPOINT_FLAG)) >= 0)
+    {
+	trap_table[i].length = length;
+	trap_table[i].access = access;
+	num_watchpoints++;
+	arm_traps();
+
+	printf("Set %s [%d] at %.4x-%.4x\n", trap_name(WATCHPOINT_FLAG), i,
+	       address, address + length - 1);
+    }
+}
+
+static void set_io_trap(int port, int flag, int access)
+{
+    int i;
+
+    if((i = add_trap(port & 0xff, flag)) >= 0)
+    {
+	trap_table[i].access = access;
+	num_watchpoints++;
+	arm_traps();
+
+	printf("Set %s [%d] at port %.2x\n", trap_name(flag), i, port & 0xff);
+    }
+}
+
 static void clear_trap(int i)
 {
     if((i < 0) || (i > MAX_TRAPS) || !trap_table[i].valid)
@@ -285,13 +424,17 @@ static void clear_trap(int i)
     }
     else
     {
-	traps[trap_table[i].address] &= ~(trap_table[i].flag);
 	trap_table[i].valid = 0;
-	if (trap_table[i].flag == WATCHPOINT_FLAG) {
+	if (trap_table[i].flag >= WATCHPOINT_FLAG) {
 	    /* Decrement number of set watchpoints. */
 	    num_watchpoints--;
 	}
+	else
+	{
+	    traps[trap_table[i].address] &= ~(trap_table[i].flag);
+	}
 	num_traps--;
+	arm_traps();
 	printf("Cleared %s [%d] at %.4x\n",
 	       trap_name(trap_table[i].flag), i, trap_table[i].address);
     }
@@ -350,13 +493,13 @@ void hard_reset() {
 }
 
 void run_emulation() {
-	// Forces non-continuous run, while handling traps.
-	debug_run(/* disable_continuous= */ 1);
+	// Breakpoints are checked by z80_run, so this can run continuously.
+	debug_run(/* disable_continuous= */ 0);
 }
 
 void halt_emulation() {
 	puts("Halting Emulation");
-	set_trap(Z80_PC, BREAK_ONCE_FLAG);
+	trs_debug();
 }
 
 void on_trx_control_callback(TRX_CONTROL_TYPE type) {
@@ -368,9 +511,12 @@ void on_trx_control_callback(TRX_CONTROL_TYPE type) {
 }
 
 void on_trx_add_breakpoint(int bp_id, uint16_t addr, TRX_BREAK_TYPE type) {
-  int flag = BREAKPOINT_FLAG;  // TRX_BREAK_PC
-  if (type == TRX_BREAK_MEMORY) flag = WATCHPOINT_FLAG;
-  set_trap(addr, flag);
+  if (type == TRX_BREAK_MEMORY)
+    set_watchpoint(addr, 1, MEM_WATCH_READ | MEM_WATCH_WRITE);
+  else if (type == TRX_BREAK_IO)
+    set_io_trap(addr, IOBREAK_FLAG, IOPORT_BREAK_IN | IOPORT_BREAK_OUT);
+  else
+    set_trap(addr, BREAKPOINT_FLAG);  // TRX_BREAK_PC
 }
 
 void on_trx_remove_breakpoint(int bp_id) {
@@ -421,7 +567,7 @@ void on_trx_get_state_update(TRX_SystemState* state) {
 }
 
 uint8_t trx_read_memory(uint16_t addr) {
-  return (uint8_t)mem_read(addr);
+  return (uint8_t)mem_peek(addr);
 }
 
 void trx_write_memory(uint16_t addr, uint8_t value) {
@@ -432,6 +578,61 @@ void trx_set_pc(uint16_t addr) {
   Z80_PC = addr;
 }
 
+/*
+ * Keys from the web frontend arrive on the web server thread, so hand them
+ * to trs_get_event as user events instead of feeding the keyboard queue
+ * directly.  The key names are those of the browser's KeyboardEvent.key,
+ * which already carry the shift state of printable characters.
+ */
+void trx_key_event(const char *key, bool down, bool shift) {
+  static const struct {
+    const char *name;
+    int keysym;
+  } names[] = {
+    { "Enter",      0x0d  },
+    { "Escape",     0x1b  },
+    { "Backspace",  0x08  },
+    { "Tab",        0x09  },
+    { "ArrowUp",    0x111 },
+    { "ArrowDown",  0x112 },
+    { "ArrowRight", 0x113 },
+    { "ArrowLeft",  0x114 },
+    { "Home",       0x116 },
+    { "Shift",      0x130 },
+    { "Control",    0x132 },
+  };
+  SDL_Event event;
+  int keysym = -1;
+  int i;
+
+  (void)shift;
+  if (key[0] >= 0x20 && key[0] <= 0x7e && key[1] == '\0') {
+    keysym = key[0];
+    /* Same case swap as the keys typed by scripts */
+    if (keysym >= 0x5b && keysym <= 0x60)
+      keysym += 0x20;
+    else if (keysym >= 0x7b && keysym <= 0x7e)
+      keysym -= 0x20;
+  } else {
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+      if (strcmp(key, names[i].name) == 0) {
+        keysym = names[i].keysym;
+        break;
+      }
+    }
+  }
+  if (keysym < 0) {
+    printf("[TRX] WARNING: Unknown key: '%s'\n", key);
+    return;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.type = SDL_USEREVENT;
+  event.user.code = down ? keysym : (keysym | 0x10000);
+  if (SDL_PushEvent(&event) < 0)
+    printf("[TRX] WARNING: Key event dropped: %s\n", SDL_GetError());
+}
+
 void trs_debug(void)
 {
     stop_signaled = 1;
@@ -460,6 +661,9 @@ void debug_init(void)
     ctx->capabilities.memory_range.start = 0x0000; // 0x8000;
     ctx->capabilities.memory_range.length = 0xFF00; // <== FIXME // 20;
     ctx->capabilities.max_breakpoints = 128;
+    ctx->capabilities.pc_breakpoints = true;
+    ctx->capabilities.memory_breakpoints = true;
+    ctx->capabilities.io_breakpoints = true;
     ctx->capabilities.alt_single_step_mode = false;
     ctx->control_callback = &on_trx_control_callback;
     ctx->read_memory = &trx_read_memory;
@@ -469,6 +673,7 @@ void debug_init(void)
     ctx->get_resource = &on_trx_get_resource;
     ctx->get_state_update = &on_trx_get_state_update;
     ctx->set_pc = trx_set_pc;
+    ctx->key_event = trx_key_event;
     init_trs_xray(ctx);
 }
 
@@ -485,7 +690,7 @@ static void print_memory(Uint16 address, int num_bytes)
 	printf("%.4x:\t", address);
 	for(i = 0; i < bytes_to_print; ++i)
 	{
-	    printf("%.2x ", mem_read(address + i));
+	    printf("%.2x ", mem_peek(address + i));
 	}
 	for(i = bytes_to_print; i < 16; ++i)
 	{
@@ -494,7 +699,7 @@ static void print_memory(Uint16 address, int num_bytes)
 	printf("    ");
 	for(i = 0; i < bytes_to_print; ++i)
 	{
-	    byte = mem_read(address + i);
+	    byte = mem_peek(address + i);
 	    if(isprint(byte))
 	    {
 		putchar(byte);
@@ -513,12 +718,11 @@ static void print_memory(Uint16 address, int num_bytes)
 static void debug_run(int disable_continuous)
 {
     Uint8 t;
-    Uint8 byte;
     int continuous;
-    int i;
-    int watch_triggered = 0;
 
     stop_signaled = 0;
+    watch_address = -1;
+    watch_running = 1;
 
     t = traps[Z80_PC];
     while(!stop_signaled)
@@ -542,7 +746,12 @@ static void debug_run(int disable_continuous)
 
 	if(print_instructions) disassemble(Z80_PC);
 
-	continuous = !disable_continuous && (!print_instructions && num_traps == 0);
+	/*
+	 * PC traps are caught by z80_run itself, which returns before
+	 * executing a trapped address, and watchpoints stop it from
+	 * mem_read and mem_write.
+	 */
+	continuous = !disable_continuous && !print_instructions;
 	if (z80_run(continuous)) {
 	  puts("emt_debug instruction executed.");
 	  stop_signaled = 1;
@@ -561,42 +770,23 @@ static void debug_run(int disable_continuous)
 	    clear_trap_address(Z80_PC, BREAK_ONCE_FLAG);
 	}
 
-	/*
-	 * Iterate over the trap list looking for watchpoints only if we
-	 * know there are any to be found.
-	 */
-	if (num_watchpoints)
+	if(watch_address >= 0)
 	{
-	    for (i = 0; i < MAX_TRAPS; ++i)
-	    {
-		if (trap_table[i].valid &&
-		    trap_table[i].flag == WATCHPOINT_FLAG)
-		{
-		    byte = mem_read(trap_table[i].address);
-		    if (byte != trap_table[i].byte)
-		    {
-			/*
-			 * If a watched memory location has changed, report
-			 * it, update the watch entry in the trap table to
-			 * reflect the new value, and set the
-			 * watch_triggered flag so that we stop after all
-			 * watchpoints have been processed.
-			 */
-			printf("Memory location 0x%.4x changed value from "
-			       "0x%.2x to 0x%.2x.\n", trap_table[i].address,
-			       trap_table[i].byte, byte);
-			trap_table[i].byte = byte;
-			watch_triggered = 1;
-		    }
-		}
-	    }
-	    if (watch_triggered)
-	    {
-		stop_signaled = 1;
-	    }
+	    if(watch_access == IOPORT_BREAK_OUT)
+		printf("Port 0x%.2x written with 0x%.2x.\n",
+		       watch_address, watch_value);
+	    else if(watch_access == IOPORT_BREAK_IN)
+		printf("Port 0x%.2x read as 0x%.2x.\n",
+		       watch_address, watch_value);
+	    else if(watch_access == MEM_WATCH_WRITE)
+		printf("Memory location 0x%.4x written with 0x%.2x.\n",
+		       watch_address, watch_value);
+	    else
+		printf("Memory location 0x%.4x read.\n", watch_address);
+	    stop_signaled = 1;
 	}
-
     }
+    watch_running = 0;
     printf("Stopped at %.4x\n", Z80_PC);
 }
 
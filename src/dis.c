@@ -2094,24 +2094,28 @@ static const struct opcode minor[6][256] = {
     }
 };
 
-int disassemble(Uint16 pc)
+/*
+ * Disassemble the instruction at pc to file, fetching its bytes with
+ * read_byte, so code can also be decoded from outside the Z80 memory.
+ */
+int disassemble_to(FILE *file, Uint16 pc, int (*read_byte)(int address))
 {
     int	i, j;
     const struct opcode	*code;
     int	addr;
 
     addr = pc;
-    i = mem_read(pc++);
+    i = read_byte(pc++);
     if (!major[i].name)
     {
 	j = major[i].args;
-	i = mem_read(pc++);
+	i = read_byte(pc++);
 	if (!minor[j][i].name)
 	{
 	    /* dd cb or fd cb; offset comes *before* instruction */
 	    j = minor[j][i].args;
             pc++; /* skip over offset */
-	    i = mem_read(pc++);
+	    i = read_byte(pc++);
 	}
 	code = &minor[j][i];
     }
@@ -2119,35 +2123,40 @@ int disassemble(Uint16 pc)
     {
 	code = &major[i];
     }
-    printf ("%04x  ", addr);
+    fprintf (file, "%04x  ", addr);
     for (i = 0; i < ((pc + arglen(code->args) - addr) & 0xffff); i++)
-	printf("%02x ", mem_read(addr + i));
+	fprintf(file, "%02x ", read_byte(addr + i));
     for (; i < 4; i++)
-	printf("   ");
-    putchar (' ');
+	fputs("   ", file);
+    putc (' ', file);
     switch (code->args) {
       case A_16: /* 16-bit number */
-	printf (code->name, mem_read(pc + 1), mem_read(pc));
+	fprintf (file, code->name, read_byte(pc + 1), read_byte(pc));
 	break;
       case A_8X2: /* Two 8-bit numbers */
-	printf (code->name, mem_read(pc), mem_read(pc + 1));
+	fprintf (file, code->name, read_byte(pc), read_byte(pc + 1));
 	break;
       case A_8:  /* One 8-bit number */
-	printf (code->name, mem_read(pc));
+	fprintf (file, code->name, read_byte(pc));
 	break;
       case A_8P: /* One 8-bit number before last opcode byte */
-	printf (code->name, mem_read(pc - 2));
+	fprintf (file, code->name, read_byte(pc - 2));
 	break;
       case A_0:  /* No args */
       case A_0B: /* No args, backskip over last opcode byte */
-	fputs (code->name, stdout);
+	fputs (code->name, file);
 	break;
       case A_8R: /* One 8-bit relative address */
-	printf (code->name, (pc + 1 + (signed char) mem_read(pc)) & 0xffff);
+	fprintf (file, code->name, (pc + 1 + (signed char) read_byte(pc)) & 0xffff);
 	break;
     }
-    putchar ('\n');
+    putc ('\n', file);
     pc += arglen(code->args);
     return pc;  /* return the location of the next instruction */
 }
+
+int disassemble(Uint16 pc)
+{
+    return disassemble_to(stdout, pc, mem_peek);
+}
 #endif
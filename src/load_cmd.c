@@ -28,7 +28,9 @@
  *  of the TRS-80 DOS /cmd file format.
  */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <SDL_types.h>
 #include "load_cmd.h"
@@ -343,3 +345,201 @@ load_cmd(FILE* f, Uint8 memory[1 << 16],
   }
   return status;
 }
+
+/* Level II BASIC keywords for tokens 0x80 - 0xfb */
+static const char *basic_tokens[] = {
+  "END", "FOR", "RESET", "SET", "CLS", "CMD", "RANDOM", "NEXT",
+  "DATA", "INPUT", "DIM", "READ", "LET", "GOTO", "RUN", "IF",
+  "RESTORE", "GOSUB", "RETURN", "REM", "STOP", "ELSE", "TRON", "TROFF",
+  "DEFSTR", "DEFINT", "DEFSNG", "DEFDBL", "LINE", "EDIT", "ERROR", "RESUME",
+  "OUT", "ON", "OPEN", "FIELD", "GET", "PUT", "CLOSE", "LOAD",
+  "MERGE", "NAME", "KILL", "LSET", "RSET", "SAVE", "SYSTEM", "LPRINT",
+  "DEF", "POKE", "PRINT", "CONT", "LIST", "LLIST", "DELETE", "AUTO",
+  "CLEAR", "CLOAD", "CSAVE", "NEW", "TAB(", "TO", "FN", "USING",
+  "VARPTR", "USR", "ERL", "ERR", "STRING$", "INSTR", "POINT", "TIME$",
+  "MEM", "INKEY$", "THEN", "NOT", "STEP", "+", "-", "*",
+  "/", "[", "AND", "OR", ">", "=", "<", "SGN",
+  "INT", "ABS", "FRE", "INP", "POS", "SQR", "RND", "LOG",
+  "EXP", "COS", "SIN", "TAN", "ATN", "PEEK", "CVI", "CVS",
+  "CVD", "EOF", "LOC", "LOF", "MKI$", "MKS$", "MKD$", "CINT",
+  "CSNG", "CDBL", "FIX", "LEN", "STR$", "VAL", "ASC", "CHR$",
+  "LEFT$", "RIGHT$", "MID$", "'",
+};
+
+#define TOKEN_DATA  0x88
+#define TOKEN_REM   0x93
+#define TOKEN_ELSE  0x95
+#define TOKEN_PRINT 0xb2
+#define TOKEN_QUOTE 0xfb
+
+typedef struct {
+  int number;
+  int order;
+  int len;
+  Uint8 *data;
+} BasicLine;
+
+static int
+basic_token(const char* s, int* len)
+{
+  int i, n;
+
+  for (i = 0; i < (int)(sizeof(basic_tokens) / sizeof(basic_tokens[0])); i++) {
+    const char *k = basic_tokens[i];
+
+    for (n = 0; k[n] && toupper((unsigned char)s[n]) == k[n]; n++)
+      ;
+    if (k[n] == '\0') {
+      *len = n;
+      return 0x80 + i;
+    }
+  }
+  return -1;
+}
+
+/* Tokenize one line the way the ROM does when it is typed in */
+static int
+basic_crunch(const char* s, Uint8* out)
+{
+  int n = 0, quote = 0, data = 0;
+  int token, len;
+
+  while (*s) {
+    int c = (unsigned char)*s;
+
+    if (quote || data) {
+      if (c == '"') quote = !quote;
+      else if (c == ':' && !quote) data = 0;
+      out[n++] = c;
+      s++;
+      continue;
+    }
+    if (c == '"') {
+      quote = 1;
+      out[n++] = c;
+      s++;
+      continue;
+    }
+    if (c == '?') {
+      out[n++] = TOKEN_PRINT;
+      s++;
+      continue;
+    }
+    token = basic_token(s, &len);
+    if (token < 0) {
+      out[n++] = toupper(c);
+      s++;
+      continue;
+    }
+    s += len;
+    if (token == TOKEN_QUOTE) {
+      /* ' is stored as :REM' */
+      out[n++] = ':';
+      out[n++] = TOKEN_REM;
+    } else if (token == TOKEN_ELSE && (n == 0 || out[n - 1] != ':')) {
+      out[n++] = ':';
+    }
+    out[n++] = token;
+    if (token == TOKEN_REM || token == TOKEN_QUOTE) {
+      while (*s) out[n++] = *s++;
+    } else if (token == TOKEN_DATA) {
+      data = 1;
+    }
+  }
+  out[n++] = 0;
+  return n;
+}
+
+static int
+basic_line_cmp(const void* a, const void* b)
+{
+  const BasicLine *la = a, *lb = b;
+
+  if (la->number != lb->number) return la->number - lb->number;
+  return la->order - lb->order;
+}
+
+int
+load_basic(FILE* f, Uint8 memory[1 << 16], int start, int limit,
+	   int* end, int* errline)
+{
+  char text[1024];
+  Uint8 out[2 * sizeof(text)];
+  BasicLine *lines = NULL;
+  int nlines = 0, maxlines = 0;
+  int lineno = 0;
+  int status = LOAD_CMD_OK;
+  int addr = start;
+  int i;
+
+  while (fgets(text, sizeof(text), f)) {
+    char *s = text;
+    long number;
+
+    lineno++;
+    text[strcspn(text, "\r\n")] = '\0';
+    while (*s == ' ' || *s == '\t') s++;
+    if (*s == '\0') continue;
+    if (!isdigit((unsigned char)*s) ||
+	(number = strtol(s, &s, 10)) > 65529) {
+      status = LOAD_BASIC_NO_LINE;
+      break;
+    }
+    while (*s == ' ') s++;
+
+    if (nlines == maxlines) {
+      BasicLine *l;
+
+      maxlines = maxlines ? maxlines * 2 : 256;
+      if ((l = realloc(lines, maxlines * sizeof(BasicLine))) == NULL) {
+	status = LOAD_BASIC_FULL;
+	break;
+      }
+      lines = l;
+    }
+    lines[nlines].number = number;
+    lines[nlines].order = nlines;
+    lines[nlines].len = basic_crunch(s, out);
+    if ((lines[nlines].data = malloc(lines[nlines].len)) == NULL) {
+      status = LOAD_BASIC_FULL;
+      break;
+    }
+    memcpy(lines[nlines].data, out, lines[nlines].len);
+    nlines++;
+  }
+  if (errline) *errline = lineno;
+
+  if (status == LOAD_CMD_OK) {
+    qsort(lines, nlines, sizeof(BasicLine), basic_line_cmp);
+    for (i = 0; i < nlines; i++) {
+      BasicLine *l = &lines[i];
+      int next;
+
+      /* Of several lines with the same number the last one counts */
+      if (i + 1 < nlines && lines[i + 1].number == l->number) continue;
+      next = addr + 4 + l->len;
+      if (next + 2 > limit) {
+	status = LOAD_BASIC_FULL;
+	if (errline) *errline = l->number;
+	break;
+      }
+      memory[addr] = next & 0xff;
+      memory[addr + 1] = next >> 8;
+      memory[addr + 2] = l->number & 0xff;
+      memory[addr + 3] = l->number >> 8;
+      memcpy(&memory[addr + 4], l->data, l->len);
+      addr = next;
+    }
+  }
+  if (status == LOAD_CMD_OK) {
+    /* End of program marker */
+    memory[addr++] = 0;
+    memory[addr++] = 0;
+    *end = addr;
+  }
+
+  for (i = 0; i < nlines; i++)
+    free(lines[i].data);
+  free(lines);
+  return status;
+}
@@ -37,6 +37,9 @@
 
 #define ISAM_NONE -1
 
+#define LOAD_BASIC_NO_LINE -5
+#define LOAD_BASIC_FULL -6
+
 /* Load the /cmd file f into the given memory, optionally selecting
  * out an ISAM or PDS member.  Return LOAD_CMD_OK for success if f was a
  * normal /cmd file, LOAD_CMD_ISAM for success if it was an ISAM file,
@@ -81,3 +84,16 @@ int
 load_cmd(FILE* f, Uint8 memory[65536],
 	 Uint8* loadmap, int verbosity, FILE* outf,
 	 int isam, char* pds, int* xferaddr, int stopxfer);
+
+/* Tokenize the Level II / Model III BASIC source text in f and store
+ * the program into the given memory, starting at address start.  The
+ * lines may come in any order; a later line replaces an earlier one
+ * with the same number.  Return LOAD_CMD_OK for success and set *end
+ * to the first free address after the program, LOAD_BASIC_NO_LINE if
+ * a line has no valid line number, or LOAD_BASIC_FULL if the program
+ * would reach address limit.  If errline is not NULL, the number of
+ * the offending source line is returned there.
+ */
+int
+load_basic(FILE* f, Uint8 memory[65536], int start, int limit,
+	   int* end, int* errline);
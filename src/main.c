@@ -41,11 +41,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #include <SDL.h>
 #include "error.h"
 #include "load_cmd.h"
 #include "trs.h"
+#include "trs_bench.h"
 #include "trs_disk.h"
+#include "trs_hard.h"
+#include "trs_overlay.h"
 #include "trs_sdl_keyboard.h"
 #include "trs_state_save.h"
 
@@ -58,6 +65,10 @@
 int trs_model = 1;
 char *program_name;
 
+int trs_fork_count = 0;
+int trs_fork_delay = 0;
+int trs_fork_id = -1;
+
 int trs_load_cmd(const char *filename)
 {
   FILE *program;
@@ -81,6 +92,110 @@ int trs_load_cmd(const char *filename)
   return 0;
 }
 
+/*
+ * Fork mode: after the machine has run for trs_fork_delay emulated
+ * seconds, split it into trs_fork_count child processes which continue
+ * from the very same state.  Memory is shared copy-on-write by fork(),
+ * disk and hard drive images are switched to private overlays so that
+ * the children never see each other's writes.  The parent only waits
+ * for the children and exits with failure if any of them failed.
+ * Each child can tell itself apart by the SDLTRS_FORK_ID variable.
+ * The -fork option already switched to headless mode, as the processes
+ * can't share a window, an X11 connection or an audio device.
+ */
+void trs_fork_check(void)
+{
+#ifndef _WIN32
+  static int ticks = -1;
+  int failed = 0;
+  int status;
+  int i;
+
+  if (trs_fork_count <= 0 || trs_fork_id >= 0)
+    return;
+  if (ticks < 0)
+    ticks = trs_fork_delay * timer_hz;
+  if (ticks-- > 0)
+    return;
+
+  /* Children must not inherit and write out any pending data twice */
+  fflush(NULL);
+
+  for (i = 0; i < trs_fork_count; i++) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+      char id[16];
+
+      snprintf(id, sizeof(id), "%d", i);
+      setenv("SDLTRS_FORK_ID", id, 1);
+      trs_fork_id = i;
+      trs_overlay = 1;
+      trs_overlay_commit = 0;
+      trs_disk_overlay();
+      trs_hard_overlay();
+      return;
+    }
+    if (pid < 0) {
+      error("failed to fork machine %d: %s", i, strerror(errno));
+      failed++;
+      break;
+    }
+  }
+
+  while (wait(&status) > 0) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+      failed++;
+  }
+  /* Skip the atexit handlers: the children still own SDL resources */
+  _exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+#endif
+}
+
+/* Level II / Model III BASIC pointers */
+#define BASIC_STRSPACE 0x40A0
+#define BASIC_TXTTAB   0x40A4
+#define BASIC_VARTAB   0x40F9
+#define BASIC_ARYTAB   0x40FB
+#define BASIC_STREND   0x40FD
+
+int trs_load_basic(const char *filename)
+{
+  FILE *program;
+  extern Uint8 memory[];
+  int start, limit, end, line;
+  int status;
+
+  start = memory[BASIC_TXTTAB] | memory[BASIC_TXTTAB + 1] << 8;
+  limit = memory[BASIC_STRSPACE] | memory[BASIC_STRSPACE + 1] << 8;
+  if (start < 0x4200 || start >= limit) {
+    error("failed to load BASIC program %s: BASIC is not ready", filename);
+    return -1;
+  }
+  if ((program = fopen(filename, "r")) == NULL) {
+    error("failed to load BASIC program %s: %s", filename, strerror(errno));
+    return -1;
+  }
+  status = load_basic(program, memory, start, limit, &end, &line);
+  fclose(program);
+  if (status == LOAD_BASIC_NO_LINE) {
+    error("%s:%d: line number missing or too large", filename, line);
+    return -1;
+  } else if (status != LOAD_CMD_OK) {
+    error("failed to load BASIC program %s: out of memory in line %d",
+        filename, line);
+    return -1;
+  }
+
+  /* Program ends here, variables are set up again by RUN */
+  memory[BASIC_VARTAB] = memory[BASIC_ARYTAB] = memory[BASIC_STREND] =
+    end & 0xFF;
+  memory[BASIC_VARTAB + 1] = memory[BASIC_ARYTAB + 1] =
+    memory[BASIC_STREND + 1] = end >> 8;
+  debug("BASIC program %s: 0x%x - 0x%x\n", filename, start, end);
+  return 0;
+}
+
 static int trs_load_rom(const char *filename)
 {
   FILE *program;
@@ -221,6 +336,8 @@ int SDLmain(int argc, char *argv[])
   }
   if (trs_cmd_file[0])
     trs_load_cmd(trs_cmd_file);
+  if (trs_bench)
+    trs_bench_start();
 
   if (!debug || fullscreen) {
     /* Run continuously until exit or request to enter debugger */
@@ -81,17 +81,40 @@ extern int trs_continuous; /* 1= run continuously,
 			     -1= suppress interrupt and enter debugger */
 extern int trs_disk_debug_flags;
 extern int trs_io_debug_flags;
+
+/* Per-port flags in trs_io_ports; the trace bits match trs_io_debug_flags */
+#define IOPORT_TRACE_IN  (0x1)
+#define IOPORT_TRACE_OUT (0x2)
+#define IOPORT_BREAK_IN  (0x4)
+#define IOPORT_BREAK_OUT (0x8)
+extern Uint8 trs_io_ports[256];
+extern void trs_io_trace_start(const char *filename);
+extern void trs_io_trace_ports(const char *ports);
 extern int trs_emtsafe;
+extern int trs_emt_latency;
 
 extern void trs_parse_command_line(int argc, char **argv, int *debug);
 extern int trs_write_config_file(const char *filename);
 extern int trs_load_cmd(const char *filename);
+extern int trs_load_basic(const char *filename);
 extern int trs_load_config_file(void);
+extern void trs_fork_check(void);
+
+extern int trs_fork_count;
+extern int trs_fork_delay;
+extern int trs_fork_id;
 
 extern void trs_screen_init(void);
 extern void screen_init(void);
 extern void trs_rom_init(void);
 extern void trs_screen_write_char(unsigned int position, Uint8 char_index);
+/* Buffer size for trs_screen_text: 24 rows of 80 UTF-8 characters */
+#define TRS_SCREEN_TEXT (24 * (80 * 4 + 1) + 1)
+extern int trs_screen_text(char *buf, int size);
+extern int trs_screen_match_start(const char *text, int row, int col, int regex);
+extern int trs_screen_match(void);
+extern void trs_screen_match_stop(void);
+extern void trs_screen_capture(Uint8 *frame);
 extern void trs_screen_update(void);
 extern void trs_screen_expanded(int flag);
 extern void trs_screen_alternate(int flag);
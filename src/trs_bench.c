@@ -0,0 +1,465 @@
+/*
+ * trs_bench.c -- reproducible full-system benchmarks
+ *
+ * -benchmark runs one scenario headless and without throttling to real
+ * time, then writes a report in JSON.  A scenario sets up the machine,
+ * optionally inserts a boot disk or places a Z80 program in memory, and
+ * drives it with script commands (see trs_script.c); it ends with the
+ * script's quit.  The boot, compute, fill and grafyx scenarios need no
+ * ROM or disk images; basic needs a Model III ROM image and dir a
+ * bootable LDOS or LS-DOS disk in drive 0, and they fail right away
+ * without them.  Benchmarks ignore the user's configuration file.  Since
+ * the timer interrupts, the keyboard input of the script and the disk
+ * emulation all follow the T-state counter, a scenario executes the
+ * same instructions on every run and only the host time varies.
+ *
+ * The argument is the name of a built-in scenario or a script file,
+ * which runs with the machine configured by the other options.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_bench.h"
+#include "trs_disk.h"
+#include "trs_perf.h"
+#include "trs_script.h"
+
+/* Emulated seconds before a scenario that did not finish is stopped */
+#define BENCH_TIMEOUT	600
+
+typedef struct {
+  const char *name;
+  const char *description;
+  int model;			/* 0 to keep the configured model */
+  const Uint8 *boot;		/* boot sector of a disk in drive 0 */
+  int boot_size;
+  const Uint8 *program;		/* Z80 code run at BENCH_START */
+  int program_size;
+  const char *script;
+  int needs;			/* files the user has to provide */
+} Scenario;
+
+#define BENCH_START	0x8000
+
+#define BENCH_NEEDS_ROM3	1	/* Model III ROM image */
+#define BENCH_NEEDS_DISK	2	/* bootable disk in drive 0 */
+
+/* A JV3 image starts with the sector IDs and the write protect flag */
+#define JV3_HEADER	(34 * 256)
+
+/*
+ * Boot sector loaded to 4300h by the Model 4P boot ROM.  It shows a
+ * prompt and echoes the keys read from the keyboard matrix until ENTER,
+ * then answers OK and prompts again.
+ */
+static const Uint8 boot_sector[] = {
+  0x31, 0x00, 0x42,		/* 4300 ld sp,4200h */
+  0x21, 0x00, 0x3C,		/* 4303 ld hl,3C00h */
+  0x11, 0x01, 0x3C,		/* 4306 ld de,3C01h */
+  0x01, 0xFF, 0x03,		/* 4309 ld bc,03FFh */
+  0x36, 0x20,			/* 430C ld (hl),' ' */
+  0xED, 0xB0,			/* 430E ldir */
+  0x11, 0x00, 0x3C,		/* 4310 ld de,3C00h */
+  0x21, 0xA0, 0x43,		/* 4313 ld hl,43A0h */
+  0xCD, 0x43, 0x43,		/* 4316 call 4343h */
+  0xCD, 0x4B, 0x43,		/* 4319 call 434Bh */
+  0x21, 0xBD, 0x43,		/* 431C ld hl,43BDh */
+  0xCD, 0x43, 0x43,		/* 431F call 4343h */
+  0xCD, 0x4B, 0x43,		/* 4322 call 434Bh */
+  0x3E, 0x3E,			/* 4325 ld a,'>' */
+  0x12,				/* 4327 ld (de),a */
+  0x13,				/* 4328 inc de */
+  0x13,				/* 4329 inc de */
+  0xCD, 0x5A, 0x43,		/* 432A call 435Ah */
+  0xFE, 0x0D,			/* 432D cp 0Dh */
+  0x28, 0x07,			/* 432F jr z,4338h */
+  0xB7,				/* 4331 or a */
+  0x28, 0xF6,			/* 4332 jr z,432Ah */
+  0x12,				/* 4334 ld (de),a */
+  0x13,				/* 4335 inc de */
+  0x18, 0xF2,			/* 4336 jr 432Ah */
+  0xCD, 0x4B, 0x43,		/* 4338 call 434Bh */
+  0x21, 0xC3, 0x43,		/* 433B ld hl,43C3h */
+  0xCD, 0x43, 0x43,		/* 433E call 4343h */
+  0x18, 0xD6,			/* 4341 jr 4319h */
+  0x7E,				/* 4343 ld a,(hl) */
+  0xB7,				/* 4344 or a */
+  0xC8,				/* 4345 ret z */
+  0x12,				/* 4346 ld (de),a */
+  0x23,				/* 4347 inc hl */
+  0x13,				/* 4348 inc de */
+  0x18, 0xF8,			/* 4349 jr 4343h */
+  0x7B,				/* 434B ld a,e */
+  0xE6, 0xC0,			/* 434C and 0C0h */
+  0xC6, 0x40,			/* 434E add a,40h */
+  0x5F,				/* 4350 ld e,a */
+  0xD0,				/* 4351 ret nc */
+  0x14,				/* 4352 inc d */
+  0x7A,				/* 4353 ld a,d */
+  0xFE, 0x40,			/* 4354 cp 40h */
+  0xD8,				/* 4356 ret c */
+  0x16, 0x3C,			/* 4357 ld d,3Ch */
+  0xC9,				/* 4359 ret */
+  0x3A, 0x7F, 0x38,		/* 435A ld a,(387Fh) */
+  0xB7,				/* 435D or a */
+  0x28, 0xFA,			/* 435E jr z,435Ah */
+  0x21, 0x01, 0x38,		/* 4360 ld hl,3801h */
+  0x0E, 0x00,			/* 4363 ld c,0 */
+  0x7E,				/* 4365 ld a,(hl) */
+  0xB7,				/* 4366 or a */
+  0x20, 0x0B,			/* 4367 jr nz,4374h */
+  0x79,				/* 4369 ld a,c */
+  0xC6, 0x08,			/* 436A add a,8 */
+  0x4F,				/* 436C ld c,a */
+  0xCB, 0x25,			/* 436D sla l */
+  0xF2, 0x65, 0x43,		/* 436F jp p,4365h */
+  0x18, 0xE6,			/* 4372 jr 435Ah */
+  0x0F,				/* 4374 rrca */
+  0x38, 0x03,			/* 4375 jr c,437Ah */
+  0x0C,				/* 4377 inc c */
+  0x18, 0xFA,			/* 4378 jr 4374h */
+  0x79,				/* 437A ld a,c */
+  0xFE, 0x20,			/* 437B cp 32 */
+  0x30, 0x04,			/* 437D jr nc,4383h */
+  0xC6, 0x40,			/* 437F add a,40h */
+  0x18, 0x14,			/* 4381 jr 4397h */
+  0xFE, 0x30,			/* 4383 cp 48 */
+  0x30, 0x04,			/* 4385 jr nc,438Bh */
+  0xC6, 0x10,			/* 4387 add a,10h */
+  0x18, 0x0C,			/* 4389 jr 4397h */
+  0x3E, 0x0D,			/* 438B ld a,0Dh */
+  0x28, 0x08,			/* 438D jr z,4397h */
+  0x79,				/* 438F ld a,c */
+  0xFE, 0x37,			/* 4390 cp 55 */
+  0x3E, 0x20,			/* 4392 ld a,' ' */
+  0x28, 0x01,			/* 4394 jr z,4397h */
+  0xAF,				/* 4396 xor a */
+  0x47,				/* 4397 ld b,a */
+  0x3A, 0x7F, 0x38,		/* 4398 ld a,(387Fh) */
+  0xB7,				/* 439B or a */
+  0x20, 0xFA,			/* 439C jr nz,4398h */
+  0x78,				/* 439E ld a,b */
+  0xC9,				/* 439F ret */
+  0x53, 0x44, 0x4C, 0x54, 0x52, 0x53, 0x20, 0x42,	/* 43A0 db "SDLTRS BENCHMARK BOOT SECTOR",0 */
+  0x45, 0x4E, 0x43, 0x48, 0x4D, 0x41, 0x52, 0x4B,
+  0x20, 0x42, 0x4F, 0x4F, 0x54, 0x20, 0x53, 0x45,
+  0x43, 0x54, 0x4F, 0x52, 0x00,
+  0x52, 0x45, 0x41, 0x44, 0x59, 0x00,	/* 43BD db "READY",0 */
+  0x4F, 0x4B, 0x00,		/* 43C3 db "OK",0 */
+};
+
+/* Fill the text screen with one character after another */
+static const Uint8 fill_program[] = {
+  0x16, 0x20,			/* 8000 ld d,20h */
+  0x21, 0x00, 0x3C,		/* 8002 ld hl,3C00h */
+  0x01, 0x00, 0x04,		/* 8005 ld bc,0400h */
+  0x72,				/* 8008 ld (hl),d */
+  0x23,				/* 8009 inc hl */
+  0x0B,				/* 800A dec bc */
+  0x78,				/* 800B ld a,b */
+  0xB1,				/* 800C or c */
+  0x20, 0xF9,			/* 800D jr nz,8008h */
+  0x14,				/* 800F inc d */
+  0x18, 0xF0,			/* 8010 jr 8002h */
+};
+
+/* Arithmetic on a 4K buffer, without I/O */
+static const Uint8 compute_program[] = {
+  0x21, 0x00, 0x90,		/* 8000 ld hl,9000h */
+  0x01, 0x00, 0x10,		/* 8003 ld bc,1000h */
+  0x7E,				/* 8006 ld a,(hl) */
+  0x87,				/* 8007 add a,a */
+  0xCE, 0x07,			/* 8008 adc a,7 */
+  0x77,				/* 800A ld (hl),a */
+  0x23,				/* 800B inc hl */
+  0x0B,				/* 800C dec bc */
+  0x78,				/* 800D ld a,b */
+  0xB1,				/* 800E or c */
+  0x20, 0xF5,			/* 800F jr nz,8006h */
+  0x18, 0xED,			/* 8011 jr 8000h */
+};
+
+/* Redraw the whole Grafyx screen with otir, shifted by one every frame */
+static const Uint8 grafyx_program[] = {
+  0x3E, 0x81,			/* 8000 ld a,81h ; enable, Y not clocked */
+  0xD3, 0x83,			/* 8002 out (83h),a */
+  0x21, 0x00, 0x00,		/* 8004 ld hl,0000h */
+  0x1E, 0x00,			/* 8007 ld e,0 */
+  0x7B,				/* 8009 ld a,e */
+  0xD3, 0x81,			/* 800A out (81h),a */
+  0xAF,				/* 800C xor a */
+  0xD3, 0x80,			/* 800D out (80h),a */
+  0x01, 0x82, 0x50,		/* 800F ld bc,5082h */
+  0xED, 0xB3,			/* 8012 otir */
+  0x1C,				/* 8014 inc e */
+  0x7B,				/* 8015 ld a,e */
+  0xFE, 0xF0,			/* 8016 cp 240 */
+  0x20, 0xEF,			/* 8018 jr nz,8009h */
+  0x23,				/* 801A inc hl */
+  0x18, 0xEA,			/* 801B jr 8007h */
+};
+
+static const Scenario scenarios[] = {
+  { "boot", "Model 4P disk boot to a prompt, then a line typed in",
+    5, boot_sector, sizeof(boot_sector), NULL, 0,
+    "wait READY\n"
+    "type BENCH\\n\n"
+    "wait OK\n"
+    "quit\n" },
+  { "compute", "Z80 arithmetic loop for 20 seconds",
+    3, NULL, 0, compute_program, sizeof(compute_program),
+    "delay 20\n"
+    "quit\n" },
+  { "fill", "text screen fill loop for 20 seconds",
+    3, NULL, 0, fill_program, sizeof(fill_program),
+    "delay 20\n"
+    "quit\n" },
+  { "grafyx", "Grafyx full screen drawing for 20 seconds",
+    4, NULL, 0, grafyx_program, sizeof(grafyx_program),
+    "delay 20\n"
+    "quit\n" },
+  { "basic", "BASIC loop, needs a Model III ROM image",
+    3, NULL, 0, NULL, 0,
+    "wait Cass?\n"
+    "type \\n\n"
+    "wait Memory Size?\n"
+    "type \\n\n"
+    "wait READY\n"
+    "type 10 FOR I=1 TO 5000:A=A+SQR(I):NEXT:PRINT \"DO\";\"NE\"\\nRUN\\n\n"
+    "wait DONE\n"
+    "quit\n", BENCH_NEEDS_ROM3 },
+  { "dir", "directory listing, needs a bootable LDOS or LS-DOS disk",
+    0, NULL, 0, NULL, 0,
+    "wait Ready\n"
+    "type DIR :0\\n\n"
+    "wait Free\n"
+    "quit\n", BENCH_NEEDS_DISK },
+};
+
+int trs_bench = 0;
+
+static const Scenario *scenario;
+static char scenario_name[FILENAME_MAX];
+static char output_file[FILENAME_MAX];
+static char boot_disk[FILENAME_MAX];
+static Uint32 start_time;
+static tstate_t start_tstates;
+static Uint32 ticks;
+static int timed_out;
+
+static const Scenario *bench_find(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(scenarios) / sizeof(scenarios[0])); i++)
+    if (strcasecmp(name, scenarios[i].name) == 0)
+      return &scenarios[i];
+  return NULL;
+}
+
+void trs_bench_list(FILE *file)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(scenarios) / sizeof(scenarios[0])); i++)
+    fprintf(file, "  %-8s %s\n", scenarios[i].name, scenarios[i].description);
+}
+
+/*
+ * Select a scenario while the command line is parsed, before the screen
+ * is opened: the video and audio output go to SDL's dummy drivers.
+ */
+int trs_bench_select(const char *name)
+{
+  const char *script;
+  char line[1024];
+
+  scenario = bench_find(name);
+  snprintf(scenario_name, FILENAME_MAX, "%s", name);
+  if (scenario == NULL) {
+    if (trs_script_load(name) != 0) {
+      error("unknown benchmark '%s', built-in scenarios are:", name);
+      trs_bench_list(stderr);
+      return -1;
+    }
+  } else {
+    if (scenario->model)
+      trs_model = scenario->model;
+    for (script = scenario->script; *script; script += strcspn(script, "\n") + 1) {
+      snprintf(line, sizeof(line), "%.*s", (int)strcspn(script, "\n"), script);
+      trs_script_command(line);
+    }
+  }
+
+  trs_headless();
+  trs_bench = 1;
+  return 0;
+}
+
+/*
+ * Switch video and audio to SDL's dummy drivers before the screen is
+ * opened, for runs without a window such as benchmarks and fork mode.
+ */
+void trs_headless(void)
+{
+#ifdef SDL2
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+  SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+#else
+  putenv("SDL_VIDEODRIVER=dummy");
+  putenv("SDL_AUDIODRIVER=dummy");
+#endif
+  SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+  if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+    error("failed to initialize headless video: %s", SDL_GetError());
+  trs_sound = 0;
+}
+
+void trs_bench_output(const char *filename)
+{
+  snprintf(output_file, FILENAME_MAX, "%s", filename);
+}
+
+static void bench_report(void)
+{
+  FILE *file = stdout;
+  trs_perf_counters total;
+  Uint32 elapsed = SDL_GetTicks() - start_time;
+  tstate_t tstates = z80_state.t_count - start_tstates;
+  double seconds = (double)ticks / timer_hz;
+
+  if (output_file[0] && (file = fopen(output_file, "w")) == NULL) {
+    error("failed to write benchmark report %s: %s", output_file,
+          strerror(errno));
+    file = stdout;
+  }
+  trs_perf_totals(&total);
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"scenario\": \"%s\",\n", scenario ? scenario->name : "script");
+  fprintf(file, "  \"model\": %d,\n", trs_model);
+  fprintf(file, "  \"completed\": %s,\n", timed_out ? "false" : "true");
+  fprintf(file, "  \"host_seconds\": %.3f,\n", elapsed / 1000.0);
+  fprintf(file, "  \"emulated_seconds\": %.3f,\n", seconds);
+  fprintf(file, "  \"speedup\": %.2f,\n", elapsed ? seconds * 1000.0 / elapsed : 0.0);
+  fprintf(file, "  \"tstates\": %" TSTATE_T_LEN ",\n", tstates);
+  fprintf(file, "  \"instructions\": %" TSTATE_T_LEN ",\n", (tstate_t)total.instructions);
+  fprintf(file, "  \"mhz\": %.2f,\n", elapsed ? tstates / (elapsed * 1000.0) : 0.0);
+  fprintf(file, "  \"frames\": %u,\n", (unsigned int)total.frames);
+  fprintf(file, "  \"rects\": %u,\n", (unsigned int)total.rects);
+  fprintf(file, "  \"disk_bytes\": %u,\n", (unsigned int)total.disk_bytes);
+  fprintf(file, "  \"event_us\": %u,\n", (unsigned int)total.event_us);
+  fprintf(file, "  \"flush_us\": %u\n", (unsigned int)total.flush_us);
+  fprintf(file, "}\n");
+
+  if (file != stdout)
+    fclose(file);
+}
+
+static void bench_remove_disk(void)
+{
+  trs_disk_remove(0);
+  remove(boot_disk);
+}
+
+/* Write a JV3 image with the boot sector and insert it in drive 0 */
+static int bench_boot_disk(const Uint8 *boot, int size)
+{
+  FILE *file;
+  int i;
+#ifdef _WIN32
+  char *name = _tempnam(NULL, "bench");
+
+  if (name != NULL) {
+    snprintf(boot_disk, FILENAME_MAX, "%s", name);
+    free(name);
+  }
+  file = name ? fopen(boot_disk, "wb") : NULL;
+#else
+  const char *tmpdir = getenv("TMPDIR");
+  int fd;
+
+  snprintf(boot_disk, FILENAME_MAX, "%s/sdltrs-bench-XXXXXX",
+           tmpdir ? tmpdir : "/tmp");
+  file = (fd = mkstemp(boot_disk)) == -1 ? NULL : fdopen(fd, "wb");
+#endif
+  if (file == NULL) {
+    error("failed to create benchmark disk: %s", strerror(errno));
+    return -1;
+  }
+  atexit(bench_remove_disk);
+
+  /* Track 0, sector 1 in double density with 256 bytes, all others free */
+  putc(0, file);
+  putc(1, file);
+  putc(0x80, file);
+  for (i = 3; i < JV3_HEADER; i++)
+    putc(0xff, file);
+  fwrite(boot, size, 1, file);
+  for (i = size; i < 256; i++)
+    putc(0, file);
+  if (fclose(file) != 0) {
+    error("failed to write benchmark disk %s: %s", boot_disk, strerror(errno));
+    return -1;
+  }
+  trs_disk_insert(0, boot_disk);
+  return 0;
+}
+
+/* Check the files a scenario needs, once all options are known */
+static int bench_check_needs(const Scenario *s)
+{
+  FILE *file;
+
+  if (s->needs & BENCH_NEEDS_ROM3) {
+    if (romfile3[0] == 0 || (file = fopen(romfile3, "rb")) == NULL) {
+      error("benchmark %s needs a Model III ROM image, give it with -romfile3",
+            s->name);
+      return -1;
+    }
+    fclose(file);
+  }
+  if ((s->needs & BENCH_NEEDS_DISK) && trs_disk_getfilename(0)[0] == 0) {
+    error("benchmark %s needs a bootable LDOS or LS-DOS disk, "
+          "give it with -disk0", s->name);
+    return -1;
+  }
+  return 0;
+}
+
+/* Set up the scenario after the reset, right before the Z80 starts */
+void trs_bench_start(void)
+{
+  int i;
+
+  if (scenario != NULL) {
+    if (bench_check_needs(scenario) != 0)
+      exit(EXIT_FAILURE);
+    if (scenario->boot &&
+        bench_boot_disk(scenario->boot, scenario->boot_size) != 0)
+      exit(EXIT_FAILURE);
+    if (scenario->program) {
+      for (i = 0; i < scenario->program_size; i++)
+        mem_write(BENCH_START + i, scenario->program[i]);
+      Z80_PC = BENCH_START;
+    }
+  }
+  atexit(bench_report);
+  start_time = SDL_GetTicks();
+  start_tstates = z80_state.t_count;
+}
+
+/* Called once per timer tick instead of waiting for the host */
+void trs_bench_tick(void)
+{
+  if (++ticks > (Uint32)BENCH_TIMEOUT * timer_hz) {
+    error("benchmark %s did not finish in %d emulated seconds",
+          scenario_name, BENCH_TIMEOUT);
+    timed_out = 1;
+    exit(EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,19 @@
+/*
+ * trs_bench.h -- reproducible full-system benchmarks
+ */
+#ifndef _TRS_BENCH_H
+#define _TRS_BENCH_H
+
+#include <stdio.h>
+
+/* Non-zero while a benchmark runs: no throttling to real time */
+extern int trs_bench;
+
+extern int trs_bench_select(const char *name);
+extern void trs_bench_output(const char *filename);
+extern void trs_bench_list(FILE *file);
+extern void trs_bench_start(void);
+extern void trs_bench_tick(void);
+extern void trs_headless(void);
+
+#endif /* _TRS_BENCH_H */
@@ -59,6 +59,7 @@
 
 #include "error.h"
 #include "trs.h"
+#include "trs_perf.h"
 #include "trs_state_save.h"
 
 #ifndef SDL_memcpy
@@ -117,6 +118,8 @@ static Uint8 *sound_ring_read_ptr = sound_ring;
 static Uint8 *sound_ring_write_ptr = sound_ring;
 static Uint32 sound_ring_count = 0;
 static Uint8 *sound_ring_end = sound_ring + SOUND_RING_SIZE;
+/* Samples were queued since the sound last stopped */
+static int sound_ring_playing = FALSE;
 
 /* For bit-level emulation */
 static tstate_t cassette_transition;
@@ -346,6 +349,7 @@ put_sample(Uint8 sample, int convert, FILE* f)
         error("sample format 0x%x not supported", cassette_afmt);
         break;
     }
+    sound_ring_playing = TRUE;
     SDL_UnlockAudio();
     return;
   }
@@ -455,8 +459,22 @@ parse_wav_header(FILE *f)
   return 0;
 }
 
+/* The last samples are queued, the ring may now drain without underrun */
+static void sound_stopped(void)
+{
+  SDL_LockAudio();
+  sound_ring_playing = FALSE;
+  SDL_UnlockAudio();
+}
+
 static void trs_sdl_sound_update(void *userdata, Uint8 * stream, int len)
 {
+  /* Running short while sound plays is an underrun, the ring draining
+     after the sound stopped is not */
+  if (sound_ring_playing && !trs_paused &&
+      sound_ring_count < (unsigned int)len)
+    trs_perf_underruns++;
+
   if (sound_ring_count == 0) {
     SDL_memset(stream, cassette_silence, len);
   } else {
@@ -819,6 +837,8 @@ transition_out(int value)
     }
     if (value == FLUSH) {
       value = cassette_value;
+      if (cassette_format == DIRECT_FORMAT)
+        sound_stopped();
     }
     break;
 
@@ -1239,6 +1259,7 @@ trs_orch90_out(int channels, int value)
     trs_cancel_event();
   }
   if (value == FLUSH) {
+    sound_stopped();
     trs_schedule_event(assert_state_void, CLOSE, 5000000);
   } else {
     trs_schedule_event(orch90_flush, FLUSH,
@@ -1412,6 +1433,7 @@ trs_cassette_load(FILE *file)
   sound_ring_read_ptr = sound_ring;
   sound_ring_write_ptr = sound_ring;
   sound_ring_count = 0;
+  sound_ring_playing = FALSE;
   SDL_UnlockAudio();
   trs_load_int(file, &soundDeviceOpen, 1);
   if (currentOpened != soundDeviceOpen) {
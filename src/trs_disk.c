@@ -65,6 +65,9 @@
 #include "error.h"
 #include "trs_disk.h"
 #include "trs_hard.h"
+#include "trs_hostdir.h"
+#include "trs_overlay.h"
+#include "trs_perf.h"
 #include "trs_stringy.h"
 #include "trs_state_save.h"
 
@@ -227,6 +230,7 @@ typedef struct {
   int last_used_id;		  /* last used index */
   int nblocks;                    /* number of blocks of ids, 1 or 2 */
   int sorted_valid;               /* sorted_id array valid */
+  int nsorted;                    /* used ids in sorted_id, then sentinels */
   SectorId id[JV3_SECSMAX + 1];   /* extra one is a loop sentinel */
   int offset[JV3_SECSMAX + 1];    /* offset into file for each id */
   short sorted_id[JV3_SECSMAX + 1];
@@ -342,7 +346,7 @@ trs_disk_debug(void)
     } else {
       switch (d->emutype) {
       case JV1:
-	puts("JV1");
+	puts(trs_hostdir_stream(d->file) ? "JV1 (host directory)" : "JV1");
 	break;
       case JV3:
 	puts("JV3");
@@ -511,56 +515,129 @@ trs_disk_unimpl(Uint8 cmd, char* more)
   error("trs_disk_command(0x%02x) not implemented - %s", cmd, more);
 }
 
-/* Sort first by track, second by side, third by position in emulated-disk
-   sector array (i.e., physical sector order on track).  */
-static int
-jv3_id_compare(const void* p1, const void* p2)
-{
-  DiskState *d = &disk[state.curdrive];
-  int i1 = *(short*)p1;
-  int i2 = *(short*)p2;
-  int r = d->u.jv3.id[i1].track - d->u.jv3.id[i2].track;
-  if (r != 0) return r;
-  r = (d->u.jv3.id[i1].flags & JV3_SIDE) - (d->u.jv3.id[i2].flags & JV3_SIDE);
-  if (r != 0) return r;
-  return i1 - i2;
-}
+/* Used ids are sorted first by track, second by side, third by position
+   in emulated-disk sector array (i.e., physical sector order on track).
+   The id index is below 8192, so this key orders them all. */
+#define jv3_key(d, i) \
+  (((d)->u.jv3.id[i].track << 14) | \
+   (((d)->u.jv3.id[i].flags & JV3_SIDE) ? 1 << 13 : 0) | (i))
 
-/* (Re-)create the sorted_id data structure for the given drive */
+/* (Re-)create the sorted_id data structure, a counting sort by track and
+   side that keeps the ids of a track in order.  After this, sorted_id and
+   track_start are kept up to date by jv3_alloc_sector and jv3_free_sector,
+   so it is only needed when the disk is inserted or a state is loaded. */
 static void
-jv3_sort_ids(int drive)
+jv3_sort_ids(DiskState *d)
 {
-  DiskState *d = &disk[drive];
-  int olddrive = state.curdrive;
-  int i, track, side;
+  short next[MAXTRACKS][JV3_SIDES];
+  int i, track, side, n;
 
-  for (i = 0; i <= JV3_SECSMAX; i++) {
-    d->u.jv3.sorted_id[i] = i;
+  memset(next, 0, sizeof(next));
+  for (i = 0; i < JV3_SECSMAX; i++) {
+    SectorId *sid = &d->u.jv3.id[i];
+    if (sid->track != JV3_FREE) {
+      next[sid->track][sid->flags & JV3_SIDE ? 1 : 0]++;
+    }
   }
-  state.curdrive = drive;
-  qsort((void*) d->u.jv3.sorted_id, JV3_SECSMAX, sizeof(short),
-	jv3_id_compare);
-  state.curdrive = olddrive;
-
+  n = 0;
   for (track = 0; track < MAXTRACKS; track++) {
-    d->u.jv3.track_start[track][0] = -1;
-    d->u.jv3.track_start[track][1] = -1;
+    for (side = 0; side < JV3_SIDES; side++) {
+      int count = next[track][side];
+      d->u.jv3.track_start[track][side] = count ? n : -1;
+      next[track][side] = n;
+      n += count;
+    }
   }
-  track = side = -1;
   for (i = 0; i < JV3_SECSMAX; i++) {
-    SectorId *sid = &d->u.jv3.id[d->u.jv3.sorted_id[i]];
-    if (sid->track != track ||
-	(sid->flags & JV3_SIDE ? 1 : 0) != side) {
-      track = sid->track;
-      if (track == JV3_FREE) break;
-      side = sid->flags & JV3_SIDE ? 1 : 0;
-      d->u.jv3.track_start[track][side] = i;
+    SectorId *sid = &d->u.jv3.id[i];
+    if (sid->track != JV3_FREE) {
+      d->u.jv3.sorted_id[next[sid->track][sid->flags & JV3_SIDE ? 1 : 0]++] = i;
     }
   }
+  d->u.jv3.nsorted = n;
+  /* Free entries all point to the sentinel, which ends every scan */
+  for (i = n; i <= JV3_SECSMAX; i++) {
+    d->u.jv3.sorted_id[i] = JV3_SECSMAX;
+  }
 
   d->u.jv3.sorted_valid = 1;
 }
 
+/* Position of a used id in sorted_id, or where it goes */
+static int
+jv3_sorted_pos(DiskState *d, int id_index)
+{
+  int key = jv3_key(d, id_index);
+  int lo = 0, hi = d->u.jv3.nsorted;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (jv3_key(d, d->u.jv3.sorted_id[mid]) < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Move track_start of all tracks/sides after the given one */
+static void
+jv3_shift_starts(DiskState *d, int track, int side, int delta)
+{
+  int t, s;
+
+  for (t = track; t < MAXTRACKS; t++) {
+    for (s = (t == track) ? side + 1 : 0; s < JV3_SIDES; s++) {
+      if (d->u.jv3.track_start[t][s] != -1) {
+	d->u.jv3.track_start[t][s] += delta;
+      }
+    }
+  }
+}
+
+/* Insert a newly used id into sorted_id */
+static void
+jv3_index_add(DiskState *d, int id_index)
+{
+  int track = d->u.jv3.id[id_index].track;
+  int side = d->u.jv3.id[id_index].flags & JV3_SIDE ? 1 : 0;
+  int pos = jv3_sorted_pos(d, id_index);
+
+  memmove(&d->u.jv3.sorted_id[pos + 1], &d->u.jv3.sorted_id[pos],
+	  (d->u.jv3.nsorted - pos) * sizeof(short));
+  d->u.jv3.sorted_id[pos] = id_index;
+  d->u.jv3.nsorted++;
+  if (d->u.jv3.track_start[track][side] == -1) {
+    d->u.jv3.track_start[track][side] = pos;
+  }
+  jv3_shift_starts(d, track, side, 1);
+}
+
+/* Take an id that is about to be freed out of sorted_id */
+static void
+jv3_index_remove(DiskState *d, int id_index)
+{
+  int track = d->u.jv3.id[id_index].track;
+  int side = d->u.jv3.id[id_index].flags & JV3_SIDE ? 1 : 0;
+  int pos = jv3_sorted_pos(d, id_index);
+
+  if (pos >= d->u.jv3.nsorted || d->u.jv3.sorted_id[pos] != id_index) {
+    return;
+  }
+  d->u.jv3.nsorted--;
+  memmove(&d->u.jv3.sorted_id[pos], &d->u.jv3.sorted_id[pos + 1],
+	  (d->u.jv3.nsorted - pos) * sizeof(short));
+  d->u.jv3.sorted_id[d->u.jv3.nsorted] = JV3_SECSMAX;
+  if (d->u.jv3.track_start[track][side] == pos) {
+    SectorId *sid = &d->u.jv3.id[d->u.jv3.sorted_id[pos]];
+    if (sid->track != track || (sid->flags & JV3_SIDE ? 1 : 0) != side) {
+      d->u.jv3.track_start[track][side] = -1;
+    }
+  }
+  jv3_shift_starts(d, track, side, -1);
+}
+
 /* JV3 only */
 static int
 id_index_to_size_code(DiskState *d, int id_index)
@@ -628,16 +705,17 @@ idoffset(DiskState *d, int id_index)
   }
 }
 
+/* Allocate an id of the given size for a new sector and index it */
 static int
-jv3_alloc_sector(DiskState *d, int size_code)
+jv3_alloc_sector(DiskState *d, int size_code, int track, int sector,
+		 int flags)
 {
   int maybe = d->u.jv3.free_id[size_code];
-  d->u.jv3.sorted_valid = 0;
   while (maybe <= d->u.jv3.last_used_id) {
     if (d->u.jv3.id[maybe].track == JV3_FREE &&
 	id_index_to_size_code(d, maybe) == size_code) {
       d->u.jv3.free_id[size_code] = maybe + 1;
-      return maybe;
+      goto found;
     }
     maybe++;
   }
@@ -651,7 +729,14 @@ jv3_alloc_sector(DiskState *d, int size_code)
   if (d->u.jv3.last_used_id + 1 == JV3_SECSPERBLK) {
       d->u.jv3.offset[d->u.jv3.last_used_id + 1] += JV3_SECSTART;
   }
-  return d->u.jv3.last_used_id;
+  maybe = d->u.jv3.last_used_id;
+
+ found:
+  d->u.jv3.id[maybe].track = track;
+  d->u.jv3.id[maybe].sector = sector;
+  d->u.jv3.id[maybe].flags = flags;
+  if (d->u.jv3.sorted_valid) jv3_index_add(d, maybe);
+  return maybe;
 }
 
 static void
@@ -662,7 +747,7 @@ jv3_free_sector(DiskState *d, int id_index)
   if (d->u.jv3.free_id[size_code] > id_index) {
     d->u.jv3.free_id[size_code] = id_index;
   }
-  d->u.jv3.sorted_valid = 0;
+  if (d->u.jv3.sorted_valid) jv3_index_remove(d, id_index);
   d->u.jv3.id[id_index].track = JV3_FREE;
   d->u.jv3.id[id_index].sector = JV3_FREE;
   d->u.jv3.id[id_index].flags =
@@ -685,12 +770,17 @@ jv3_free_sector(DiskState *d, int id_index)
     } else {
       newlen = offset(d, 0);
     }
+    if (trs_overlay_stream(d->file)) {
+      c = trs_overlay_truncate(d->file, newlen);
+      if (c == EOF) state.status |= TRSDISK_WRITEFLT;
+    } else {
 #ifdef _WIN32
-    chsize(fileno(d->file), newlen);
+      chsize(fileno(d->file), newlen);
 #else
-    c = ftruncate(fileno(d->file), newlen);
-    if (c == EOF) state.status |= TRSDISK_WRITEFLT;
+      c = ftruncate(fileno(d->file), newlen);
+      if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 #endif
+    }
   }
 }
 
@@ -764,6 +854,34 @@ trs_disk_remove(int drive)
   d->writeprot = 0;
 }
 
+/* Switch inserted disk images to private copy-on-write overlays */
+void
+trs_disk_overlay(void)
+{
+  int i;
+
+  for (i = 0; i < NDRIVES; i++) {
+    DiskState *d = &disk[i];
+    FILE *file;
+
+    if (d->file == NULL || d->emutype == REAL || trs_overlay_stream(d->file))
+      continue;
+    if (trs_hostdir_stream(d->file)) {
+      trs_hostdir_private(d->file);
+      continue;
+    }
+    fflush(d->file);
+    file = trs_overlay_open(d->filename);
+    if (file == NULL) {
+      error("failed to open overlay for disk%d: %s: %s", i, d->filename,
+          strerror(errno));
+      continue;
+    }
+    fclose(d->file);
+    d->file = file;
+  }
+}
+
 void
 trs_disk_insert(int drive, const char *diskname)
 {
@@ -782,6 +900,19 @@ trs_disk_insert(int drive, const char *diskname)
     error("failed to open disk image %s: %s", diskname, strerror(errno));
     return;
   }
+  if (S_ISDIR(st.st_mode)) {
+    /* Host directory, shown as a JV1 image built in memory */
+    d->file = trs_hostdir_open(diskname, !trs_overlay || trs_overlay_commit);
+    if (d->file == NULL) {
+      d->filename[0] = 0;
+      d->writeprot = 0;
+      return;
+    }
+    d->writeprot = access(diskname, W_OK) != 0;
+    d->emutype = JV1;
+    snprintf(d->filename, FILENAME_MAX, "%s", diskname);
+    return;
+  }
   #if __linux
   if (S_ISBLK(st.st_mode)) {
     /* Real floppy drive */
@@ -818,13 +949,19 @@ trs_disk_insert(int drive, const char *diskname)
   } else
 #endif
   {
-    d->file = fopen(diskname, "rb+");
-    if (d->file == NULL) {
-      d->file = fopen(diskname, "rb");
+    if (trs_overlay) {
+      d->file = trs_overlay_open(diskname);
       if (d->file == NULL) return;
-      d->writeprot = 1;
+      d->writeprot = access(diskname, W_OK) != 0;
     } else {
-      d->writeprot = 0;
+      d->file = fopen(diskname, "rb+");
+      if (d->file == NULL) {
+        d->file = fopen(diskname, "rb");
+        if (d->file == NULL) return;
+        d->writeprot = 1;
+      } else {
+        d->writeprot = 0;
+      }
     }
     trs_disk_emutype(d);
     snprintf(d->filename, FILENAME_MAX, "%s", diskname);
@@ -873,7 +1010,7 @@ trs_disk_insert(int drive, const char *diskname)
 	d->u.jv3.last_used_id = id_index;
       }
     }
-    jv3_sort_ids(drive);
+    jv3_sort_ids(d);
   } else if (d->emutype == DMK) {
     fseek(d->file, DMK_NTRACKS, 0);
     d->u.dmk.ntracks = (Uint8) getc(d->file);
@@ -1001,7 +1138,7 @@ search(int sector, int side)
       state.status |= TRSDISK_NOTFOUND;
       return -1;
     }
-    if (!d->u.jv3.sorted_valid) jv3_sort_ids(state.curdrive);
+    if (!d->u.jv3.sorted_valid) jv3_sort_ids(d);
     i = d->u.jv3.track_start[d->phytrack][state.curside];
     if (i != -1) {
       for (;;) {
@@ -1125,7 +1262,7 @@ search_adr(void)
 	state.curside >= JV3_SIDES || d->file == NULL) {
       return -1;
     }
-    if (!d->u.jv3.sorted_valid) jv3_sort_ids(state.curdrive);
+    if (!d->u.jv3.sorted_valid) jv3_sort_ids(d);
     return d->u.jv3.track_start[d->phytrack][state.curside];
   }
 }
@@ -1394,6 +1531,8 @@ trs_disk_data_read(void)
   case TRSDISK_READ:
     if (state.bytecount > 0 && (state.status & TRSDISK_DRQ)) {
       int c;
+
+      trs_perf.disk_bytes++;
       if (d->emutype == REAL) {
 	c = d->u.real.buf[size_code_to_size(d->u.real.size_code)
 			 - state.bytecount];
@@ -1571,6 +1710,7 @@ trs_disk_data_write(Uint8 data)
   switch (state.currcommand & TRSDISK_CMDMASK) {
   case TRSDISK_WRITE:
     if (state.bytecount > 0) {
+      trs_perf.disk_bytes++;
       if (d->emutype == REAL) {
 	d->u.real.buf[size_code_to_size(d->u.real.size_code)
 		     - state.bytecount] = data;
@@ -1919,7 +2059,9 @@ trs_disk_data_write(Uint8 data)
       }
       if (d->emutype == JV3) {
 	int id_index;
-	id_index = jv3_alloc_sector(d, data);
+	id_index = jv3_alloc_sector(d, data, d->phytrack, state.format_sec,
+	  (state.curside ? JV3_SIDE : 0) | (state.density ? JV3_DENSITY : 0) |
+	  ((data & 3) ^ 1));
 	if (id_index == -1) {
 	  /* Data structure full */
 	  state.status |= TRSDISK_WRITEFLT;
@@ -1928,12 +2070,6 @@ trs_disk_data_write(Uint8 data)
 	  state.format = FMT_DONE;
 	  break;
 	}
-	d->u.jv3.sorted_valid = 0;
-	d->u.jv3.id[id_index].track = d->phytrack;
-	d->u.jv3.id[id_index].sector = state.format_sec;
-	d->u.jv3.id[id_index].flags =
-	  (state.curside ? JV3_SIDE : 0) | (state.density ? JV3_DENSITY : 0) |
-	  ((data & 3) ^ 1);
 	state.format_sec = id_index;
 
       } else if (d->emutype == REAL) {
@@ -3782,12 +3918,15 @@ static void trs_load_diskstate(FILE *file, DiskState *d)
   else
     d->file = NULL;
   trs_load_filename(file, d->filename);
-  if (d->emutype == JV3)
+  if (d->emutype == JV3) {
     trs_load_jv3state(file, &d->u.jv3);
-  else if (d->emutype == REAL)
+    /* nsorted is not saved, rebuild the index on the next search */
+    d->u.jv3.sorted_valid = 0;
+  } else if (d->emutype == REAL) {
     trs_load_realstate(file, &d->u.real);
-  else
+  } else {
     trs_load_dmkstate(file, &d->u.dmk);
+  }
 }
 
 void trs_disk_save(FILE *file)
@@ -3809,11 +3948,23 @@ void trs_disk_save(FILE *file)
 
 void trs_disk_load(FILE *file)
 {
+  FILE *overlay[NDRIVES];
+  char filename[NDRIVES][FILENAME_MAX];
+  struct stat st;
   int i;
 
+  /* Overlays and host directories hold changes that are not in the image
+     yet, so keep them if the same image is inserted after loading */
   for (i = 0; i < NDRIVES; i++) {
-    if (disk[i].file != NULL)
-      fclose(disk[i].file);
+    overlay[i] = NULL;
+    if (disk[i].file != NULL) {
+      if (trs_overlay_stream(disk[i].file) ||
+          trs_hostdir_stream(disk[i].file)) {
+        overlay[i] = disk[i].file;
+        snprintf(filename[i], FILENAME_MAX, "%s", disk[i].filename);
+      } else
+        fclose(disk[i].file);
+    }
   }
   trs_load_int(file, &trs_disk_nocontroller, 1);
   trs_load_int(file, &trs_disk_doubler, 1);
@@ -3824,7 +3975,37 @@ void trs_disk_load(FILE *file)
   trs_fdc_load(file, &other_state);
   for (i = 0; i < NDRIVES; i++) {
     trs_load_diskstate(file, &disk[i]);
-     if (disk[i].file != NULL) {
+    if (overlay[i] != NULL) {
+      if (disk[i].file != NULL && disk[i].emutype != REAL &&
+          strcmp(disk[i].filename, filename[i]) == 0) {
+        disk[i].file = overlay[i];
+        continue;
+      }
+      fclose(overlay[i]);
+    }
+    if (disk[i].file != NULL && disk[i].emutype == JV1 &&
+        stat(disk[i].filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+      disk[i].file = trs_hostdir_open(disk[i].filename,
+          !trs_overlay || trs_overlay_commit);
+      if (disk[i].file == NULL) {
+        disk[i].emutype = NONE;
+        disk[i].writeprot = 0;
+        disk[i].filename[0] = 0;
+      }
+      continue;
+    }
+    if (disk[i].file != NULL && trs_overlay && disk[i].emutype != REAL) {
+      disk[i].file = trs_overlay_open(disk[i].filename);
+      if (disk[i].file == NULL) {
+        error("failed to load disk%d: %s: %s", i, disk[i].filename,
+            strerror(errno));
+        disk[i].emutype = NONE;
+        disk[i].writeprot = 0;
+        disk[i].filename[0] = 0;
+      }
+      continue;
+    }
+    if (disk[i].file != NULL) {
       disk[i].file = fopen(disk[i].filename, "rb+");
       if (disk[i].file == NULL) {
         disk[i].file = fopen(disk[i].filename, "rb");
@@ -51,6 +51,7 @@ extern int trs_disk_getdisktype(int unit);
 
 extern void trs_disk_insert(int drive, const char *diskname);
 extern void trs_disk_remove(int drive);
+extern void trs_disk_overlay(void);
 
 extern int trs_diskset_save(const char *filename);
 extern int trs_diskset_load(const char *filename);
@@ -30,10 +30,13 @@
 
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include "error.h"
 #include "trs.h"
 #include "trs_hard.h"
 #include "trs_imp_exp.h"
+#include "trs_overlay.h"
+#include "trs_perf.h"
 #include "trs_state_save.h"
 
 #include "reed.h"
@@ -121,6 +124,10 @@ void trs_hard_init(void)
 
 void trs_hard_attach(int drive, const char *diskname)
 {
+  if (state.d[drive].file != NULL) {
+    fclose(state.d[drive].file);
+    state.d[drive].file = NULL;
+  }
   snprintf(state.d[drive].filename, FILENAME_MAX, "%s", diskname);
   if (open_drive(drive) < 0) {
     trs_hard_remove(drive);
@@ -137,6 +144,29 @@ void trs_hard_remove(int drive)
   state.d[drive].file = NULL;
 }
 
+/* Switch attached hard drive images to private copy-on-write overlays */
+void trs_hard_overlay(void)
+{
+  int i;
+
+  for (i = 0; i < TRS_HARD_MAXDRIVES; i++) {
+    Drive *d = &state.d[i];
+    FILE *file;
+
+    if (d->file == NULL || trs_overlay_stream(d->file))
+      continue;
+    fflush(d->file);
+    file = trs_overlay_open(d->filename);
+    if (file == NULL) {
+      error("failed to open overlay for hard%d: %s: %s", i, d->filename,
+          strerror(errno));
+      continue;
+    }
+    fclose(d->file);
+    d->file = file;
+  }
+}
+
 char*
 trs_hard_getfilename(int unit)
 {
@@ -170,6 +200,7 @@ int trs_hard_in(int port)
       break;
     case TRS_HARD_DATA:
       v = hard_data_in();
+      trs_perf.disk_bytes++;
       break;
     case TRS_HARD_ERROR:
       v = state.error;
@@ -228,6 +259,7 @@ void trs_hard_out(int port, int value)
     break;
   case TRS_HARD_DATA:
     hard_data_out(value);
+    trs_perf.disk_bytes++;
     break;
   case TRS_HARD_PRECOMP:
     break;
@@ -402,6 +434,11 @@ static int open_drive(int drive)
   size_t res;
   int err = 0;
 
+  if (d->file != NULL && trs_overlay_stream(d->file)) {
+    /* Reopening would throw away the changes held by the overlay */
+    rewind(d->file);
+    goto header;
+  }
   if (d->file != NULL) {
     fclose(d->file);
     d->file = NULL;
@@ -409,6 +446,18 @@ static int open_drive(int drive)
   if (d->filename[0] == 0)
     goto fail;
 
+  if (trs_overlay) {
+    d->file = trs_overlay_open(d->filename);
+    if (d->file == NULL) {
+      error("trs_hard: could not open hard drive image %s: %s",
+	    d->filename, strerror(errno));
+      err = errno;
+      goto fail;
+    }
+    d->writeprot = access(d->filename, W_OK) != 0;
+    goto header;
+  }
+
   /* First try opening for reading and writing */
   d->file = fopen(d->filename, "rb+");
   if (d->file == NULL) {
@@ -428,6 +477,7 @@ static int open_drive(int drive)
   }
 
   /* Read in the Reed header and check some basic magic numbers (not all) */
+ header:
   res = fread(&rhh, sizeof(rhh), 1, d->file);
   if (res != 1 || rhh.id1 != 0x56 || rhh.id2 != 0xcb || rhh.ver != 0x10) {
     error("trs_hard: unrecognized hard drive image %s", d->filename);
@@ -603,11 +653,20 @@ void trs_hard_save(FILE *file)
 
 void trs_hard_load(FILE *file)
 {
+  FILE *overlay[TRS_HARD_MAXDRIVES];
+  char filename[TRS_HARD_MAXDRIVES][FILENAME_MAX];
   int i;
 
+  /* Keep overlays of images which are still attached after loading */
   for (i = 0; i < TRS_HARD_MAXDRIVES; i++) {
-    if (state.d[i].file != NULL)
-      fclose(state.d[i].file);
+    overlay[i] = NULL;
+    if (state.d[i].file != NULL) {
+      if (trs_overlay_stream(state.d[i].file)) {
+        overlay[i] = state.d[i].file;
+        snprintf(filename[i], FILENAME_MAX, "%s", state.d[i].filename);
+      } else
+        fclose(state.d[i].file);
+    }
   }
   trs_load_int(file, &state.present, 1);
   trs_load_uchar(file, &state.control, 1);
@@ -623,6 +682,24 @@ void trs_hard_load(FILE *file)
   trs_load_int(file, &state.bytesdone, 1);
   for (i = 0; i < TRS_HARD_MAXDRIVES; i++) {
     trs_load_harddrive(file, &state.d[i]);
+    if (overlay[i] != NULL) {
+      if (state.d[i].file != NULL &&
+          strcmp(state.d[i].filename, filename[i]) == 0) {
+        state.d[i].file = overlay[i];
+        continue;
+      }
+      fclose(overlay[i]);
+    }
+    if (state.d[i].file != NULL && trs_overlay) {
+      state.d[i].file = trs_overlay_open(state.d[i].filename);
+      if (state.d[i].file == NULL) {
+        error("failed to load hard%d: %s: %s", i, state.d[i].filename,
+            strerror(errno));
+        state.d[i].filename[0] = 0;
+        state.d[i].writeprot = 0;
+      }
+      continue;
+    }
     if (state.d[i].file != NULL) {
       state.d[i].file = fopen(state.d[i].filename, "rb+");
       if (state.d[i].file == NULL) {
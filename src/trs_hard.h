@@ -34,6 +34,7 @@
 extern void trs_hard_init(void);
 extern void trs_hard_attach(int drive, const char *diskname);
 extern void trs_hard_remove(int drive);
+extern void trs_hard_overlay(void);
 extern int trs_hard_in(int port);
 extern void trs_hard_out(int port, int value);
 extern char trs_disk_dir[];
@@ -0,0 +1,747 @@
+/*
+ * trs_hostdir.c -- a host directory presented as an LDOS floppy image
+ *
+ * A directory inserted into a floppy drive is shown to the disk emulation
+ * as a JV1 image built in memory: a single-sided, single-density LDOS 5
+ * data disk with 40 tracks of 10 sectors and the directory on track 17.
+ * It holds the regular files of the directory whose names fit the 8/3
+ * scheme of the TRS-80, up to the capacity of the disk.  All sectors
+ * stay in memory, so reading and writing the disk never touches the
+ * host directory.
+ *
+ * Each time the TRS-80 writes a directory entry sector, which DOS does
+ * when a file is closed, the files of that sector are read back out of
+ * the image and the ones whose contents changed are written to the host
+ * directory, new files with lower case names.  Writes of the GAT and
+ * HIT, and entries whose extents changed, belong to a file still being
+ * extended and are left for a later write; new empty files are skipped
+ * for the same reason.  Files killed or renamed on the TRS-80 are left
+ * alone on the host.
+ */
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <SDL_types.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_hostdir.h"
+
+#define HD_TRACKS	40
+#define HD_SECTORS	10		/* per track */
+#define HD_SECSIZE	256
+#define HD_TRACKSIZE	(HD_SECTORS * HD_SECSIZE)
+#define HD_DIRTRACK	17		/* JV1 marks this track as directory */
+#define HD_GRANS	2		/* granules per track */
+#define HD_GRANSIZE	(HD_TRACKSIZE / HD_GRANS)
+#define HD_ENTRIES	((HD_SECTORS - 2) * 8)
+#define HD_EXTENTS	4		/* in the entry, the fifth is the link */
+#define HD_KNOWN	256		/* files remembered, with renamed ones */
+#define HD_NOPASSWORD	0xef5c		/* hash of a blank password */
+
+/* Directory entry attributes */
+#define HD_ATTR_FXDE	0x80
+#define HD_ATTR_SYS	0x40
+#define HD_ATTR_USED	0x10
+#define HD_ATTR_INV	0x08
+
+/* fopencookie() on glibc and musl, funopen() on the BSDs */
+#if defined(__linux) || defined(__GLIBC__)
+#define HOSTDIR_COOKIE
+#endif
+#ifdef __GLIBC__
+typedef off64_t hostdir_off_t;		/* as cookie_seek_function_t wants */
+#else
+typedef off_t hostdir_off_t;
+#endif
+
+#if defined(HOSTDIR_COOKIE) || defined(__APPLE__) || defined(__FreeBSD__) || \
+    defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define HOSTDIR_SUPPORT
+
+#include <dirent.h>
+
+typedef struct {
+  Uint8 name[11];			/* TRS-80 name, blank padded */
+  char *host;				/* in the host directory, NULL if
+					   the file is not to be written */
+  Uint32 hash;				/* of the contents last seen */
+} HostFile;
+
+typedef struct hostdir {
+  FILE *file;
+  char *dirname;
+  Uint8 *image;
+  off_t size;
+  off_t pos;
+  int writeback;
+  int dirty;
+  Uint8 dir[HD_TRACKSIZE];		/* directory track as last synced */
+  HostFile known[HD_KNOWN];
+  int nknown;
+  struct hostdir *next;
+} HostDir;
+
+static HostDir *hostdirs;
+
+static HostDir *hostdir_find(FILE *file)
+{
+  HostDir *h;
+
+  for (h = hostdirs; h != NULL; h = h->next) {
+    if (h->file == file)
+      return h;
+  }
+  return NULL;
+}
+
+static Uint32 hostdir_hash(const Uint8 *data, size_t size)
+{
+  Uint32 hash = 2166136261U;
+
+  while (size-- > 0)
+    hash = (hash ^ *data++) * 16777619U;
+  return hash;
+}
+
+/* Hash of a file name for the HIT, as LDOS computes it */
+static Uint8 hostdir_hit(const Uint8 *name)
+{
+  Uint8 hash = 0;
+  int i;
+
+  for (i = 0; i < 11; i++) {
+    hash ^= name[i];
+    hash = (hash << 1) | (hash >> 7);
+  }
+  return hash ? hash : 1;
+}
+
+static Uint8 *hostdir_sector(HostDir *h, int track, int sector)
+{
+  off_t offset = ((off_t)track * HD_SECTORS + sector) * HD_SECSIZE;
+
+  if (offset + HD_SECSIZE > h->size)
+    return NULL;
+  return h->image + offset;
+}
+
+/* Directory entry for a DEC (directory entry code) */
+static Uint8 *hostdir_entry(HostDir *h, int dirtrack, int dec)
+{
+  Uint8 *sector;
+
+  if ((dec & 0x1f) >= HD_SECTORS - 2)
+    return NULL;
+  if ((sector = hostdir_sector(h, dirtrack, 2 + (dec & 0x1f))) == NULL)
+    return NULL;
+  return sector + (dec >> 5) * 32;
+}
+
+/* Make a TRS-80 name from a host name, return -1 if it does not fit */
+static int hostdir_trsname(const char *host, Uint8 *name)
+{
+  const char *dot = strrchr(host, '.');
+  size_t len = dot ? (size_t)(dot - host) : strlen(host);
+  size_t i;
+
+  if (len < 1 || len > 8 || !isalpha((unsigned char)host[0]) ||
+      (dot && (strlen(dot + 1) < 1 || strlen(dot + 1) > 3)))
+    return -1;
+  memset(name, ' ', 11);
+  for (i = 0; i < len; i++) {
+    if (!isalnum((unsigned char)host[i]))
+      return -1;
+    name[i] = toupper((unsigned char)host[i]);
+  }
+  for (i = 0; dot && dot[i + 1]; i++) {
+    if (!isalnum((unsigned char)dot[i + 1]))
+      return -1;
+    name[8 + i] = toupper((unsigned char)dot[i + 1]);
+  }
+  return 0;
+}
+
+static int hostdir_compare(const void *p1, const void *p2)
+{
+  return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+/* Add a file to the list of known ones, host NULL to never write it */
+static HostFile *hostdir_remember(HostDir *h, const Uint8 *name,
+                                  const char *host, Uint32 hash)
+{
+  HostFile *known;
+
+  if (h->nknown >= HD_KNOWN)
+    return NULL;
+  known = &h->known[h->nknown++];
+  memcpy(known->name, name, 11);
+  known->host = host ? strdup(host) : NULL;
+  known->hash = hash;
+  return known;
+}
+
+/* Put a file into the next free granules and a directory entry */
+static int hostdir_add(HostDir *h, const char *host, const Uint8 *name,
+                       const Uint8 *data, size_t size, int *granule, int dec)
+{
+  Uint8 *entry = hostdir_entry(h, HD_DIRTRACK, dec);
+  Uint8 *gat = hostdir_sector(h, HD_DIRTRACK, 0);
+  int const grans = (size + HD_GRANSIZE - 1) / HD_GRANSIZE;
+  int extents = 0;
+  int prev = -2;
+  int run = 0;
+  int g, n;
+
+  /* Check that the file fits before taking anything */
+  for (g = *granule, n = 0; n < grans; g++) {
+    if (g >= HD_TRACKS * HD_GRANS)
+      return -1;
+    if (g / HD_GRANS == HD_DIRTRACK)
+      continue;
+    if (g != prev + 1 || run == 32) {
+      extents++;
+      run = 0;
+    }
+    prev = g;
+    run++;
+    n++;
+  }
+  if (extents > HD_EXTENTS || h->nknown >= HD_KNOWN)
+    return -1;
+
+  memset(entry, 0, 32);
+  entry[0] = HD_ATTR_USED;
+  entry[3] = size % HD_SECSIZE;
+  memcpy(entry + 5, name, 11);
+  entry[16] = entry[18] = HD_NOPASSWORD & 0xff;
+  entry[17] = entry[19] = HD_NOPASSWORD >> 8;
+  entry[20] = (size / HD_SECSIZE) & 0xff;
+  entry[21] = (size / HD_SECSIZE) >> 8;
+  memset(entry + 22, 0xff, 10);
+  hostdir_sector(h, HD_DIRTRACK, 1)[dec] = hostdir_hit(name);
+
+  extents = 0;
+  prev = -2;
+  for (n = 0; n < grans; (*granule)++) {
+    size_t const done = (size_t)n * HD_GRANSIZE;
+    Uint8 *extent = entry + 20 + extents * 2;	/* the last one */
+
+    g = *granule;
+    if (g / HD_GRANS == HD_DIRTRACK)
+      continue;
+    if (g != prev + 1 || (extent[1] & 0x1f) == 0x1f) {
+      extent += 2;
+      extent[0] = g / HD_GRANS;
+      extent[1] = (g % HD_GRANS) << 5;
+      extents++;
+    } else {
+      extent[1]++;
+    }
+    gat[g / HD_GRANS] |= 1 << (g % HD_GRANS);
+    memcpy(h->image + (off_t)g * HD_GRANSIZE, data + done,
+           size - done < HD_GRANSIZE ? size - done : HD_GRANSIZE);
+    prev = g;
+    n++;
+  }
+
+  hostdir_remember(h, name, host, hostdir_hash(data, size));
+  return 0;
+}
+
+/* Read a file into memory, NULL if it cannot be read */
+static Uint8 *hostdir_read(const char *path, size_t *size)
+{
+  FILE *f = fopen(path, "rb");
+  Uint8 *data;
+  long len;
+
+  if (f == NULL)
+    return NULL;
+  if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 ||
+      (data = malloc(len + 1)) == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  rewind(f);
+  if (fread(data, 1, len, f) != (size_t)len) {
+    free(data);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+  *size = len;
+  return data;
+}
+
+/* Lay out an empty data disk, then add the files of the directory */
+static int hostdir_build(HostDir *h)
+{
+  static const Uint8 boot_sys[11] = "BOOT    SYS";
+  static const Uint8 dir_sys[11] = "DIR     SYS";
+  char path[FILENAME_MAX];
+  char **names = NULL;
+  int nnames = 0;
+  Uint8 *gat, *entry;
+  Uint8 name[11];
+  const char *base;
+  struct dirent *de;
+  struct stat st;
+  time_t now = time(NULL);
+  DIR *dir;
+  int granule = 1;		/* granule 0 holds BOOT/SYS */
+  int i, j, dec;
+
+  h->size = (off_t)HD_TRACKS * HD_TRACKSIZE;
+  if ((h->image = calloc(1, h->size)) == NULL)
+    return -1;
+  h->image[1] = 0xfe;
+  h->image[2] = HD_DIRTRACK;
+
+  gat = hostdir_sector(h, HD_DIRTRACK, 0);
+  memset(gat, 0xff, 0xc0);
+  for (i = 0; i < HD_TRACKS; i++)
+    gat[i] = gat[0x60 + i] = 0xfc;
+  gat[0] |= 0x01;
+  gat[HD_DIRTRACK] = 0xff;
+  gat[0xcb] = 0x51;
+  gat[0xcc] = HD_TRACKS - 35;
+  gat[0xcd] = 0x80 | (HD_GRANS - 1);
+  gat[0xce] = HD_NOPASSWORD & 0xff;
+  gat[0xcf] = HD_NOPASSWORD >> 8;
+  base = strrchr(h->dirname, DIR_SLASH);
+  base = (base && base[1]) ? base + 1 : h->dirname;
+  memset(gat + 0xd0, ' ', 8);
+  for (i = j = 0; base[i] && j < 8; i++) {
+    if (isalnum((unsigned char)base[i]))
+      gat[0xd0 + j++] = toupper((unsigned char)base[i]);
+  }
+  strftime((char *)gat + 0xd8, 9, "%m/%d/%y", localtime(&now));
+  gat[0xe0] = 0x0d;
+
+  for (i = 0; i < 2; i++) {
+    entry = hostdir_entry(h, HD_DIRTRACK, i);
+    entry[0] = HD_ATTR_SYS | HD_ATTR_USED | HD_ATTR_INV | 6;
+    memcpy(entry + 5, i ? dir_sys : boot_sys, 11);
+    entry[16] = entry[18] = HD_NOPASSWORD & 0xff;
+    entry[17] = entry[19] = HD_NOPASSWORD >> 8;
+    entry[20] = i ? HD_SECTORS : HD_SECTORS / HD_GRANS;
+    entry[22] = i ? HD_DIRTRACK : 0;
+    entry[23] = i ? HD_GRANS - 1 : 0;
+    memset(entry + 24, 0xff, 8);
+    hostdir_sector(h, HD_DIRTRACK, 1)[i] = hostdir_hit(entry + 5);
+  }
+
+  if ((dir = opendir(h->dirname)) == NULL)
+    return -1;
+  while ((de = readdir(dir)) != NULL) {
+    char **more;
+
+    if (hostdir_trsname(de->d_name, name) < 0)
+      continue;
+    if ((more = realloc(names, (nnames + 1) * sizeof(char *))) == NULL)
+      break;
+    names = more;
+    if ((names[nnames] = strdup(de->d_name)) != NULL)
+      nnames++;
+  }
+  closedir(dir);
+  if (nnames > 1)
+    qsort(names, nnames, sizeof(char *), hostdir_compare);
+
+  /* The first entry of each directory sector is kept for system files */
+  dec = 0x20;
+  for (i = 0; i < nnames; i++) {
+    Uint8 *data;
+    size_t size;
+
+    snprintf(path, FILENAME_MAX, "%s%c%s", h->dirname, DIR_SLASH, names[i]);
+    hostdir_trsname(names[i], name);
+    for (j = 0; j < h->nknown; j++) {
+      if (memcmp(h->known[j].name, name, 11) == 0)
+        break;
+    }
+    if (j < h->nknown || stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+      continue;
+    /* Files left out are remembered so the TRS-80 cannot replace them */
+    if (dec >= HD_ENTRIES / (HD_SECTORS - 2) << 5) {
+      error("%s: directory is full, %s skipped", h->dirname, names[i]);
+      hostdir_remember(h, name, NULL, 0);
+      continue;
+    }
+    if ((data = hostdir_read(path, &size)) == NULL) {
+      error("failed to read %s: %s", path, strerror(errno));
+      hostdir_remember(h, name, NULL, 0);
+      continue;
+    }
+    if (hostdir_add(h, names[i], name, data, size, &granule, dec) < 0) {
+      error("%s: disk is full, %s skipped", h->dirname, names[i]);
+      hostdir_remember(h, name, NULL, 0);
+    } else if ((++dec & 0x1f) == HD_SECTORS - 2) {
+      dec = (dec & ~0x1f) + 0x20;
+    }
+    free(data);
+  }
+  for (i = 0; i < nnames; i++)
+    free(names[i]);
+  free(names);
+  return 0;
+}
+
+/* Collect the data of a file from its extents, NULL if they are bad */
+static Uint8 *hostdir_extract(HostDir *h, int dirtrack, int grans,
+                              const Uint8 *entry, size_t *size)
+{
+  size_t total = (entry[20] | (entry[21] << 8)) * HD_SECSIZE + entry[3];
+  size_t done = 0;
+  int links = 0;
+  Uint8 *data;
+  int i;
+
+  if ((data = malloc(total + 1)) == NULL)
+    return NULL;
+  while (done < total) {
+    for (i = 0; i < HD_EXTENTS && done < total; i++) {
+      const Uint8 *extent = entry + 22 + i * 2;
+      int g = extent[0] * grans + (extent[1] >> 5);
+      int count = (extent[1] & 0x1f) + 1;
+      off_t offset;
+      size_t len;
+
+      if (extent[0] >= 0xfe)
+        break;
+      while (count-- > 0 && done < total) {
+        offset = (off_t)(g / grans) * HD_TRACKSIZE +
+          (off_t)(g % grans) * (HD_TRACKSIZE / grans);
+        len = HD_TRACKSIZE / grans;
+        if (len > total - done)
+          len = total - done;
+        if (offset + (off_t)len > h->size)
+          goto bad;
+        memcpy(data + done, h->image + offset, len);
+        done += len;
+        g++;
+      }
+    }
+    if (done >= total)
+      break;
+    /* Follow the link to the extended entry */
+    if (entry[30] != 0xfe || ++links > HD_ENTRIES ||
+        (entry = hostdir_entry(h, dirtrack, entry[31])) == NULL ||
+        !(entry[0] & HD_ATTR_FXDE))
+      goto bad;
+  }
+  *size = total;
+  return data;
+
+bad:
+  free(data);
+  return NULL;
+}
+
+/*
+ * Write the files changed by the TRS-80 into the host directory, only
+ * those with entries in directory sectors first to last when a sector
+ * was written, or all of them with first < 0 when the disk is closed.
+ */
+static void hostdir_sync(HostDir *h, int first, int last)
+{
+  char path[FILENAME_MAX];
+  char host[13];			/* 8/3 plus the dot */
+  struct stat st;
+  int dirtrack = h->image[2];
+  int grans = (hostdir_sector(h, dirtrack, 0) ?
+               (hostdir_sector(h, dirtrack, 0)[0xcd] & 7) + 1 : HD_GRANS);
+  int dec, i, j;
+
+  h->dirty = 0;
+  if (!h->writeback)
+    return;
+  if (HD_SECTORS % grans)
+    grans = HD_GRANS;
+
+  for (dec = 0; dec < 256; dec++) {
+    Uint8 *entry = hostdir_entry(h, dirtrack, dec);
+    HostFile *known = NULL;
+    Uint8 *data;
+    size_t size;
+    Uint32 hash;
+    FILE *f;
+
+    if (entry == NULL || (entry[0] & (HD_ATTR_FXDE | HD_ATTR_SYS |
+                                      HD_ATTR_USED)) != HD_ATTR_USED)
+      continue;
+    if (first >= 0) {
+      int const sector = 2 + (dec & 0x1f);
+
+      if (sector < first || sector > last)
+        continue;
+      /* New extents or link: the file is still being extended */
+      if (memcmp(h->dir + sector * HD_SECSIZE + (dec >> 5) * 32 + 22,
+                 entry + 22, 10) != 0)
+        continue;
+    }
+    for (i = 0; i < h->nknown; i++) {
+      if (memcmp(h->known[i].name, entry + 5, 11) == 0) {
+        known = &h->known[i];
+        break;
+      }
+    }
+    if (known != NULL && known->host == NULL)
+      continue;
+    if (known == NULL) {
+      /* New file, named in lower case if the name is valid */
+      if (!isalpha(entry[5]))
+        continue;
+      for (i = j = 0; i < 11; i++) {
+        Uint8 const c = entry[5 + i];
+
+        if (c == ' ')
+          continue;
+        if (!isalnum(c))
+          break;
+        if (i >= 8 && memchr(host, '.', j) == NULL)
+          host[j++] = '.';
+        host[j++] = tolower(c);
+      }
+      host[j] = 0;
+      if (i < 11)
+        continue;
+    }
+    if ((data = hostdir_extract(h, dirtrack, grans, entry, &size)) == NULL)
+      continue;
+    if (known == NULL && size == 0) {
+      free(data);
+      continue;
+    }
+    hash = hostdir_hash(data, size);
+    if (known && known->hash == hash) {
+      free(data);
+      continue;
+    }
+
+    snprintf(path, FILENAME_MAX, "%s%c%s", h->dirname, DIR_SLASH,
+             known ? known->host : host);
+    if (known == NULL && stat(path, &st) == 0) {
+      error("%s: %s was created on the host, not replaced", h->dirname, host);
+      hostdir_remember(h, entry + 5, NULL, 0);
+      free(data);
+      continue;
+    }
+    if ((f = fopen(path, "wb")) == NULL ||
+        fwrite(data, 1, size, f) != size) {
+      error("failed to write %s: %s", path, strerror(errno));
+      if (f)
+        fclose(f);
+      free(data);
+      continue;
+    }
+    if (fclose(f) != 0)
+      error("failed to write %s: %s", path, strerror(errno));
+    free(data);
+
+    if (known == NULL)
+      hostdir_remember(h, entry + 5, host, hash);
+    else
+      known->hash = hash;
+  }
+}
+
+static ssize_t hostdir_read_image(void *cookie, char *buf, size_t size)
+{
+  HostDir *h = cookie;
+
+  if (h->pos >= h->size)
+    return 0;
+  if ((off_t)size > h->size - h->pos)
+    size = h->size - h->pos;
+  memcpy(buf, h->image + h->pos, size);
+  h->pos += size;
+  return size;
+}
+
+static ssize_t hostdir_write_image(void *cookie, const char *buf, size_t size)
+{
+  HostDir *h = cookie;
+  off_t const dir = (off_t)h->image[2] * HD_TRACKSIZE;
+
+  if (h->pos + (off_t)size > h->size) {
+    Uint8 *image = realloc(h->image, h->pos + size);
+
+    if (image == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    memset(image + h->size, 0, h->pos + size - h->size);
+    h->image = image;
+    h->size = h->pos + size;
+  }
+  memcpy(h->image + h->pos, buf, size);
+  h->dirty = 1;
+  if (h->pos < dir + HD_TRACKSIZE && h->pos + (off_t)size > dir &&
+      dir + HD_TRACKSIZE <= h->size) {
+    int const first = (h->pos > dir ? h->pos - dir : 0) / HD_SECSIZE;
+    int const last = ((h->pos + (off_t)size < dir + HD_TRACKSIZE ?
+                       h->pos + (off_t)size - dir : HD_TRACKSIZE) - 1) /
+                     HD_SECSIZE;
+
+    hostdir_sync(h, first, last);
+    memcpy(h->dir + first * HD_SECSIZE, h->image + dir + first * HD_SECSIZE,
+           (last - first + 1) * HD_SECSIZE);
+  }
+  h->pos += size;
+  return size;
+}
+
+static int hostdir_seek(void *cookie, hostdir_off_t *offset, int whence)
+{
+  HostDir *h = cookie;
+  off_t pos;
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = *offset;
+      break;
+    case SEEK_CUR:
+      pos = h->pos + *offset;
+      break;
+    case SEEK_END:
+      pos = h->size + *offset;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (pos < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  *offset = h->pos = pos;
+  return 0;
+}
+
+static void hostdir_free(HostDir *h)
+{
+  int i;
+
+  for (i = 0; i < h->nknown; i++)
+    free(h->known[i].host);
+  free(h->image);
+  free(h->dirname);
+  free(h);
+}
+
+static int hostdir_close(void *cookie)
+{
+  HostDir *h = cookie;
+  HostDir **p;
+
+  if (h->dirty)
+    hostdir_sync(h, -1, -1);
+  for (p = &hostdirs; *p != NULL; p = &(*p)->next) {
+    if (*p == h) {
+      *p = h->next;
+      break;
+    }
+  }
+  hostdir_free(h);
+  return 0;
+}
+
+/* Close all host directories at exit, so changes get written out */
+static void hostdir_cleanup(void)
+{
+  while (hostdirs != NULL)
+    fclose(hostdirs->file);
+}
+
+#ifdef HOSTDIR_COOKIE
+static cookie_io_functions_t hostdir_functions = {
+  hostdir_read_image, hostdir_write_image, hostdir_seek, hostdir_close
+};
+#else
+static int hostdir_funread(void *cookie, char *buf, int size)
+{
+  return hostdir_read_image(cookie, buf, size);
+}
+
+static int hostdir_funwrite(void *cookie, const char *buf, int size)
+{
+  return hostdir_write_image(cookie, buf, size);
+}
+
+static fpos_t hostdir_funseek(void *cookie, fpos_t offset, int whence)
+{
+  hostdir_off_t pos = offset;
+
+  if (hostdir_seek(cookie, &pos, whence) < 0)
+    return -1;
+  return pos;
+}
+#endif
+#endif /* HOSTDIR_SUPPORT */
+
+FILE *trs_hostdir_open(const char *dirname, int writeback)
+{
+#ifdef HOSTDIR_SUPPORT
+  static int registered;
+  HostDir *h;
+
+  if (!registered) {
+    atexit(hostdir_cleanup);
+    registered = 1;
+  }
+  if ((h = calloc(1, sizeof(HostDir))) == NULL)
+    return NULL;
+  if ((h->dirname = strdup(dirname)) == NULL || hostdir_build(h) < 0) {
+    error("failed to read directory %s: %s", dirname, strerror(errno));
+    hostdir_free(h);
+    return NULL;
+  }
+  h->writeback = writeback;
+  memcpy(h->dir, hostdir_sector(h, HD_DIRTRACK, 0), HD_TRACKSIZE);
+
+#ifdef HOSTDIR_COOKIE
+  h->file = fopencookie(h, "r+", hostdir_functions);
+#else
+  h->file = funopen(h, hostdir_funread, hostdir_funwrite,
+                    hostdir_funseek, hostdir_close);
+#endif
+  if (h->file == NULL) {
+    hostdir_free(h);
+    return NULL;
+  }
+  h->next = hostdirs;
+  hostdirs = h;
+  return h->file;
+#else
+  error("directory as disk not supported on this platform: '%s'", dirname);
+  errno = ENOSYS;
+  return NULL;
+#endif
+}
+
+int trs_hostdir_stream(FILE *file)
+{
+#ifdef HOSTDIR_SUPPORT
+  return hostdir_find(file) != NULL;
+#else
+  return 0;
+#endif
+}
+
+void trs_hostdir_private(FILE *file)
+{
+#ifdef HOSTDIR_SUPPORT
+  HostDir *h = hostdir_find(file);
+
+  if (h != NULL)
+    h->writeback = 0;
+#endif
+}
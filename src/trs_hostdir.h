@@ -0,0 +1,17 @@
+/*
+ * trs_hostdir.h -- a host directory presented as an LDOS floppy image
+ */
+#ifndef _TRS_HOSTDIR_H
+#define _TRS_HOSTDIR_H
+
+#include <stdio.h>
+
+/* Build a JV1 image of the files in dirname and return a read-write
+   stream on it.  With writeback set, files changed by the TRS-80 are
+   written to the directory whenever its directory track is written. */
+extern FILE *trs_hostdir_open(const char *dirname, int writeback);
+extern int trs_hostdir_stream(FILE *file);
+/* Keep all further changes in memory, as for an overlay */
+extern void trs_hostdir_private(FILE *file);
+
+#endif /* _TRS_HOSTDIR_H */
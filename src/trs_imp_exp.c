@@ -37,6 +37,7 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <SDL.h>
 #include "error.h"
 #include "trs.h"
 #include "trs_disk.h"
@@ -72,6 +73,198 @@ typedef struct {
 static OpenDisk od[MAX_OPENDISK];
 static int xtrshard_fd[4] = {-1,-1,-1,-1};
 
+/*
+ * With trs_emt_latency set, emt_read and emt_write are done by an I/O
+ * thread.  The trap is executed again, 8 T-states each time, until the
+ * latency has passed in emulated time; then it waits for the thread if
+ * needed and completes.  The Z80 sees the same timing on every run,
+ * while the display and sound go on during large transfers.  After a
+ * read, the thread reads ahead on the same descriptor.  All other traps
+ * on descriptors wait for the thread first.
+ */
+int trs_emt_latency = 0; /* in microseconds of emulated time */
+
+#define EMT_READ  1
+#define EMT_WRITE 2
+#define EMT_AHEAD 65536
+
+typedef struct {
+  int op;         /* EMT_READ or EMT_WRITE, 0 when idle */
+  int done;       /* the thread has finished the operation */
+  Uint16 pc;      /* address of the trap */
+  int fd;
+  Uint16 address;
+  int size;
+  int result;     /* bytes transferred, or -1 with errno in error */
+  int error;
+  tstate_t deadline;
+  Uint8 buf[0x10000];
+} EmtRequest;
+
+static EmtRequest emt_req;
+static struct {
+  int fd;         /* -1 if nothing was read ahead */
+  off_t off;
+  int len;
+  int eof;        /* the file ended in the read-ahead */
+  Uint8 buf[EMT_AHEAD];
+} emt_ahead = { -1 };
+static SDL_Thread *emt_thread;
+static SDL_sem *emt_go, *emt_done;
+static SDL_mutex *emt_lock; /* held by the thread while it works */
+
+static void emt_io_read(void)
+{
+  off_t const off = lseek(emt_req.fd, 0, SEEK_CUR);
+  off_t const end = emt_ahead.off + emt_ahead.len;
+  int size = emt_req.size;
+
+  if (emt_ahead.fd == emt_req.fd && off != (off_t) -1 &&
+      off >= emt_ahead.off && off <= end &&
+      (off + size <= end || emt_ahead.eof)) {
+    if (off + size > end)
+      size = end - off;
+    memcpy(emt_req.buf, emt_ahead.buf + (off - emt_ahead.off), size);
+    lseek(emt_req.fd, off + size, SEEK_SET);
+    emt_req.result = size;
+  } else {
+    emt_req.result = read(emt_req.fd, emt_req.buf, size);
+    emt_req.error = errno;
+  }
+}
+
+/* Read the data after a sequential read, leaving the position as it was */
+static void emt_io_ahead(int fd)
+{
+  off_t const off = lseek(fd, 0, SEEK_CUR);
+
+  if (off == (off_t) -1 || (emt_ahead.fd == fd && (emt_ahead.eof ||
+      off + EMT_AHEAD / 2 <= emt_ahead.off + emt_ahead.len)))
+    return;
+  emt_ahead.fd = -1;
+  emt_ahead.len = read(fd, emt_ahead.buf, EMT_AHEAD);
+  lseek(fd, off, SEEK_SET);
+  if (emt_ahead.len >= 0) {
+    emt_ahead.fd = fd;
+    emt_ahead.off = off;
+    emt_ahead.eof = emt_ahead.len < EMT_AHEAD;
+  }
+}
+
+static int emt_io(void *data)
+{
+  int op, fd, result;
+
+  for (;;) {
+    SDL_SemWait(emt_go);
+    SDL_LockMutex(emt_lock);
+    op = emt_req.op;
+    if (op == EMT_READ) {
+      emt_io_read();
+    } else {
+      emt_ahead.fd = -1;
+      emt_req.result = write(emt_req.fd, emt_req.buf, emt_req.size);
+      emt_req.error = errno;
+    }
+    /* The next request may be filled in as soon as this one is done */
+    fd = emt_req.fd;
+    result = emt_req.result;
+    SDL_SemPost(emt_done);
+    if (op == EMT_READ && result > 0)
+      emt_io_ahead(fd);
+    SDL_UnlockMutex(emt_lock);
+  }
+  return 0;
+}
+
+/* Wait until the I/O thread is idle, keeping the result of a request */
+static void emt_io_wait(void)
+{
+  if (emt_req.op && !emt_req.done) {
+    SDL_SemWait(emt_done);
+    emt_req.done = 1;
+  }
+  if (emt_lock) {
+    SDL_LockMutex(emt_lock);
+    SDL_UnlockMutex(emt_lock);
+  }
+}
+
+/* Before other traps on descriptors, which may change the files */
+static void emt_io_sync(void)
+{
+  emt_io_wait();
+  emt_ahead.fd = -1;
+}
+
+/*
+ * Returns FALSE if the trap should be done at once, else it has been
+ * submitted, is waiting or has completed.
+ */
+static int emt_async(int op)
+{
+  Uint16 const pc = Z80_PC - 2;
+
+  if (trs_emt_latency <= 0 && emt_req.op == 0)
+    return FALSE;
+  if (emt_req.op && (emt_req.op != op || emt_req.pc != pc)) {
+    /* Another trap, from an interrupt handler: do it at once */
+    emt_io_sync();
+    return FALSE;
+  }
+
+  if (emt_thread == NULL) {
+    emt_go = SDL_CreateSemaphore(0);
+    emt_done = SDL_CreateSemaphore(0);
+    emt_lock = SDL_CreateMutex();
+#ifdef SDL2
+    emt_thread = SDL_CreateThread(emt_io, "Emulator trap I/O", NULL);
+#else
+    emt_thread = SDL_CreateThread(emt_io, NULL);
+#endif
+    if (emt_thread == NULL) {
+      error("failed to create emulator trap I/O thread: %s", SDL_GetError());
+      trs_emt_latency = 0;
+      return FALSE;
+    }
+  }
+
+  if (emt_req.op == 0) {
+    emt_req.op = op;
+    emt_req.done = 0;
+    emt_req.pc = pc;
+    emt_req.fd = Z80_DE;
+    emt_req.address = Z80_HL;
+    emt_req.size = Z80_BC;
+    emt_req.deadline = z80_state.t_count +
+      (tstate_t)(trs_emt_latency * z80_state.clockMHz);
+    if (op == EMT_WRITE)
+      memcpy(emt_req.buf, mem_pointer(Z80_HL, 0), Z80_BC);
+    SDL_SemPost(emt_go);
+  }
+  if (z80_state.t_count < emt_req.deadline) {
+    /* Execute the trap again */
+    Z80_PC = pc;
+    T_COUNT(8);
+    return TRUE;
+  }
+
+  if (!emt_req.done)
+    SDL_SemWait(emt_done);
+  if (op == EMT_READ && emt_req.result > 0)
+    memcpy(mem_pointer(emt_req.address, 1), emt_req.buf, emt_req.result);
+  if (emt_req.result >= 0) {
+    Z80_A = 0;
+    Z80_F |= ZERO_MASK;
+  } else {
+    Z80_A = emt_req.error;
+    Z80_F &= ~ZERO_MASK;
+  }
+  Z80_BC = emt_req.result;
+  emt_req.op = 0;
+  return TRUE;
+}
+
 void do_emt_system(void)
 {
   int res;
@@ -212,6 +405,7 @@ void do_emt_open(void)
     Z80_F &= ~ZERO_MASK;
     return;
   }
+  emt_io_sync();
   fd = open((char *)mem_pointer(Z80_HL, 0), oflag, Z80_DE);
   if (fd >= 0) {
     Z80_A = 0;
@@ -225,6 +419,7 @@ void do_emt_open(void)
 
 void do_emt_close(void)
 {
+  emt_io_sync();
   if (close(Z80_DE) >= 0) {
     Z80_A = 0;
     Z80_F |= ZERO_MASK;
@@ -251,6 +446,8 @@ void do_emt_read(void)
         trs_hard_led(i, 1);
     }
   }
+  if (emt_async(EMT_READ))
+    return;
   size = read(Z80_DE, mem_pointer(Z80_HL, 1), Z80_BC);
   if (size >= 0) {
     Z80_A = 0;
@@ -280,6 +477,8 @@ void do_emt_write(void)
         trs_hard_led(i, 1);
     }
   }
+  if (emt_async(EMT_WRITE))
+    return;
   size = write(Z80_DE, mem_pointer(Z80_HL, 0), Z80_BC);
   if (size >= 0) {
     Z80_A = 0;
@@ -304,6 +503,8 @@ void do_emt_lseek(void)
   for (i = 0; i < 8; i++) {
     offset = offset + (mem_read(Z80_HL + i) << i*8);
   }
+  /* The read-ahead is kept, it is checked against the position */
+  emt_io_wait();
   offset = lseek(Z80_DE, offset, Z80_BC);
   if (offset != (off_t) -1) {
     Z80_A = 0;
@@ -620,6 +821,7 @@ void do_emt_ftruncate(void)
   for (i = 0; i < 8; i++) {
     offset = offset + (mem_read(Z80_HL + i) << i*8);
   }
+  emt_io_sync();
 #ifdef _WIN32
   result = chsize(Z80_DE, offset);
 #else
@@ -666,6 +868,7 @@ void do_emt_opendisk(void)
     Z80_F &= ~ZERO_MASK;
     return;
   }
+  emt_io_sync();
   od[i].fd = open(trs_hard_getfilename(drive), O_RDWR);
   if (od[i].fd < 0) {
     od[i].fd = open(trs_hard_getfilename(drive), O_RDONLY);
@@ -687,6 +890,8 @@ void do_emt_opendisk(void)
 int do_emt_closefd(int odindex)
 {
   int i;
+
+  emt_io_sync();
   if (od[odindex].xtrshard) {
     for (i = 0; i < 4; i++) {
       if (xtrshard_fd[i] == od[odindex].fd)
@@ -750,6 +955,7 @@ void trs_imp_exp_save(FILE *file)
   int one = 1;
   int zero = 0;
 
+  emt_io_wait();
   for (i = 0; i < MAX_OPENDIR; i++) {
     if (dir[i].dir == NULL)
       trs_save_int(file, &zero, 1);
@@ -770,6 +976,9 @@ void trs_imp_exp_load(FILE *file)
 {
   int i, dir_present;
 
+  /* A trap in progress starts again */
+  emt_io_sync();
+  emt_req.op = 0;
   /* Close any open dirs and files */
   for (i = 0; i < MAX_OPENDIR; i++) {
     if (dir[i].dir)
@@ -816,6 +1025,7 @@ trs_impexp_xtrshard_attach(int drive)
 {
   int i;
 
+  emt_io_sync();
   for (i = 0; i < MAX_OPENDISK; i++) {
     if (od[i].inuse && od[i].xtrshard && (od[i].xtrshard_unit == drive)) {
       close(od[i].fd);
@@ -830,6 +1040,7 @@ trs_impexp_xtrshard_remove(int drive)
 {
   int i;
 
+  emt_io_sync();
   for (i = 0; i < MAX_OPENDISK; i++) {
     if (od[i].inuse && od[i].xtrshard && (od[i].xtrshard_unit == drive)) {
       close(od[i].fd);
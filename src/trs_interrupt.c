@@ -32,6 +32,8 @@
 #include <unistd.h>
 #include <SDL.h>
 #include "trs.h"
+#include "trs_bench.h"
+#include "trs_perf.h"
 #include "trs_state_save.h"
 
 /*#define IDEBUG 1*/
@@ -334,10 +336,20 @@ void trs_timer_sync_with_host(void)
   Uint32 curtime;
   static Uint32 lasttime = 0;
 
+  if (trs_bench) {
+    trs_bench_tick();
+    trs_timer_event();
+    return;
+  }
+
   curtime = SDL_GetTicks();
 
-  if (lasttime + deltatime > curtime)
+  if (lasttime + deltatime > curtime) {
+    Uint32 sleep_start = trs_perf_time();
+
     SDL_Delay(lasttime + deltatime - curtime);
+    trs_perf.sleep_us += trs_perf_time() - sleep_start;
+  }
 
   curtime = SDL_GetTicks();
 
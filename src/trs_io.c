@@ -38,11 +38,12 @@
  */
 
 /*
- * Debug flags.  Update help_message in debug.c if these change.
+ * Debug flags are IOPORT_TRACE_IN and IOPORT_TRACE_OUT in trs.h.
  */
-#define IODEBUG_IN  (1 << 0)  /* IN instructions */
-#define IODEBUG_OUT (2 << 0)  /* OUT instructions */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "error.h"
@@ -60,13 +61,120 @@ static int ctrlimage = 0;   /* Model 4/4p */
 static int rominimage = 0;  /* Model 4p */
 
 int trs_io_debug_flags = 0;
+Uint8 trs_io_ports[256];
+
+/*
+ * Traced port accesses go into a ring buffer, decoded only at exit,
+ * so a busy controller can be traced at full speed.
+ */
+#define IOTRACE_SIZE 4096 /* power of two */
+
+static struct {
+  tstate_t t_count;
+  Uint16 pc;
+  Uint8 port;
+  Uint8 value;
+  Uint8 access; /* IOPORT_TRACE_IN or IOPORT_TRACE_OUT */
+} io_trace[IOTRACE_SIZE];
+static unsigned int io_trace_next;
+static int io_trace_selected;
+static char io_trace_file[FILENAME_MAX];
+
+static void io_trace_port(int port, int value, int access)
+{
+  int flags = trs_io_ports[port] | trs_io_debug_flags;
+
+  if (flags & access) {
+    unsigned int i = io_trace_next++ & (IOTRACE_SIZE - 1);
+
+    io_trace[i].t_count = z80_state.t_count;
+    io_trace[i].pc = z80_state.pc.word;
+    io_trace[i].port = port;
+    io_trace[i].value = value;
+    io_trace[i].access = access;
+  }
+#ifdef ZBX
+  /* The break bits are the trace bits shifted left by two */
+  if (flags & (access << 2))
+    debug_io(port, value, access << 2);
+#endif
+}
+
+/* Write the traced port accesses, oldest first, to the trace file */
+static void io_trace_exit(void)
+{
+  FILE *file;
+  unsigned int i;
+
+  if ((file = fopen(io_trace_file, "w")) == NULL) {
+    error("failed to write I/O trace %s: %s", io_trace_file, strerror(errno));
+    return;
+  }
+  i = io_trace_next > IOTRACE_SIZE ? io_trace_next - IOTRACE_SIZE : 0;
+  for (; i != io_trace_next; i++) {
+    int n = i & (IOTRACE_SIZE - 1);
+
+    if (io_trace[n].access == IOPORT_TRACE_OUT)
+      fprintf(file, "%" TSTATE_T_LEN ": out (0x%02x), 0x%02x; pc 0x%04x\n",
+          io_trace[n].t_count, io_trace[n].port, io_trace[n].value,
+          io_trace[n].pc);
+    else
+      fprintf(file, "%" TSTATE_T_LEN ": in (0x%02x) => 0x%02x; pc 0x%04x\n",
+          io_trace[n].t_count, io_trace[n].port, io_trace[n].value,
+          io_trace[n].pc);
+  }
+  fclose(file);
+}
+
+/* Trace port accesses; the last ones are written to filename at exit */
+void trs_io_trace_start(const char *filename)
+{
+  static int registered;
+
+  snprintf(io_trace_file, FILENAME_MAX, "%s", filename);
+  if (!registered) {
+    atexit(io_trace_exit);
+    registered = 1;
+  }
+  if (!io_trace_selected)
+    trs_io_debug_flags = IOPORT_TRACE_IN | IOPORT_TRACE_OUT;
+}
+
+/* Trace only the ports in a list like "e8-eb,f0" instead of all */
+void trs_io_trace_ports(const char *ports)
+{
+  char *next;
+
+  trs_io_debug_flags = 0;
+  io_trace_selected = 1;
+  while (*ports) {
+    unsigned long first = strtoul(ports, &next, 16);
+    unsigned long last = first;
+
+    if (next == ports || first > 0xff)
+      break;
+    if (*next == '-') {
+      ports = next + 1;
+      last = strtoul(ports, &next, 16);
+      if (next == ports || last > 0xff)
+        break;
+    }
+    for (; first <= last; first++)
+      trs_io_ports[first] |= IOPORT_TRACE_IN | IOPORT_TRACE_OUT;
+    if (*next == '\0')
+      return;
+    if (*next != ',')
+      break;
+    ports = next + 1;
+  }
+  error("bad I/O port list: %s", ports);
+}
 
 /*ARGSUSED*/
 void z80_out(int port, int value)
 {
-  if (trs_io_debug_flags & IODEBUG_OUT) {
-    debug("out (0x%02x), 0x%02x; pc 0x%04x\n", port, value, z80_state.pc.word);
-  }
+  if (trs_io_ports[port] | trs_io_debug_flags)
+    io_trace_port(port, value, IOPORT_TRACE_OUT);
 
   /* First, ports common to all models */
   switch (port) {
@@ -563,9 +671,8 @@ int z80_in(int port)
   }
 
  done:
-  if (trs_io_debug_flags & IODEBUG_IN) {
-    debug("in (0x%02x) => 0x%02x; pc %04x\n", port, value, z80_state.pc.word);
-  }
+  if (trs_io_ports[port] | trs_io_debug_flags)
+    io_trace_port(port, value, IOPORT_TRACE_IN);
 
   return value;
 }
@@ -105,6 +105,10 @@ static unsigned int supermem_hi;
 static int selector_reg = 0;
 static int m_a11_flipflop;
 
+#ifdef ZBX
+Uint8 mem_watch_pages[256];
+#endif
+
 void mem_video_page(int which)
 {
     video_offset = -VIDEO_START + (which ? VIDEO_PAGE_1 : VIDEO_PAGE_0);
@@ -383,10 +387,16 @@ static int trs80_model1_ram(int address)
   return memory[offset];
 }
 
-static int trs80_model1_mmio(int address)
+static int trs80_model1_mmio(int address, int peek)
 {
   if (address >= VIDEO_START) return video[address + video_offset];
   if (address < trs_rom_size) return rom[address];
+  /* Reading the devices below has side effects, a peek gets 0xff */
+  if (peek) {
+    if (address >= 0x3900 && selector)
+      return trs80_model1_ram(address);
+    return 0xff;
+  }
   if (address == TRSDISK_DATA) return trs_disk_data_read();
   if (TRS_INTLATCH(address)) return trs_interrupt_latch_read();
   if (address == TRSDISK_STATUS) return trs_disk_status_read();
@@ -400,10 +410,14 @@ static int trs80_model1_mmio(int address)
   return 0xff;
 }
 
-int mem_read(int address)
+/*
+ * Read through the memory map.  With peek set, nothing is read that has
+ * side effects: the keyboard, the printer and the disk controller read
+ * as 0xff, so the debugger, disassembler, tracer and profiler can look
+ * at memory without disturbing the machine.
+ */
+static int mem_fetch(int address, int peek)
 {
-    address &= 0xffff; /* allow callers to be sloppy */
-
     /* There are some adapters that sit above the system and
        either intercept before the hardware proper, or adjust
        the address. Deal with these first so that we take their
@@ -418,53 +432,57 @@ int mem_read(int address)
     switch (memory_map) {
       case 0x10: /* Model I */
         if (address < RAM_START)
-	  return trs80_model1_mmio(address & 0x3FFF);
+	  return trs80_model1_mmio(address & 0x3FFF, peek);
 	else
 	  return trs80_model1_ram(address);
       case 0x11: /* Model 1: selector mode 1 (all RAM except I/O high */
         if (address >= 0xF7E0 && address <= 0xF7FF)
-          return trs80_model1_mmio(address & 0x3FFF);
+          return trs80_model1_mmio(address & 0x3FFF, peek);
 	return trs80_model1_ram(address);
       case 0x12: /* Model 1 selector mode 2 (ROM disabled) */
         if (address < 0x37E0)
           return trs80_model1_ram(address);
 	if (address < RAM_START)
-	  return trs80_model1_mmio(address);
+	  return trs80_model1_mmio(address, peek);
 	return trs80_model1_ram(address);
       case 0x13: /* Model 1: selector mode 3 (CP/M mode) */
         if (address >= 0xF7E0)
-          return trs80_model1_mmio(address & 0x3FFF);
+          return trs80_model1_mmio(address & 0x3FFF, peek);
 	/* Fall through */
       case 0x14: /* Model 1: All RAM banking high */
       case 0x15: /* Model 1: All RAM banking low */
 	return trs80_model1_ram(address);
       case 0x16: /* Model 1: Low 16K in top 16K */
 	if (address < RAM_START)
-	  return trs80_model1_mmio(address);
+	  return trs80_model1_mmio(address, peek);
 	return trs80_model1_ram(address);
       case 0x17: /* Model 1: Described in the selector doc as 'not useful' */
         return 0xFF;	/* Not clear what really happens */
 
       case 0x30: /* Model III */
 	if (address >= RAM_START) return memory[address];
-	if (address == PRINTER_ADDRESS)	return trs_printer_read();
+	if (address == PRINTER_ADDRESS)
+	  return peek ? 0xff : trs_printer_read();
 	if (address < trs_rom_size) return rom[address];
 	if (address >= VIDEO_START) {
 	  return grafyx_m3_read_byte(address - VIDEO_START);
 	}
-	if (address >= KEYBOARD_START) return trs_kb_mem_read(address);
+	if (address >= KEYBOARD_START)
+	  return peek ? 0xff : trs_kb_mem_read(address);
 	return 0xff;
 
       case 0x40: /* Model 4 map 0 */
 	if (address >= RAM_START) {
 	    return memory[address + bank_offset[address >> 15]];
 	}
-	if (address == PRINTER_ADDRESS) return trs_printer_read();
+	if (address == PRINTER_ADDRESS)
+	  return peek ? 0xff : trs_printer_read();
 	if (address < trs_rom_size) return rom[address];
 	if (address >= VIDEO_START) {
 	    return video[address + video_offset];
 	}
-	if (address >= KEYBOARD_START) return trs_kb_mem_read(address);
+	if (address >= KEYBOARD_START)
+	  return peek ? 0xff : trs_kb_mem_read(address);
 	return 0xff;
 
       case 0x54: /* Model 4P map 0, boot ROM in */
@@ -480,7 +498,8 @@ int mem_read(int address)
 	if (address >= VIDEO_START) {
 	    return video[address + video_offset];
 	}
-	if (address >= KEYBOARD_START) return trs_kb_mem_read(address);
+	if (address >= KEYBOARD_START)
+	  return peek ? 0xff : trs_kb_mem_read(address);
 	return 0xff;
 
       case 0x42: /* Model 4 map 2 */
@@ -490,7 +509,7 @@ int mem_read(int address)
 	    return memory[address + bank_offset[address >> 15]];
 	}
 	if (address >= 0xf800) return video[address-0xf800];
-	return trs_kb_mem_read(address);
+	return peek ? 0xff : trs_kb_mem_read(address);
 
       case 0x43: /* Model 4 map 3 */
       case 0x53: /* Model 4P map 3, boot ROM out */
@@ -502,6 +521,23 @@ int mem_read(int address)
     return 0xff;
 }
 
+int mem_read(int address)
+{
+    address &= 0xffff; /* allow callers to be sloppy */
+
+#ifdef ZBX
+    if (mem_watch_pages[address >> 8] & MEM_WATCH_READ)
+      debug_watch(address, 0, MEM_WATCH_READ);
+#endif
+    return mem_fetch(address, 0);
+}
+
+/* Read memory for the debugger, without watches or device side effects */
+int mem_peek(int address)
+{
+    return mem_fetch(address & 0xffff, 1);
+}
+
 static void trs80_screen_write_char(int vaddr, int value)
 {
   vaddr &= 0x7ff;
@@ -582,6 +618,11 @@ void mem_write(int address, int value)
 {
     address &= 0xffff;
 
+#ifdef ZBX
+    if (mem_watch_pages[address >> 8] & MEM_WATCH_WRITE)
+      debug_watch(address, value, MEM_WATCH_WRITE);
+#endif
+
     /* The SuperMem sits between the system and the Z80 */
     if (supermem) {
       if (!((address ^ supermem_hi) & 0x8000)) {
@@ -0,0 +1,387 @@
+/*
+ * trs_overlay.c -- copy-on-write overlays for disk and hard drive images
+ *
+ * An overlay is a stdio stream backed by a read-only image file and a
+ * table of modified blocks held in memory.  Blocks are copied from the
+ * image the first time they are written, so any number of processes
+ * (for example forked machines) can share one image without seeing each
+ * other's changes.  The image is accessed with pread() on a private file
+ * descriptor, so the file offset is never shared after a fork().
+ *
+ * Changes are discarded when the stream is closed, unless commit mode
+ * is on: then the modified blocks are written back to the image.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <SDL_types.h>
+#include "error.h"
+#include "trs_overlay.h"
+
+#define OVERLAY_BLOCK 512
+
+int trs_overlay = 0;
+int trs_overlay_commit = 0;
+
+/* fopencookie() on glibc and musl, funopen() on the BSDs */
+#if defined(__linux) || defined(__GLIBC__)
+#define OVERLAY_COOKIE
+#endif
+#ifdef __GLIBC__
+typedef off64_t overlay_off_t;		/* as cookie_seek_function_t wants */
+#else
+typedef off_t overlay_off_t;
+#endif
+
+#if defined(OVERLAY_COOKIE) || defined(__APPLE__) || defined(__FreeBSD__) || \
+    defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define OVERLAY_SUPPORT
+
+typedef struct overlay {
+  FILE *file;
+  char *filename;
+  int fd;
+  off_t image_size;
+  off_t base_size;
+  off_t size;
+  off_t pos;
+  Uint8 **block;
+  size_t nblocks;
+  int dirty;
+  struct overlay *next;
+} Overlay;
+
+static Overlay *overlays;
+
+static Overlay *overlay_find(FILE *file)
+{
+  Overlay *o;
+
+  for (o = overlays; o != NULL; o = o->next) {
+    if (o->file == file)
+      return o;
+  }
+  return NULL;
+}
+
+static int overlay_grow(Overlay *o, size_t nblocks)
+{
+  Uint8 **block;
+
+  if (nblocks <= o->nblocks)
+    return 0;
+  if ((block = realloc(o->block, nblocks * sizeof(Uint8 *))) == NULL)
+    return -1;
+  memset(block + o->nblocks, 0, (nblocks - o->nblocks) * sizeof(Uint8 *));
+  o->block = block;
+  o->nblocks = nblocks;
+  return 0;
+}
+
+/* Return a private copy of the block, reading it from the image if needed */
+static Uint8 *overlay_block(Overlay *o, size_t n)
+{
+  off_t offset = (off_t)n * OVERLAY_BLOCK;
+  Uint8 *data;
+
+  if (overlay_grow(o, n + 1) < 0)
+    return NULL;
+  if (o->block[n] != NULL)
+    return o->block[n];
+  if ((data = calloc(1, OVERLAY_BLOCK)) == NULL)
+    return NULL;
+
+  if (offset < o->base_size) {
+    size_t len = OVERLAY_BLOCK;
+
+    if (offset + OVERLAY_BLOCK > o->base_size)
+      len = o->base_size - offset;
+    if (pread(o->fd, data, len, offset) < 0) {
+      free(data);
+      return NULL;
+    }
+  }
+  o->block[n] = data;
+  return data;
+}
+
+static ssize_t overlay_read(void *cookie, char *buf, size_t size)
+{
+  Overlay *o = cookie;
+  size_t done = 0;
+
+  if (o->pos >= o->size)
+    return 0;
+  if ((off_t)size > o->size - o->pos)
+    size = o->size - o->pos;
+
+  while (done < size) {
+    size_t n = o->pos / OVERLAY_BLOCK;
+    size_t skip = o->pos % OVERLAY_BLOCK;
+    size_t len = OVERLAY_BLOCK - skip;
+
+    if (len > size - done)
+      len = size - done;
+
+    if (n < o->nblocks && o->block[n] != NULL) {
+      memcpy(buf + done, o->block[n] + skip, len);
+    } else if (o->pos >= o->base_size) {
+      memset(buf + done, 0, len);
+    } else {
+      ssize_t got;
+
+      if (o->pos + (off_t)len > o->base_size)
+        len = o->base_size - o->pos;
+      if ((got = pread(o->fd, buf + done, len, o->pos)) <= 0)
+        return done ? (ssize_t)done : got;
+      len = got;
+    }
+    done += len;
+    o->pos += len;
+  }
+  return done;
+}
+
+static ssize_t overlay_write(void *cookie, const char *buf, size_t size)
+{
+  Overlay *o = cookie;
+  size_t done = 0;
+
+  while (done < size) {
+    size_t n = o->pos / OVERLAY_BLOCK;
+    size_t skip = o->pos % OVERLAY_BLOCK;
+    size_t len = OVERLAY_BLOCK - skip;
+    Uint8 *data;
+
+    if (len > size - done)
+      len = size - done;
+    if ((data = overlay_block(o, n)) == NULL) {
+      errno = ENOMEM;
+      return done ? (ssize_t)done : -1;
+    }
+    memcpy(data + skip, buf + done, len);
+    done += len;
+    o->pos += len;
+  }
+  if (o->pos > o->size)
+    o->size = o->pos;
+  o->dirty = 1;
+  return done;
+}
+
+static int overlay_seek(void *cookie, overlay_off_t *offset, int whence)
+{
+  Overlay *o = cookie;
+  off_t pos;
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = *offset;
+      break;
+    case SEEK_CUR:
+      pos = o->pos + *offset;
+      break;
+    case SEEK_END:
+      pos = o->size + *offset;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (pos < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  *offset = o->pos = pos;
+  return 0;
+}
+
+/* Write the modified blocks back into the image file */
+static int overlay_write_back(Overlay *o)
+{
+  int fd;
+  int ret = 0;
+  size_t n;
+
+  if (!o->dirty)
+    return 0;
+  if ((fd = open(o->filename, O_WRONLY)) < 0) {
+    error("failed to commit overlay to %s: %s", o->filename, strerror(errno));
+    return -1;
+  }
+  /* Data cut off by a truncate must not come back when the file grows */
+  if (o->base_size < o->image_size && ftruncate(fd, o->base_size) < 0)
+    ret = -1;
+  for (n = 0; n < o->nblocks; n++) {
+    off_t offset = (off_t)n * OVERLAY_BLOCK;
+    size_t len = OVERLAY_BLOCK;
+
+    if (o->block[n] == NULL || offset >= o->size)
+      continue;
+    if (offset + OVERLAY_BLOCK > o->size)
+      len = o->size - offset;
+    if (pwrite(fd, o->block[n], len, offset) != (ssize_t)len)
+      ret = -1;
+  }
+  if (ftruncate(fd, o->size) < 0)
+    ret = -1;
+  if (close(fd) < 0 || ret < 0) {
+    error("failed to commit overlay to %s: %s", o->filename, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int overlay_close(void *cookie)
+{
+  Overlay *o = cookie;
+  Overlay **p;
+  size_t n;
+  int ret = 0;
+
+  if (trs_overlay_commit)
+    ret = overlay_write_back(o);
+
+  for (p = &overlays; *p != NULL; p = &(*p)->next) {
+    if (*p == o) {
+      *p = o->next;
+      break;
+    }
+  }
+  for (n = 0; n < o->nblocks; n++)
+    free(o->block[n]);
+  free(o->block);
+  free(o->filename);
+  close(o->fd);
+  free(o);
+  return ret;
+}
+
+/* Close all overlays at exit, so commit mode gets to write them back */
+static void overlay_cleanup(void)
+{
+  while (overlays != NULL)
+    fclose(overlays->file);
+}
+
+#ifdef OVERLAY_COOKIE
+static cookie_io_functions_t overlay_functions = {
+  overlay_read, overlay_write, overlay_seek, overlay_close
+};
+#else
+static int overlay_funread(void *cookie, char *buf, int size)
+{
+  return overlay_read(cookie, buf, size);
+}
+
+static int overlay_funwrite(void *cookie, const char *buf, int size)
+{
+  return overlay_write(cookie, buf, size);
+}
+
+static fpos_t overlay_funseek(void *cookie, fpos_t offset, int whence)
+{
+  overlay_off_t pos = offset;
+
+  if (overlay_seek(cookie, &pos, whence) < 0)
+    return -1;
+  return pos;
+}
+#endif
+#endif /* OVERLAY_SUPPORT */
+
+FILE *trs_overlay_open(const char *filename)
+{
+#ifdef OVERLAY_SUPPORT
+  static int registered;
+  Overlay *o;
+  struct stat st;
+
+  if (!registered) {
+    atexit(overlay_cleanup);
+    registered = 1;
+  }
+  if ((o = calloc(1, sizeof(Overlay))) == NULL)
+    return NULL;
+  if ((o->fd = open(filename, O_RDONLY)) < 0) {
+    free(o);
+    return NULL;
+  }
+  if (fstat(o->fd, &st) < 0 || (o->filename = strdup(filename)) == NULL) {
+    close(o->fd);
+    free(o);
+    return NULL;
+  }
+  o->image_size = o->base_size = o->size = st.st_size;
+
+#ifdef OVERLAY_COOKIE
+  o->file = fopencookie(o, "r+", overlay_functions);
+#else
+  o->file = funopen(o, overlay_funread, overlay_funwrite,
+                    overlay_funseek, overlay_close);
+#endif
+  if (o->file == NULL) {
+    free(o->filename);
+    close(o->fd);
+    free(o);
+    return NULL;
+  }
+  o->next = overlays;
+  overlays = o;
+  return o->file;
+#else
+  error("copy-on-write overlay not supported on this platform: '%s'",
+      filename);
+  errno = ENOSYS;
+  return NULL;
+#endif
+}
+
+int trs_overlay_stream(FILE *file)
+{
+#ifdef OVERLAY_SUPPORT
+  return overlay_find(file) != NULL;
+#else
+  return 0;
+#endif
+}
+
+int trs_overlay_truncate(FILE *file, off_t length)
+{
+#ifdef OVERLAY_SUPPORT
+  Overlay *o = overlay_find(file);
+  size_t n;
+
+  if (o == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+  fflush(file);
+
+  /* Drop whole blocks past the end and clear the tail of the last one,
+     so growing the file again reads back zeros as ftruncate does */
+  for (n = (length + OVERLAY_BLOCK - 1) / OVERLAY_BLOCK; n < o->nblocks; n++) {
+    free(o->block[n]);
+    o->block[n] = NULL;
+  }
+  if (length % OVERLAY_BLOCK) {
+    n = length / OVERLAY_BLOCK;
+    if (n < o->nblocks && o->block[n] != NULL)
+      memset(o->block[n] + length % OVERLAY_BLOCK, 0,
+          OVERLAY_BLOCK - length % OVERLAY_BLOCK);
+  }
+  if (o->base_size > length)
+    o->base_size = length;
+  o->size = length;
+  o->dirty = 1;
+  return 0;
+#else
+  errno = EBADF;
+  return -1;
+#endif
+}
@@ -0,0 +1,22 @@
+/*
+ * trs_overlay.h -- copy-on-write overlays for disk and hard drive images
+ */
+#ifndef _TRS_OVERLAY_H
+#define _TRS_OVERLAY_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* When set, disk and hard drive images are opened through overlays */
+extern int trs_overlay;
+/* When set, changes are written back to the image on close and at exit */
+extern int trs_overlay_commit;
+
+/* Open the image read-only and return a read-write stream on top of it;
+   all writes are kept in memory and never reach the image file. */
+
+extern FILE *trs_overlay_open(const char *filename);
+extern int trs_overlay_stream(FILE *file);
+extern int trs_overlay_truncate(FILE *file, off_t length);
+
+#endif /* _TRS_OVERLAY_H */
@@ -0,0 +1,141 @@
+/*
+ * trs_perf.c -- emulator performance counters
+ *
+ * The emulator bumps a few counters as it runs and measures the host
+ * time spent sleeping, handling events and flushing the screen.  Once a
+ * second of host time the counters are copied to trs_perf_last, shown
+ * in the window caption of the CPU panel and, with -perflog, appended
+ * as a line of CSV to a file.  They are also summed up since the start
+ * for the benchmark report.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <SDL.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_perf.h"
+
+trs_perf_counters trs_perf;
+trs_perf_counters trs_perf_last;
+volatile Uint32 trs_perf_underruns;
+
+static trs_perf_counters perf_total;
+
+static Uint32 second_start;
+static tstate_t second_tstates;
+static Uint32 second_number;
+static Uint32 second_underruns;
+static FILE *perf_log;
+
+/* Host time in microseconds, wrapping around */
+Uint32 trs_perf_time(void)
+{
+#ifdef SDL2
+  static Uint64 frequency;
+  Uint64 counter = SDL_GetPerformanceCounter();
+
+  if (frequency == 0)
+    frequency = SDL_GetPerformanceFrequency();
+  return (Uint32)(counter / frequency * 1000000 +
+                  counter % frequency * 1000000 / frequency);
+#else
+  return SDL_GetTicks() * 1000;
+#endif
+}
+
+static double perf_rate(Uint64 count)
+{
+  return trs_perf_last.elapsed_us ?
+    count * 1000000.0 / trs_perf_last.elapsed_us : 0.0;
+}
+
+/* Called once per timer tick; closes the second when it is over */
+void trs_perf_tick(void)
+{
+  Uint32 now = trs_perf_time();
+  Uint32 elapsed = now - second_start;
+  Uint32 underruns;
+
+  if (elapsed < 1000000)
+    return;
+
+  underruns = trs_perf_underruns;
+  trs_perf.underruns = underruns - second_underruns;
+  second_underruns = underruns;
+  trs_perf.tstates = z80_state.t_count - second_tstates;
+  trs_perf.elapsed_us = elapsed;
+  trs_perf_last = trs_perf;
+  trs_perf_add(&perf_total, &trs_perf);
+  memset(&trs_perf, 0, sizeof(trs_perf));
+  second_start = now;
+  second_tstates = z80_state.t_count;
+  second_number++;
+
+  if (perf_log) {
+    fprintf(perf_log, "%u,%" TSTATE_T_LEN ",%" TSTATE_T_LEN ",%.3f,%u,%u,%u,"
+        "%u,%u,%u,%u,%u\n", (unsigned int)second_number,
+        (tstate_t)trs_perf_last.instructions, (tstate_t)trs_perf_last.tstates,
+        perf_rate(trs_perf_last.tstates) / 1000000.0,
+        (unsigned int)trs_perf_last.frames, (unsigned int)trs_perf_last.rects,
+        (unsigned int)trs_perf_last.disk_bytes,
+        (unsigned int)trs_perf_last.underruns,
+        (unsigned int)trs_perf_last.sleep_us,
+        (unsigned int)trs_perf_last.event_us,
+        (unsigned int)trs_perf_last.flush_us,
+        (unsigned int)trs_perf_last.elapsed_us);
+    fflush(perf_log);
+  }
+}
+
+void trs_perf_add(trs_perf_counters *sum, const trs_perf_counters *counters)
+{
+  sum->instructions += counters->instructions;
+  sum->tstates += counters->tstates;
+  sum->frames += counters->frames;
+  sum->rects += counters->rects;
+  sum->disk_bytes += counters->disk_bytes;
+  sum->underruns += counters->underruns;
+  sum->sleep_us += counters->sleep_us;
+  sum->event_us += counters->event_us;
+  sum->flush_us += counters->flush_us;
+  sum->elapsed_us += counters->elapsed_us;
+}
+
+/* Leave host time spent paused out of the running second */
+void trs_perf_pause(Uint32 paused_us)
+{
+  second_start += paused_us;
+}
+
+/* Counters since the start, including the running second */
+void trs_perf_totals(trs_perf_counters *total)
+{
+  *total = perf_total;
+  trs_perf_add(total, &trs_perf);
+  total->underruns += trs_perf_underruns - second_underruns;
+}
+
+/* Append the counters of every second to filename as CSV */
+int trs_perf_log(const char *filename)
+{
+  if (perf_log)
+    fclose(perf_log);
+  if ((perf_log = fopen(filename, "w")) == NULL) {
+    error("failed to open performance log %s: %s", filename, strerror(errno));
+    return -1;
+  }
+  fputs("second,instructions,tstates,mhz,frames,rects,disk_bytes,"
+        "underruns,sleep_us,event_us,flush_us,elapsed_us\n", perf_log);
+  return 0;
+}
+
+/* One line for the window caption */
+void trs_perf_summary(char *buf, int size)
+{
+  snprintf(buf, size, "%.2f MHz %.1fM ips %.0f fps %.0f%% idle",
+      perf_rate(trs_perf_last.tstates) / 1000000.0,
+      perf_rate(trs_perf_last.instructions) / 1000000.0,
+      perf_rate(trs_perf_last.frames),
+      perf_rate(trs_perf_last.sleep_us) / 10000.0);
+}
@@ -0,0 +1,40 @@
+/*
+ * trs_perf.h -- emulator performance counters
+ */
+#ifndef _TRS_PERF_H
+#define _TRS_PERF_H
+
+#include <stdio.h>
+#include <SDL_types.h>
+
+typedef struct {
+  Uint64 instructions;	/* Z80 instructions executed */
+  Uint64 tstates;	/* Z80 T-states executed */
+  Uint32 frames;	/* screen updates flushed to the window */
+  Uint32 rects;		/* rectangles in those updates */
+  Uint32 disk_bytes;	/* bytes through the floppy and hard disk data ports */
+  Uint32 underruns;	/* audio callbacks short of samples */
+  Uint32 sleep_us;	/* host time sleeping to keep real time */
+  Uint32 event_us;	/* host time handling SDL events and drawing */
+  Uint32 flush_us;	/* host time flushing the screen, part of event_us */
+  Uint32 elapsed_us;	/* host time covered by the counters */
+} trs_perf_counters;
+
+/* Counters of the running second, updated in place by the emulator */
+extern trs_perf_counters trs_perf;
+/* Counters of the last complete second */
+extern trs_perf_counters trs_perf_last;
+/* Audio underruns since the start, bumped by the audio thread; it is
+   kept out of trs_perf so that trs_perf_tick never clears it */
+extern volatile Uint32 trs_perf_underruns;
+
+extern Uint32 trs_perf_time(void);
+extern void trs_perf_tick(void);
+extern void trs_perf_pause(Uint32 paused_us);
+extern int trs_perf_log(const char *filename);
+extern void trs_perf_summary(char *buf, int size);
+extern void trs_perf_add(trs_perf_counters *sum,
+                         const trs_perf_counters *counters);
+extern void trs_perf_totals(trs_perf_counters *total);
+
+#endif /* _TRS_PERF_H */
@@ -37,7 +37,17 @@
  * SOFTWARE.
  */
 
+/*
+ * Printer output goes to a text file (carriage returns become newlines),
+ * to a raw file with the bytes as sent, or through a pipe to the printer
+ * command.  It is written through a large buffer; files get the next free
+ * name trsprnNNNN.txt or .prn in the printer directory.
+ */
+
 #include <errno.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -46,68 +56,137 @@
 
 #define NO_PRINTER   0
 #define TEXT_PRINTER 1
+#define RAW_PRINTER  2
+#define PIPE_PRINTER 3
+
+/* Status read from the printer port */
+#define PRINTER_BUSY     0x80
+#define PRINTER_NO_PAPER 0x40
+#define PRINTER_SELECTED 0x20
+#define PRINTER_NO_FAULT 0x10
+
+#define PRINTER_BUFSIZE  (1 << 16)
 
 static FILE *printer = NULL;
 static char printer_filename[FILENAME_MAX];
 static int printer_open = FALSE;
+static int printer_type;	/* type of the open output */
+static int printer_failed = FALSE;
+/* Files below this number exist in printer_dir, so they are not probed */
+static int printer_num;
+static char printer_dir[FILENAME_MAX];
 int trs_printer = NO_PRINTER;
 
 int trs_printer_reset(void)
 {
   char command[256 + FILENAME_MAX]; /* 256 for print_command + FILENAME_MAX for spool_file */
+  int rc = 0;
 
+  printer_failed = FALSE;
   if (printer_open) {
-    fclose(printer);
     printer_open = FALSE;
+    if (printer_type == PIPE_PRINTER)
+      return pclose(printer) == 0 ? 0 : -1;
+    if (fclose(printer) != 0) {
+      error("failed to write printer output file %s: %s", printer_filename,
+          strerror(errno));
+      rc = -1;
+    }
     if (trs_printer_command[0]) {
       snprintf(command, 255 + FILENAME_MAX, trs_printer_command, printer_filename);
       if (system(command) != 0)
         return -1;
     }
-    return 0;
+    return rc;
   } else
     return -1;
 }
 
-void trs_printer_open(void)
+static void trs_printer_open_file(const char *extension, const char *mode)
 {
-  int file_num;
   struct stat st;
 
-  for (file_num = 0; file_num < 10000; file_num++) {
-    if (snprintf(printer_filename, FILENAME_MAX, "%s%ctrsprn%04d.txt",
-        trs_printer_dir, DIR_SLASH, file_num) < FILENAME_MAX) {
+  if (strcmp(printer_dir, trs_printer_dir) != 0) {
+    snprintf(printer_dir, FILENAME_MAX, "%s", trs_printer_dir);
+    printer_num = 0;
+  }
+  for (; printer_num < 10000; printer_num++) {
+    if (snprintf(printer_filename, FILENAME_MAX, "%s%ctrsprn%04d.%s",
+        trs_printer_dir, DIR_SLASH, printer_num, extension) < FILENAME_MAX) {
       if (stat(printer_filename, &st) < 0) {
-        printer_open = TRUE;
-        printer = fopen(printer_filename,"w");
-        if (printer == NULL) {
+        printer_num++;
+        printer = fopen(printer_filename, mode);
+        if (printer == NULL)
           error("failed to open printer output file %s: %s", printer_filename,
               strerror(errno));
-          printer_open = FALSE;
-        }
         return;
       }
     }
   }
+  error("no free printer output file name in %s", trs_printer_dir);
+}
+
+void trs_printer_open(void)
+{
+  char command[256 + FILENAME_MAX];
+
+  printer = NULL;
+  switch (trs_printer) {
+    case TEXT_PRINTER:
+      trs_printer_open_file("txt", "w");
+      break;
+    case RAW_PRINTER:
+      trs_printer_open_file("prn", "wb");
+      break;
+    case PIPE_PRINTER:
+      /* The command reads the output, so %s is left empty */
+      snprintf(command, 255 + FILENAME_MAX, trs_printer_command, "");
+#ifndef _WIN32
+      signal(SIGPIPE, SIG_IGN);
+#endif
+      fflush(NULL);
+      printer = popen(command, "w");
+      if (printer == NULL)
+        error("failed to run printer command %s: %s", command, strerror(errno));
+      break;
+  }
+  if (printer == NULL) {
+    printer_failed = TRUE;
+    return;
+  }
+  setvbuf(printer, NULL, _IOFBF, PRINTER_BUFSIZE);
+  printer_type = trs_printer;
+  printer_open = TRUE;
 }
 
 void trs_printer_write(int value)
 {
-  if (trs_printer == TEXT_PRINTER) {
-    if (!printer_open)
-      trs_printer_open();
-
-    if (printer_open) {
-      if (value == 0x0D) {
-        fputc('\n',printer);
-      } else {
-        fputc(value,printer);
-      }
+  if (trs_printer == NO_PRINTER || printer_failed)
+    return;
+  /* The type was changed in the GUI: finish the output of the old one */
+  if (printer_open && printer_type != trs_printer)
+    trs_printer_reset();
+  if (!printer_open)
+    trs_printer_open();
+
+  if (printer_open) {
+    if (value == 0x0D && printer_type != RAW_PRINTER)
+      value = '\n';
+    if (putc(value, printer) == EOF) {
+      error("failed to write printer output: %s", strerror(errno));
+      printer_failed = TRUE;
     }
   }
 }
 
+/*
+ * Output is buffered, so the printer is never busy.  After an error it
+ * is out of paper, which makes the program stop printing and report it,
+ * until the printer is reset from the GUI.
+ */
 int trs_printer_read(void)
 {
-    return 0x30;	/* printer selected, ready, with paper, not busy */
+  if (printer_failed)
+    return PRINTER_NO_PAPER | PRINTER_SELECTED;
+  return PRINTER_SELECTED | PRINTER_NO_FAULT;
 }
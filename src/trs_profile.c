@@ -0,0 +1,301 @@
+/*
+ * trs_profile.c -- Z80 execution profiler
+ *
+ * While profiling, z80_run reports every executed instruction with the
+ * number of T-states it took.  This is counted per address for a flat
+ * histogram, and per routine by following CALL, RST and interrupts on
+ * a shadow stack: a frame is popped when the Z80 stack pointer moves
+ * above the return address it pushed, which covers RET, RETI, RETN and
+ * routines that drop their return address.
+ *
+ * The report lists the hottest addresses (disassembled when the
+ * debugger is built in), the routines with their own and inclusive
+ * T-states, and the busiest caller -> callee edges.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_profile.h"
+
+#define ADDRESS_SPACE	0x10000
+#define TOP_LEVEL	ADDRESS_SPACE	/* routine of code not called */
+#define PROFILE_DEPTH	256
+#define PROFILE_EDGES	8192		/* power of two */
+
+typedef struct {
+  int routine;
+  Uint16 sp;
+  tstate_t start;
+} Frame;
+
+typedef struct {
+  int used;
+  int caller;
+  int callee;
+  Uint32 calls;
+  tstate_t tstates;
+} Edge;
+
+typedef struct {
+  Uint32 count[ADDRESS_SPACE];
+  tstate_t tstates[ADDRESS_SPACE];
+  Uint32 calls[ADDRESS_SPACE + 1];
+  tstate_t self[ADDRESS_SPACE + 1];
+  tstate_t total[ADDRESS_SPACE + 1];
+  Edge edge[PROFILE_EDGES];
+  Frame frame[PROFILE_DEPTH];
+  int depth;
+  tstate_t tstates_all;
+  int edges_lost;
+} Profile;
+
+int trs_profile = 0;
+
+static Profile *profile;
+static char profile_file[FILENAME_MAX];
+
+static int current_routine(void)
+{
+  return profile->depth ? profile->frame[profile->depth - 1].routine
+                        : TOP_LEVEL;
+}
+
+static Edge *profile_edge(int caller, int callee)
+{
+  Uint32 i = (((Uint32)caller << 16 ^ callee) * 2654435761U) >> 19;
+  int n;
+
+  for (n = 0; n < PROFILE_EDGES; n++) {
+    Edge *e = &profile->edge[i];
+
+    if (e->used && e->caller == caller && e->callee == callee)
+      return e;
+    if (!e->used) {
+      e->used = 1;
+      e->caller = caller;
+      e->callee = callee;
+      return e;
+    }
+    i = (i + 1) & (PROFILE_EDGES - 1);
+  }
+  profile->edges_lost++;
+  return NULL;
+}
+
+static void profile_return(void)
+{
+  Frame *f = &profile->frame[--profile->depth];
+  tstate_t t = z80_state.t_count - f->start;
+  Edge *e;
+
+  profile->total[f->routine] += t;
+  if ((e = profile_edge(current_routine(), f->routine)) != NULL)
+    e->tstates += t;
+}
+
+/* A routine was entered by CALL, RST or an interrupt */
+void trs_profile_call(int routine)
+{
+  Frame *f;
+  Edge *e;
+
+  if (profile == NULL)
+    return;
+  if ((e = profile_edge(current_routine(), routine)) != NULL)
+    e->calls++;
+  profile->calls[routine]++;
+
+  if (profile->depth == PROFILE_DEPTH) {
+    /* Runaway recursion: forget the outermost frame */
+    memmove(profile->frame, profile->frame + 1,
+        (PROFILE_DEPTH - 1) * sizeof(Frame));
+    profile->depth--;
+  }
+  f = &profile->frame[profile->depth++];
+  f->routine = routine;
+  f->sp = Z80_SP;
+  f->start = z80_state.t_count;
+}
+
+void trs_profile_instruction(int pc, int opcode, int sp, tstate_t t)
+{
+  Uint16 moved;
+
+  profile->count[pc]++;
+  profile->tstates[pc] += t;
+  profile->self[current_routine()] += t;
+  profile->tstates_all += t;
+
+  if (Z80_SP == ((sp - 2) & 0xffff) &&
+      (opcode == 0xcd || (opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc7)) {
+    trs_profile_call(Z80_PC);
+    return;
+  }
+
+  while (profile->depth) {
+    moved = Z80_SP - profile->frame[profile->depth - 1].sp;
+    if (moved == 0 || moved >= 0x8000)
+      break;
+    if (moved >= 0x1000) {
+      /* The program switched to another stack */
+      profile->depth = 0;
+      break;
+    }
+    profile_return();
+  }
+}
+
+static void profile_exit(void)
+{
+  FILE *file;
+
+  if (profile == NULL || profile_file[0] == '\0')
+    return;
+  if ((file = fopen(profile_file, "w")) == NULL) {
+    error("failed to write profile %s: %s", profile_file, strerror(errno));
+    return;
+  }
+  trs_profile_report(file, -1);
+  fclose(file);
+}
+
+/* Start profiling; the report is written to filename at exit, if given */
+int trs_profile_start(const char *filename)
+{
+  static int registered;
+
+  if (profile == NULL && (profile = calloc(1, sizeof(Profile))) == NULL) {
+    error("failed to allocate profile: %s", strerror(errno));
+    return -1;
+  }
+  if (filename != NULL) {
+    snprintf(profile_file, FILENAME_MAX, "%s", filename);
+    if (!registered) {
+      atexit(profile_exit);
+      registered = 1;
+    }
+  }
+  trs_profile = 1;
+  return 0;
+}
+
+static int compare_address(const void *a, const void *b)
+{
+  tstate_t ta = profile->tstates[*(const int *)a];
+  tstate_t tb = profile->tstates[*(const int *)b];
+
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+static int compare_routine(const void *a, const void *b)
+{
+  tstate_t ta = profile->self[*(const int *)a];
+  tstate_t tb = profile->self[*(const int *)b];
+
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+static int compare_edge(const void *a, const void *b)
+{
+  tstate_t ta = ((const Edge *)a)->tstates;
+  tstate_t tb = ((const Edge *)b)->tstates;
+
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+static double percent(tstate_t t)
+{
+  return profile->tstates_all ? 100.0 * t / profile->tstates_all : 0.0;
+}
+
+static void print_routine(FILE *file, int routine)
+{
+  if (routine == TOP_LEVEL)
+    fputs("<top>", file);
+  else
+    fprintf(file, "%04x", routine);
+}
+
+/* Print the count hottest entries of each table, or all if count < 0 */
+void trs_profile_report(FILE *file, int count)
+{
+  int *index;
+  Edge *edges;
+  int i, n;
+
+  if (profile == NULL) {
+    fputs("No profile has been recorded.\n", file);
+    return;
+  }
+  if ((index = malloc((ADDRESS_SPACE + 1) * sizeof(int))) == NULL ||
+      (edges = malloc(PROFILE_EDGES * sizeof(Edge))) == NULL) {
+    free(index);
+    error("failed to allocate profile report: %s", strerror(errno));
+    return;
+  }
+
+  fprintf(file, "# Flat profile: %" TSTATE_T_LEN " T-states\n",
+      profile->tstates_all);
+  fputs("# T-states       %      count  instruction\n", file);
+  for (i = n = 0; i < ADDRESS_SPACE; i++) {
+    if (profile->count[i])
+      index[n++] = i;
+  }
+  qsort(index, n, sizeof(int), compare_address);
+  if (count >= 0 && n > count)
+    n = count;
+  for (i = 0; i < n; i++) {
+    fprintf(file, "%12" TSTATE_T_LEN " %6.2f %10u  ",
+        profile->tstates[index[i]], percent(profile->tstates[index[i]]),
+        (unsigned int)profile->count[index[i]]);
+#ifdef ZBX
+    disassemble_to(file, index[i], mem_peek);
+#else
+    fprintf(file, "%04x\n", index[i]);
+#endif
+  }
+
+  fputs("\n# Routines\n", file);
+  fputs("# self           %  inclusive      calls  routine\n", file);
+  for (i = n = 0; i <= ADDRESS_SPACE; i++) {
+    if (profile->self[i] || profile->calls[i])
+      index[n++] = i;
+  }
+  qsort(index, n, sizeof(int), compare_routine);
+  if (count >= 0 && n > count)
+    n = count;
+  for (i = 0; i < n; i++) {
+    fprintf(file, "%12" TSTATE_T_LEN " %6.2f %10" TSTATE_T_LEN " %10u  ",
+        profile->self[index[i]], percent(profile->self[index[i]]),
+        profile->total[index[i]], (unsigned int)profile->calls[index[i]]);
+    print_routine(file, index[i]);
+    putc('\n', file);
+  }
+
+  fputs("\n# Call graph\n", file);
+  fputs("# inclusive      calls  caller -> callee\n", file);
+  for (i = n = 0; i < PROFILE_EDGES; i++) {
+    if (profile->edge[i].used)
+      edges[n++] = profile->edge[i];
+  }
+  qsort(edges, n, sizeof(Edge), compare_edge);
+  if (count >= 0 && n > count)
+    n = count;
+  for (i = 0; i < n; i++) {
+    fprintf(file, "%12" TSTATE_T_LEN " %10u  ", edges[i].tstates,
+        (unsigned int)edges[i].calls);
+    print_routine(file, edges[i].caller);
+    fputs(" -> ", file);
+    print_routine(file, edges[i].callee);
+    putc('\n', file);
+  }
+  if (profile->edges_lost)
+    fprintf(file, "# %d calls not recorded, call graph table full\n",
+        profile->edges_lost);
+
+  free(edges);
+  free(index);
+}
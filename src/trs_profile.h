@@ -0,0 +1,18 @@
+/*
+ * trs_profile.h -- Z80 execution profiler
+ */
+#ifndef _TRS_PROFILE_H
+#define _TRS_PROFILE_H
+
+#include <stdio.h>
+#include "z80.h"
+
+/* Non-zero while profiling, checked by z80_run for every instruction */
+extern int trs_profile;
+
+extern int trs_profile_start(const char *filename);
+extern void trs_profile_instruction(int pc, int opcode, int sp, tstate_t t);
+extern void trs_profile_call(int routine);
+extern void trs_profile_report(FILE *file, int count);
+
+#endif /* _TRS_PROFILE_H */
@@ -0,0 +1,443 @@
+/*
+ * trs_script.c -- scripted keyboard input
+ *
+ * A script is a list of commands read from a file (-script) or given
+ * on the command line (-type), one per line:
+ *
+ *   # comment
+ *   type TEXT       type TEXT, C style escapes: \n (ENTER), \b (LEFT),
+ *                   \t (RIGHT), \f (CLEAR), \e (BREAK), \\, \xHH
+ *   typefile FILE   type the contents of a host text file
+ *   basic FILE      tokenize a BASIC program straight into memory
+ *   wait TEXT       wait until TEXT appears in a line of the screen
+ *   waitat ROW COL TEXT
+ *                   wait until TEXT appears at ROW and COL, from 0
+ *   waitre REGEX    wait until a line of the screen matches the extended
+ *                   regular expression REGEX
+ *   screen [FILE]   append the text screen in UTF-8 to FILE or stdout
+ *   waitpc ADDR     wait until the Z80 is about to execute ADDR
+ *   delay SECONDS   wait a number of emulated seconds
+ *   snapshot        keep a copy of the CPU, memory and devices in memory
+ *   restore         return the machine to the snapshot, e.g. to run
+ *                   the next test on a freshly booted system; the media
+ *                   are not part of it, so all drives must be write
+ *                   protected
+ *   quit            exit the emulator
+ *
+ * Keys are not paced by the host timer but fed into the keyboard queue
+ * whenever the Z80 program reads the keyboard matrix and the previous
+ * key has been taken, so typing runs as fast as the guest can scan.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL_types.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_script.h"
+#include "trs_state_save.h"
+
+#define SCRIPT_TYPE   0
+#define SCRIPT_WAIT   1
+#define SCRIPT_WAITPC 2
+#define SCRIPT_DELAY  3
+#define SCRIPT_QUIT   4
+#define SCRIPT_BASIC  5
+#define SCRIPT_SCREEN 6
+#define SCRIPT_SNAPSHOT 7
+#define SCRIPT_RESTORE  8
+
+typedef struct {
+  int command;
+  int value;
+  int row, col;
+  int *keys;
+  char *text;
+} ScriptCommand;
+
+extern int turbo_paste;
+
+int trs_script_pc = -1;
+
+static ScriptCommand *commands;
+static int num_commands;
+static int max_commands;
+static int current;
+static int started;
+static int key_index;
+static int key_up;
+static int delay_ticks;
+static int turbo_saved;
+#ifndef _WIN32
+static trs_snapshot *snapshot;
+#endif
+
+static ScriptCommand *script_add(int command)
+{
+  ScriptCommand *c;
+
+  if (num_commands == max_commands) {
+    int size = max_commands ? max_commands * 2 : 16;
+
+    if ((c = realloc(commands, size * sizeof(ScriptCommand))) == NULL) {
+      error("failed to allocate script command: %s", strerror(errno));
+      return NULL;
+    }
+    commands = c;
+    max_commands = size;
+  }
+  c = &commands[num_commands++];
+  memset(c, 0, sizeof(ScriptCommand));
+  c->command = command;
+  return c;
+}
+
+/* Map host characters to the keysyms used by trs_xlate_keysym */
+static int script_keysym(int ch)
+{
+  if (ch == '\n' || ch == '\r')
+    return 0x0d;
+  if (ch >= 0x5b && ch <= 0x60)
+    return ch + 0x20;
+  if (ch >= 0x7b && ch <= 0x7e)
+    return ch - 0x20;
+  return ch & 0xff;
+}
+
+static int script_escape(const char **text)
+{
+  const char *s = *text;
+  int ch = *s++;
+
+  switch (ch) {
+    case 'n':
+    case 'r':
+      ch = '\n';
+      break;
+    case 'b':
+      ch = 0x08;
+      break;
+    case 't':
+      ch = 0x09;
+      break;
+    case 'f':
+      ch = 0x0c;
+      break;
+    case 'e':
+      ch = 0x1b;
+      break;
+    case 'x':
+      ch = strtol(s, (char **)&s, 16);
+      break;
+    case '\0':
+      ch = '\\';
+      s--;
+      break;
+  }
+  *text = s;
+  return ch;
+}
+
+static void script_add_keys(const char *text, int len, int escapes)
+{
+  ScriptCommand *c;
+  const char *end = text + len;
+  int n = 0;
+
+  if ((c = script_add(SCRIPT_TYPE)) == NULL)
+    return;
+  if ((c->keys = malloc((len + 1) * sizeof(int))) == NULL) {
+    error("failed to allocate script text: %s", strerror(errno));
+    num_commands--;
+    return;
+  }
+  while (text < end) {
+    int ch = (unsigned char)*text++;
+
+    if (escapes && ch == '\\')
+      ch = script_escape(&text);
+    else if (ch == '\r' && text < end && *text == '\n')
+      continue;
+    c->keys[n++] = script_keysym(ch);
+  }
+  c->value = n;
+}
+
+static void script_add_file(const char *filename)
+{
+  FILE *file;
+  char *text;
+  long len;
+
+  if ((file = fopen(filename, "rb")) == NULL) {
+    error("failed to open %s: %s", filename, strerror(errno));
+    return;
+  }
+  fseek(file, 0, SEEK_END);
+  len = ftell(file);
+  rewind(file);
+  if (len > 0 && (text = malloc(len)) != NULL) {
+    len = fread(text, 1, len, file);
+    script_add_keys(text, len, FALSE);
+    free(text);
+  }
+  fclose(file);
+}
+
+static void script_parse(char *line, const char *source, int lineno)
+{
+  ScriptCommand *c;
+  char *arg;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  line += strspn(line, " \t");
+  if (*line == '\0' || *line == '#')
+    return;
+  arg = line + strcspn(line, " \t");
+  if (*arg != '\0') {
+    *arg++ = '\0';
+    arg += strspn(arg, " \t");
+  }
+
+  if (strcmp(line, "type") == 0) {
+    script_add_keys(arg, strlen(arg), TRUE);
+  } else if (strcmp(line, "typefile") == 0) {
+    script_add_file(arg);
+  } else if (strcmp(line, "basic") == 0) {
+    if ((c = script_add(SCRIPT_BASIC)) != NULL && (c->text = strdup(arg)) == NULL)
+      num_commands--;
+  } else if (strcmp(line, "wait") == 0 || strcmp(line, "waitre") == 0) {
+    if ((c = script_add(SCRIPT_WAIT)) != NULL) {
+      c->value = strcmp(line, "waitre") == 0;
+      c->row = -1;
+      if ((c->text = strdup(arg)) == NULL)
+        num_commands--;
+    }
+  } else if (strcmp(line, "waitat") == 0) {
+    if ((c = script_add(SCRIPT_WAIT)) != NULL) {
+      c->row = strtol(arg, &arg, 0);
+      c->col = strtol(arg, &arg, 0);
+      if (*arg == ' ' || *arg == '\t')
+        arg++;
+      if (c->row < 0 || (c->text = strdup(arg)) == NULL)
+        num_commands--;
+    }
+  } else if (strcmp(line, "waitpc") == 0) {
+    if ((c = script_add(SCRIPT_WAITPC)) != NULL)
+      c->value = strtol(arg, NULL, 0) & 0xffff;
+  } else if (strcmp(line, "delay") == 0) {
+    if ((c = script_add(SCRIPT_DELAY)) != NULL)
+      c->value = atof(arg) * 1000;
+  } else if (strcmp(line, "screen") == 0) {
+    if ((c = script_add(SCRIPT_SCREEN)) != NULL && (c->text = strdup(arg)) == NULL)
+      num_commands--;
+  } else if (strcmp(line, "snapshot") == 0) {
+    script_add(SCRIPT_SNAPSHOT);
+  } else if (strcmp(line, "restore") == 0) {
+    script_add(SCRIPT_RESTORE);
+  } else if (strcmp(line, "quit") == 0) {
+    script_add(SCRIPT_QUIT);
+  } else {
+    error("%s:%d: unknown script command '%s'", source, lineno, line);
+  }
+}
+
+int trs_script_load(const char *filename)
+{
+  FILE *file;
+  char line[1024];
+  int lineno = 0;
+
+  if ((file = fopen(filename, "r")) == NULL) {
+    error("failed to load script %s: %s", filename, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file))
+    script_parse(line, filename, ++lineno);
+  fclose(file);
+  return 0;
+}
+
+/* Add a single script command, e.g. from the command line */
+void trs_script_command(const char *command)
+{
+  char line[1024];
+
+  snprintf(line, sizeof(line), "%s", command);
+  script_parse(line, "command", 1);
+}
+
+void trs_script_type(const char *text, int escapes)
+{
+  script_add_keys(text, strlen(text), escapes);
+}
+
+int trs_script_typing(void)
+{
+  return current < num_commands && commands[current].command == SCRIPT_TYPE;
+}
+
+/* Stop typing the current text, e.g. when the user presses a key */
+void trs_script_abort(void)
+{
+  if (trs_script_typing()) {
+    ScriptCommand *c = &commands[current];
+
+    if (key_up)
+      trs_xlate_keysym(0x10000 | c->keys[key_index]);
+    key_up = FALSE;
+    key_index = c->value;
+  }
+}
+
+/* Next key to queue, called when the Z80 reads an empty keyboard queue */
+int trs_script_key(void)
+{
+  ScriptCommand *c;
+
+  if (!started || !trs_script_typing())
+    return -1;
+  c = &commands[current];
+  if (key_index >= c->value)
+    return -1;
+  if (key_up) {
+    key_up = FALSE;
+    return 0x10000 | c->keys[key_index++];
+  }
+  key_up = TRUE;
+  return c->keys[key_index];
+}
+
+void trs_script_pc_reached(void)
+{
+  trs_script_pc = -1;
+}
+
+static void script_screen(const char *filename)
+{
+  char text[TRS_SCREEN_TEXT];
+  FILE *file = stdout;
+
+  if (*filename && (file = fopen(filename, "a")) == NULL) {
+    error("failed to write screen to %s: %s", filename, strerror(errno));
+    return;
+  }
+  trs_screen_text(text, sizeof(text));
+  fputs(text, file);
+  if (file != stdout)
+    fclose(file);
+  else
+    fflush(stdout);
+}
+
+#ifndef _WIN32
+static void script_snapshot(void)
+{
+  if (snapshot == NULL && (snapshot = trs_snapshot_new()) == NULL)
+    return;
+  trs_snapshot_save(snapshot);
+}
+
+static void script_restore(void)
+{
+  if (snapshot == NULL) {
+    error("script restore without a snapshot");
+    return;
+  }
+  if (trs_snapshot_restore(snapshot) == 0)
+    trs_screen_init();
+}
+#endif
+
+static void script_start(ScriptCommand *c)
+{
+  switch (c->command) {
+    case SCRIPT_TYPE:
+      key_index = 0;
+      key_up = FALSE;
+      if (turbo_paste) {
+        turbo_saved = timer_overclock;
+        trs_turbo_mode(1);
+      }
+      break;
+    case SCRIPT_WAIT:
+      trs_screen_match_start(c->text, c->row, c->col, c->value);
+      break;
+    case SCRIPT_WAITPC:
+      trs_script_pc = c->value;
+      break;
+    case SCRIPT_DELAY:
+      delay_ticks = c->value * timer_hz / 1000;
+      break;
+    case SCRIPT_BASIC:
+      trs_load_basic(c->text);
+      break;
+    case SCRIPT_SCREEN:
+      script_screen(c->text);
+      break;
+#ifndef _WIN32
+    case SCRIPT_SNAPSHOT:
+      script_snapshot();
+      break;
+    case SCRIPT_RESTORE:
+      script_restore();
+      break;
+#else
+    case SCRIPT_SNAPSHOT:
+    case SCRIPT_RESTORE:
+      error("script snapshots are not supported on this platform");
+      break;
+#endif
+    case SCRIPT_QUIT:
+      trs_exit(0);
+      break;
+  }
+  started = TRUE;
+}
+
+static int script_done(ScriptCommand *c)
+{
+  switch (c->command) {
+    case SCRIPT_TYPE:
+      if (key_index < c->value)
+        return FALSE;
+      if (turbo_paste)
+        trs_turbo_mode(turbo_saved);
+      return TRUE;
+    case SCRIPT_WAIT:
+      if (!trs_screen_match())
+        return FALSE;
+      trs_screen_match_stop();
+      return TRUE;
+    case SCRIPT_WAITPC:
+      return trs_script_pc == -1;
+    case SCRIPT_DELAY:
+      return delay_ticks-- <= 0;
+  }
+  return TRUE;
+}
+
+/* Advance the script, called once per timer tick */
+void trs_script_tick(void)
+{
+  while (current < num_commands) {
+    ScriptCommand *c = &commands[current];
+
+    if (!started)
+      script_start(c);
+    if (!script_done(c))
+      return;
+    free(c->keys);
+    free(c->text);
+    started = FALSE;
+    current++;
+  }
+  /* Everything is done, reuse the table for the next text */
+  current = num_commands = 0;
+#ifndef _WIN32
+  trs_snapshot_free(snapshot);
+  snapshot = NULL;
+#endif
+}
@@ -0,0 +1,19 @@
+/*
+ * trs_script.h -- scripted keyboard input
+ */
+#ifndef _TRS_SCRIPT_H
+#define _TRS_SCRIPT_H
+
+/* Address the script is waiting for, -1 if none */
+extern int trs_script_pc;
+
+extern int trs_script_load(const char *filename);
+extern void trs_script_command(const char *command);
+extern void trs_script_type(const char *text, int escapes);
+extern void trs_script_abort(void);
+extern int trs_script_typing(void);
+extern int trs_script_key(void);
+extern void trs_script_tick(void);
+extern void trs_script_pc_reached(void);
+
+#endif /* _TRS_SCRIPT_H */
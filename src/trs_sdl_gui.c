@@ -2301,7 +2301,7 @@ void trs_gui_printer_management(void)
    {"Printer Command:", MENU_TITLE_TYPE},
    {"   ", MENU_NORMAL_TYPE},
    {"", 0}};
-  const char *printer_choices[2] = {"     None", "     Text"};
+  const char *printer_choices[4] = {"     None", "     Text", "      Raw", "     Pipe"};
   int selection = 0;
 
   while (1) {
@@ -2318,7 +2318,7 @@ void trs_gui_printer_management(void)
           trs_gui_display_message("Warning", "No Printer Output in File");
         break;
       case 1:
-        trs_printer = trs_gui_display_popup("Printer", printer_choices, 2, trs_printer);
+        trs_printer = trs_gui_display_popup("Printer", printer_choices, 4, trs_printer);
         break;
       case 3:
         filename[0] = 0;
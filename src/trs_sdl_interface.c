@@ -41,17 +41,28 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <regex.h>
+#endif
 #include <SDL.h>
 #include "blit.h"
 #include "error.h"
 #include "trs.h"
+#include "trs_bench.h"
 #include "trs_cassette.h"
 #include "trs_disk.h"
+#include "trs_hard.h"
 #include "trs_iodefs.h"
+#include "trs_overlay.h"
+#include "trs_perf.h"
+#include "trs_profile.h"
 #include "trs_sdl_gui.h"
+#include "trs_script.h"
 #include "trs_sdl_keyboard.h"
 #include "trs_state_save.h"
 #include "trs_stringy.h"
+#include "trs_trace.h"
+#include "trs_video.h"
 #include "trs_uart.h"
 #include "web_debugger.h"
 
@@ -112,6 +123,7 @@ char trs_printer_command[FILENAME_MAX];
 static Uint8 trs_screen[2048];
 static int cpu_panel = 0;
 static int debugger = 0;
+static long trace_size = 0;
 static int screen_chars = 1024;
 static int row_chars = 64;
 static int col_chars = 16;
@@ -151,12 +163,6 @@ static Uint32 bright_orange;
 static Uint32 last_key[256];
 
 #if defined(SDL2) || !defined(NOX)
-#define PASTE_IDLE    0
-#define PASTE_GETNEXT 1
-#define PASTE_KEYDOWN 2
-#define PASTE_KEYUP   3
-static int  paste_state = PASTE_IDLE;
-static int  paste_lastkey = FALSE;
 extern int  PasteManagerStartPaste(void);
 extern void PasteManagerStartCopy(const char *string);
 extern int  PasteManagerGetChar(Uint8 *character);
@@ -171,8 +177,6 @@ static int selectionStartY = 0;
 static int selectionEndX = 0;
 static int selectionEndY = 0;
 static int requestSelectAll = FALSE;
-static int timer_saved;
-static unsigned int cycles_saved;
 #endif
 
 /* Support for Micro-Labs Grafyx Solution and Radio Shack hi-res card */
@@ -188,6 +192,13 @@ static Uint8 grafyx_x = 0, grafyx_y = 0, grafyx_mode = 0;
 static Uint8 grafyx_enable = 0;
 static Uint8 grafyx_overlay = 0;
 static Uint8 grafyx_xoffset = 0, grafyx_yoffset = 0;
+/* Bit patterns of a byte expanded to scale 2, 3 and 4 */
+static Uint8 grafyx_expand[MAX_SCALE - 1][256][MAX_SCALE];
+/* Bytes written since the last frame, drawn by grafyx_update() */
+static Uint8 grafyx_dirty[G_YSIZE][G_XSIZE];
+static Uint8 grafyx_dirty_row[G_YSIZE];
+static Uint8 grafyx_dirty_cell[80 * 24];
+static int grafyx_dirty_count = 0;
 
 /* Port 0x83 (grafyx_mode) bits */
 #define G_ENABLE    1
@@ -210,11 +221,24 @@ static Uint8 grafyx_xoffset = 0, grafyx_yoffset = 0;
 static Uint8 hrg_screen[HRG_MEMSIZE];
 static int hrg_pixel_x[2][6 + 1];
 static int hrg_pixel_y[12 + 1];
-static int hrg_pixel_width[2][6];
 static int hrg_pixel_height[12];
 static int hrg_enable = 0;
 static int hrg_addr = 0;
+/* Runs of set bits in a 6-bit pattern: start and width */
+static Uint8 hrg_runs[64][3][2];
+static Uint8 hrg_run_count[64];
+/* Character cells with graphics written since the last frame: 0 if the
+   cell is not in hrg_dirty_list, 1 if it is and needs a redraw, 2 if it
+   is but was redrawn with its text already.  A cell is listed only once,
+   so the list cannot overflow. */
+#define HRG_CLEAN	0
+#define HRG_DIRTY	1
+#define HRG_DRAWN	2
+static Uint8 hrg_dirty[1024];
+static short hrg_dirty_list[1024];
+static int hrg_dirty_count = 0;
 static void hrg_update_char(int position);
+static void hrg_update(void);
 
 /* Option handling */
 typedef struct trs_opt_struct {
@@ -225,6 +249,9 @@ typedef struct trs_opt_struct {
   void *strArg;
 } trs_opt;
 
+static void trs_opt_basic(char *arg, int intarg, int *stringarg);
+static void trs_opt_benchmark(char *arg, int intarg, int *stringarg);
+static void trs_opt_benchout(char *arg, int intarg, int *stringarg);
 static void trs_opt_borderwidth(char *arg, int intarg, int *stringarg);
 static void trs_opt_cass(char *arg, int intarg, int *stringarg);
 static void trs_opt_charset(char *arg, int intarg, int *stringarg);
@@ -237,19 +264,28 @@ static void trs_opt_doubler(char *arg, int intarg, int *stringarg);
 #ifdef __linux
 static void trs_opt_doublestep(char *arg, int intarg, int *stringarg);
 #endif
+static void trs_opt_emtlatency(char *arg, int intarg, int *stringarg);
+#ifndef _WIN32
+static void trs_opt_fork(char *arg, int intarg, int *variable);
+#endif
 static void trs_opt_hard(char *arg, int intarg, int *stringarg);
 static void trs_opt_huffman(char *arg, int intarg, int *stringarg);
 static void trs_opt_hypermem(char *arg, int intarg, int *stringarg);
+static void trs_opt_ioports(char *arg, int intarg, int *stringarg);
+static void trs_opt_iotrace(char *arg, int intarg, int *stringarg);
 static void trs_opt_joybuttonmap(char *arg, int intarg, int *stringarg);
 static void trs_opt_joysticknum(char *arg, int intarg, int *stringarg);
 static void trs_opt_keystretch(char *arg, int intarg, int *stringarg);
 static void trs_opt_microlabs(char *arg, int intarg, int *stringarg);
 static void trs_opt_model(char *arg, int intarg, int *stringarg);
+static void trs_opt_perflog(char *arg, int intarg, int *stringarg);
 static void trs_opt_printer(char *arg, int intarg, int *stringarg);
+static void trs_opt_profile(char *arg, int intarg, int *stringarg);
 static void trs_opt_rom(char *arg, int intarg, int *stringarg);
 static void trs_opt_samplerate(char *arg, int intarg, int *stringarg);
 static void trs_opt_scale(char *arg, int intarg, int *stringarg);
 static void trs_opt_scanshade(char *arg, int intarg, int *stringarg);
+static void trs_opt_script(char *arg, int intarg, int *stringarg);
 static void trs_opt_selector(char *arg, int intarg, int *stringarg);
 static void trs_opt_shiftbracket(char *arg, int intarg, int *stringarg);
 static void trs_opt_sizemap(char *arg, int intarg, int *stringarg);
@@ -260,12 +296,19 @@ static void trs_opt_stepmap(char *arg, int intarg, int *stringarg);
 static void trs_opt_string(char *arg, int intarg, int *stringarg);
 static void trs_opt_supermem(char *arg, int intarg, int *stringarg);
 static void trs_opt_switches(char *arg, int intarg, int *stringarg);
+static void trs_opt_trace(char *arg, int intarg, int *stringarg);
+static void trs_opt_tracesize(char *arg, int intarg, int *stringarg);
 static void trs_opt_turborate(char *arg, int intarg, int *stringarg);
+static void trs_opt_type(char *arg, int intarg, int *stringarg);
 static void trs_opt_value(char *arg, int intarg, int *variable);
+static void trs_opt_video(char *arg, int intarg, int *stringarg);
 static void trs_opt_wafer(char *arg, int intarg, int *stringarg);
 
 static const trs_opt options[] = {
   { "background",      trs_opt_color,         1, 0, &background          },
+  { "basic",           trs_opt_basic,         1, 0, NULL                 },
+  { "benchmark",       trs_opt_benchmark,     1, 0, NULL                 },
+  { "benchout",        trs_opt_benchout,      1, 0, NULL                 },
   { "bg",              trs_opt_color,         1, 0, &background          },
   { "borderwidth",     trs_opt_borderwidth,   1, 0, NULL                 },
   { "bw",              trs_opt_borderwidth,   1, 0, NULL                 },
@@ -296,9 +339,14 @@ static const trs_opt options[] = {
 #ifdef __linux
   { "doublestep",      trs_opt_doublestep,    0, 2, NULL                 },
 #endif
+  { "emtlatency",      trs_opt_emtlatency,    1, 0, NULL                 },
   { "emtsafe",         trs_opt_value,         0, 1, &trs_emtsafe         },
   { "fg",              trs_opt_color,         1, 0, &foreground          },
   { "foreground",      trs_opt_color,         1, 0, &foreground          },
+#ifndef _WIN32
+  { "fork",            trs_opt_fork,          1, 0, &trs_fork_count      },
+  { "forkdelay",       trs_opt_fork,          1, 0, &trs_fork_delay      },
+#endif
   { "fullscreen",      trs_opt_value,         0, 1, &fullscreen          },
   { "fs",              trs_opt_value,         0, 1, &fullscreen          },
   { "guibackground",   trs_opt_color,         1, 0, &gui_background      },
@@ -313,6 +361,8 @@ static const trs_opt options[] = {
   { "hideled",         trs_opt_value,         0, 0, &trs_show_led        },
   { "huffman",         trs_opt_huffman,       0, 1, NULL                 },
   { "hypermem",        trs_opt_hypermem,      0, 1, NULL                 },
+  { "ioports",         trs_opt_ioports,       1, 0, NULL                 },
+  { "iotrace",         trs_opt_iotrace,       1, 0, NULL                 },
   { "joyaxismapped",   trs_opt_value,         0, 1, &jaxis_mapped        },
   { "joybuttonmap",    trs_opt_joybuttonmap,  1, 0, NULL                 },
   { "joysticknum",     trs_opt_joysticknum,   1, 0, NULL                 },
@@ -346,6 +396,8 @@ static const trs_opt options[] = {
   { "nolowercase",     trs_opt_value,         0, 0, &lowercase           },
   { "nomicrolabs",     trs_opt_microlabs,     0, 0, NULL                 },
   { "nomousepointer",  trs_opt_value,         0, 0, &mousepointer        },
+  { "nooverlay",       trs_opt_value,         0, 0, &trs_overlay         },
+  { "nooverlaycommit", trs_opt_value,         0, 0, &trs_overlay_commit  },
   { "noresize3",       trs_opt_value,         0, 0, &resize3             },
   { "noresize4",       trs_opt_value,         0, 0, &resize4             },
   { "noscanlines",     trs_opt_value,         0, 0, &scanlines           },
@@ -359,9 +411,13 @@ static const trs_opt options[] = {
 #if defined(SDL2) || !defined(NOX)
   { "noturbopaste",    trs_opt_value,         0, 0, &turbo_paste         },
 #endif
+  { "overlay",         trs_opt_value,         0, 1, &trs_overlay         },
+  { "overlaycommit",   trs_opt_value,         0, 1, &trs_overlay_commit  },
+  { "perflog",         trs_opt_perflog,       1, 0, NULL                 },
   { "printer",         trs_opt_printer,       1, 0, NULL                 },
   { "printercmd",      trs_opt_string,        1, 0, trs_printer_command  },
   { "printerdir",      trs_opt_dirname,       1, 0, trs_printer_dir      },
+  { "profile",         trs_opt_profile,       1, 0, NULL                 },
   { "resize3",         trs_opt_value,         0, 1, &resize3             },
   { "resize4",         trs_opt_value,         0, 1, &resize4             },
   { "rom",             trs_opt_rom,           1, 0, NULL                 },
@@ -373,6 +429,7 @@ static const trs_opt options[] = {
   { "scale",           trs_opt_scale,         1, 0, NULL                 },
   { "scanlines",       trs_opt_value,         0, 1, &scanlines           },
   { "scanshade",       trs_opt_scanshade,     1, 0, NULL                 },
+  { "script",          trs_opt_script,        1, 0, NULL                 },
   { "selector",        trs_opt_selector,      0, 1, NULL                 },
   { "serial",          trs_opt_string,        1, 0, trs_uart_name        },
   { "shiftbracket",    trs_opt_shiftbracket,  0, 1, NULL                 },
@@ -387,12 +444,16 @@ static const trs_opt options[] = {
   { "stringy",         trs_opt_value,         0, 1, &stringy             },
   { "supermem",        trs_opt_supermem,      0, 1, NULL                 },
   { "switches",        trs_opt_switches,      1, 0, NULL                 },
+  { "trace",           trs_opt_trace,         1, 0, NULL                 },
+  { "tracesize",       trs_opt_tracesize,     1, 0, NULL                 },
   { "truedam",         trs_opt_value,         0, 1, &trs_disk_truedam    },
   { "turbo",           trs_opt_value,         0, 1, &timer_overclock     },
 #if defined(SDL2) || !defined(NOX)
   { "turbopaste",      trs_opt_value,         0, 1, &turbo_paste         },
 #endif
   { "turborate",       trs_opt_turborate,     1, 0, NULL                 },
+  { "type",            trs_opt_type,          1, 0, NULL                 },
+  { "video",           trs_opt_video,         1, 0, NULL                 },
   { "wafer0",          trs_opt_wafer,         1, 0, NULL                 },
   { "wafer1",          trs_opt_wafer,         1, 1, NULL                 },
   { "wafer2",          trs_opt_wafer,         1, 2, NULL                 },
@@ -407,7 +468,10 @@ static const int num_options = sizeof(options) / sizeof(trs_opt);
 
 /* Private routines */
 static void bitmap_init(void);
+static void grafyx_init_expand(void);
 static void grafyx_rescale(int y, int x, char byte);
+static void grafyx_update(void);
+static void grafyx_clear_dirty(void);
 
 static void stripWhitespace(char *inputStr)
 {
@@ -452,6 +516,27 @@ static const char *charset_name(int charset)
   }
 }
 
+static void trs_opt_basic(char *arg, int intarg, int *stringarg)
+{
+  char command[FILENAME_MAX + 8];
+
+  /* Wait for BASIC to set up its pointers */
+  trs_script_command("wait READY");
+  snprintf(command, sizeof(command), "basic %s", arg);
+  trs_script_command(command);
+}
+
+static void trs_opt_benchmark(char *arg, int intarg, int *stringarg)
+{
+  if (trs_bench_select(arg) != 0)
+    exit(EXIT_FAILURE);
+}
+
+static void trs_opt_benchout(char *arg, int intarg, int *stringarg)
+{
+  trs_bench_output(arg);
+}
+
 static void trs_opt_borderwidth(char *arg, int intarg, int *stringarg)
 {
   window_border_width = atol(arg);
@@ -617,6 +702,25 @@ static void trs_opt_stepmap(char *arg, int intarg, int *stringarg)
 }
 #endif
 
+static void trs_opt_emtlatency(char *arg, int intarg, int *stringarg)
+{
+  trs_emt_latency = atoi(arg);
+  if (trs_emt_latency < 0)
+    trs_emt_latency = 0;
+}
+
+#ifndef _WIN32
+static void trs_opt_fork(char *arg, int intarg, int *variable)
+{
+  *variable = atoi(arg);
+  if (*variable < 0)
+    *variable = 0;
+  /* The processes can't share one window and audio device */
+  if (variable == &trs_fork_count && trs_fork_count > 0)
+    trs_headless();
+}
+#endif
+
 static void trs_opt_hard(char *arg, int intarg, int *stringarg)
 {
   trs_hard_attach(intarg, arg);
@@ -636,6 +740,16 @@ static void trs_opt_hypermem(char *arg, int intarg, int *stringarg)
     huffman_ram = 0;
 }
 
+static void trs_opt_ioports(char *arg, int intarg, int *stringarg)
+{
+  trs_io_trace_ports(arg);
+}
+
+static void trs_opt_iotrace(char *arg, int intarg, int *stringarg)
+{
+  trs_io_trace_start(arg);
+}
+
 static void trs_opt_joybuttonmap(char *arg, int intarg, int *stringarg)
 {
   int i;
@@ -706,11 +820,16 @@ static void trs_opt_rom(char *arg, int intarg, int *stringarg)
    }
 }
 
+static void trs_opt_perflog(char *arg, int intarg, int *stringarg)
+{
+  trs_perf_log(arg);
+}
+
 static void trs_opt_printer(char *arg, int intarg, int *stringarg)
 {
   if (isdigit((int)*arg)) {
     trs_printer = atoi(arg);
-    if (trs_printer < 0 || trs_printer > 1)
+    if (trs_printer < 0 || trs_printer > 3)
       trs_printer = 0;
   } else
     switch (tolower((int)*arg)) {
@@ -720,11 +839,22 @@ static void trs_opt_printer(char *arg, int intarg, int *stringarg)
       case 't': /*text*/
         trs_printer = 1;
         break;
+      case 'r': /*raw*/
+        trs_printer = 2;
+        break;
+      case 'p': /*pipe*/
+        trs_printer = 3;
+        break;
       default:
         error("unknown printer type: %s", arg);
     }
 }
 
+static void trs_opt_profile(char *arg, int intarg, int *stringarg)
+{
+  trs_profile_start(arg);
+}
+
 static void trs_opt_samplerate(char *arg, int intarg, int *stringarg)
 {
   cassette_default_sample_rate = atol(arg);
@@ -747,6 +877,11 @@ static void trs_opt_scanshade(char *arg, int intarg, int *stringarg)
   scanshade = atoi(arg) & 255;
 }
 
+static void trs_opt_script(char *arg, int intarg, int *stringarg)
+{
+  trs_script_load(arg);
+}
+
 static void trs_opt_selector(char *arg, int intarg, int *stringarg)
 {
   selector = intarg;
@@ -808,6 +943,18 @@ static void trs_opt_switches(char *arg, int intarg, int *stringarg)
   trs_uart_switches = strtol(arg, NULL, base);
 }
 
+static void trs_opt_trace(char *arg, int intarg, int *stringarg)
+{
+  trs_trace_start(arg, trace_size);
+}
+
+static void trs_opt_tracesize(char *arg, int intarg, int *stringarg)
+{
+  trace_size = atol(arg);
+  if (trs_trace)
+    trs_trace_start(NULL, trace_size);
+}
+
 static void trs_opt_turborate(char *arg, int intarg, int *stringarg)
 {
   timer_overclock_rate = atoi(arg);
@@ -815,11 +962,21 @@ static void trs_opt_turborate(char *arg, int intarg, int *stringarg)
     timer_overclock_rate = 1;
 }
 
+static void trs_opt_type(char *arg, int intarg, int *stringarg)
+{
+  trs_script_type(arg, TRUE);
+}
+
 static void trs_opt_value(char *arg, int intarg, int *variable)
 {
   *variable = intarg;
 }
 
+static void trs_opt_video(char *arg, int intarg, int *stringarg)
+{
+  trs_video_start(arg);
+}
+
 static void trs_opt_wafer(char *arg, int intarg, int *stringarg)
 {
   stringy_insert(intarg, arg);
@@ -928,6 +1085,7 @@ int trs_load_config_file(void)
   trs_charset4 = 8;
   trs_disk_doubler = TRSDISK_BOTH;
   trs_disk_truedam = 0;
+  trs_emt_latency = 0;
   trs_emtsafe = 1;
   trs_joystick_num = 0;
   trs_kb_bracket(FALSE);
@@ -940,6 +1098,10 @@ int trs_load_config_file(void)
   if (trs_config_file[0] == 0) {
     const char *home = getenv("HOME");
 
+    /* Benchmarks must not depend on the user's settings */
+    if (trs_bench)
+      return -1;
+
     if (home)
       snprintf(trs_config_file, FILENAME_MAX, "%s/.sdltrs.t8c", home);
     else
@@ -997,6 +1159,8 @@ void trs_parse_command_line(int argc, char **argv, int *debug)
     if (argv[i][0] == '-') {
       for (j = 0; j < num_options; j++) {
         if (strcasecmp(&argv[i][1], options[j].name) == 0) {
+          if (options[j].handler == trs_opt_benchmark)
+            trs_bench = 1;
           if (options[j].hasArg)
             i++;
           break;
@@ -1034,6 +1198,12 @@ void trs_parse_command_line(int argc, char **argv, int *debug)
       error("unrecognized option %s", argv[i]);
   }
 
+  /* Images from the config file or before -overlay must be covered too */
+  if (trs_overlay) {
+    trs_disk_overlay();
+    trs_hard_overlay();
+  }
+
   *debug = debugger;
   trs_disk_setsizes();
 #ifdef __linux
@@ -1089,6 +1259,7 @@ int trs_write_config_file(const char *filename)
       fprintf(config_file, "none\n");
       break;
   }
+  fprintf(config_file, "emtlatency=%d\n", trs_emt_latency);
   fprintf(config_file, "%semtsafe\n", trs_emtsafe ? "" : "no");
   fprintf(config_file, "%sfullscreen\n", fullscreen ? "" : "no");
   fprintf(config_file, "foreground=0x%x\n", foreground);
@@ -1194,12 +1365,15 @@ void trs_screen_var_reset(void)
 
 void trs_screen_caption(void)
 {
-  char title[80];
+  char title[160];
 
-  if (cpu_panel)
-    snprintf(title, 79, "AF:%04X BC:%04X DE:%04X HL:%04X IX/IY:%04X/%04X PC/SP:%04X/%04X",
-             Z80_AF, Z80_BC, Z80_DE, Z80_HL, Z80_IX, Z80_IY, Z80_PC, Z80_SP);
-  else {
+  if (cpu_panel) {
+    char perf[64];
+
+    trs_perf_summary(perf, sizeof(perf));
+    snprintf(title, 159, "AF:%04X BC:%04X DE:%04X HL:%04X IX/IY:%04X/%04X PC/SP:%04X/%04X %s",
+             Z80_AF, Z80_BC, Z80_DE, Z80_HL, Z80_IX, Z80_IY, Z80_PC, Z80_SP, perf);
+  } else {
     const char *trs_name[] = { "", "I", "", "III", "4", "4P" };
 
     snprintf(title, 79, "%sTRS-80 Model %s (%.2f MHz) %s%s",
@@ -1297,6 +1471,7 @@ void trs_screen_init(void)
 #endif
   SDL_ShowCursor(mousepointer ? SDL_ENABLE : SDL_DISABLE);
 
+  grafyx_init_expand();
   for (y = 0; y < G_YSIZE; y++)
     for (x = 0; x < G_XSIZE; x++)
       grafyx_rescale(y, x, grafyx_unscaled[y][x]);
@@ -1506,17 +1681,25 @@ static void ProcessCopySelection(int selectAll)
  */
 void trs_sdl_flush(void)
 {
+  Uint32 flush_start;
+
 #if defined(SDL2) || !defined(NOX)
   if (mousepointer) {
-    if (!trs_emu_mouse && paste_state == PASTE_IDLE) {
+    if (!trs_emu_mouse && !trs_script_typing()) {
       ProcessCopySelection(requestSelectAll);
       requestSelectAll = FALSE;
     }
   }
 #endif
+  grafyx_update();
+  hrg_update();
   if (drawnRectCount == 0)
     return;
 
+  flush_start = trs_perf_time();
+  trs_perf.frames++;
+  trs_perf.rects += drawnRectCount == MAX_RECTS ? 1 : drawnRectCount;
+
   if (scanlines) {
 #ifdef OLD_SCANLINES
     SDL_Rect rect;
@@ -1555,6 +1738,7 @@ void trs_sdl_flush(void)
     SDL_UpdateRects(screen, drawnRectCount, drawnRects);
 #endif
   drawnRectCount = 0;
+  trs_perf.flush_us += trs_perf_time() - flush_start;
 }
 
 void trs_exit(int confirm)
@@ -1685,8 +1869,338 @@ static char *trs_get_copy_data(void)
   *curr_data = 0;
   return copy_data;
 }
+
+/* Type the clipboard contents through the script engine */
+static void trs_paste(void)
+{
+  char *text = NULL;
+  int len = 0, size = 0;
+  Uint8 data;
+  int more;
+
+  if (!PasteManagerStartPaste())
+    return;
+  do {
+    more = PasteManagerGetChar(&data);
+    if (len + 1 >= size) {
+      char *new_text = realloc(text, size += 1024);
+
+      if (new_text == NULL)
+        break;
+      text = new_text;
+    }
+    text[len++] = data;
+  } while (more);
+
+  if (text) {
+    text[len] = 0;
+    trs_script_type(text, FALSE);
+    free(text);
+  }
+}
 #endif
 
+/*
+ * Unicode for the text screen, following the character sets of
+ * trs_chars.c.  Glyphs without a close Unicode equivalent map to
+ * U+FFFD.
+ */
+
+/* Model I character sets that differ from ASCII */
+static const struct {
+  Uint8 charset;
+  Uint8 data;
+  Uint16 unicode;
+} unicode_model1[] = {
+  {  1, 0x5b, 0x2191 }, {  1, 0x5c, 0x2193 }, {  1, 0x5d, 0x2190 }, {  1, 0x5e, 0x2192 },
+  {  2, 0x5b, 0x2191 }, {  2, 0x5c, 0x2193 }, {  2, 0x5d, 0x2190 }, {  2, 0x5e, 0x2192 },
+  {  3, 0x5b, 0x2191 }, {  3, 0x5c, 0x2193 }, {  3, 0x5d, 0x2190 }, {  3, 0x5e, 0x2192 },
+  { 10, 0x5b, 0x00c4 }, { 10, 0x5c, 0x00d6 }, { 10, 0x5d, 0x00dc }, { 10, 0x5e, 0x2191 },
+  { 10, 0x5f, 0x2584 }, { 10, 0x7b, 0x00e4 }, { 10, 0x7c, 0x00f6 }, { 10, 0x7d, 0x00fc },
+  { 10, 0x7e, 0x00df },
+  { 11, 0x5b, 0x2191 }, { 11, 0x5c, 0x00d6 }, { 11, 0x5d, 0x00c1 }, { 11, 0x5e, 0x00dc },
+  { 11, 0x7c, 0x00f6 }, { 11, 0x7d, 0x00e1 }, { 11, 0x7e, 0x00fc },
+};
+
+/* 0x00-0x1f of the Model III/4 katakana and bold sets */
+static const Uint16 unicode_foreign[32] = {
+  0x0020, 0x00a3, 0x00a6, 0x00e9, 0x00dc, 0x00c5, 0x00ac, 0x00f6,
+  0x00d8, 0x00f9, 0x00f1, 0x0060, 0xfffd, 0xfffd, 0x00c4, 0x00c3,
+  0x00d1, 0x00d6, 0x00f8, 0x00d5, 0x00df, 0x00fc, 0x00f5, 0xfffd,
+  0x00e4, 0x00e0, 0x00e5, 0x00a7, 0x00c9, 0xfffd, 0x00c7, 0x007e,
+};
+
+/* 0x00-0x1f and 0xc0-0xff of the Model III/4 international set */
+static const Uint16 unicode_international[2][64] = {
+  {
+  0x00c4, 0x00d6, 0x00dc, 0x00e9, 0x00df, 0x00f3, 0x00a3, 0x00a7,
+  0x00e4, 0x00f6, 0x00fc, 0x00e0, 0x00e8, 0x00f9, 0x00b0, 0x00eb,
+  0x00ef, 0x00e2, 0x00ea, 0x00ee, 0x00f4, 0x00fb, 0x00e7, 0xfffd,
+  0xfffd, 0x00a4, 0x258c, 0x25e3, 0x2261, 0xfffd, 0x0192, 0x0020,
+  },
+  {
+  0x00b4, 0x00e0, 0x00e7, 0x00a3, 0x0060, 0x00b5, 0x00b0, 0xfffd,
+  0x2020, 0x00a7, 0x00ae, 0x00a9, 0x00bc, 0x00be, 0x00bd, 0x00b6,
+  0x00a5, 0x00c4, 0x00d6, 0x00dc, 0x00a2, 0x007e, 0x00e4, 0x00f6,
+  0x00fc, 0x00df, 0x2122, 0x00e9, 0x00f9, 0x00e8, 0x00a8, 0x0192,
+  0x00e2, 0x00ea, 0x00ee, 0x00f4, 0x00fb, 0x005e, 0x00eb, 0x00ef,
+  0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00a1, 0x00f1, 0x00e3, 0x00f5,
+  0x00c6, 0x00e6, 0x00c5, 0x00e5, 0x00d8, 0x00f8, 0x00d1, 0x00c9,
+  0x00c1, 0x00cd, 0x00d3, 0x00da, 0x00bf, 0x00d9, 0x00c8, 0x00c0,
+  },
+};
+
+/* 0x80-0xbf of the Model III/4 character sets */
+static const Uint16 unicode_symbols[64] = {
+  0x2660, 0x2665, 0x2666, 0x2663, 0x263a, 0x2639, 0x2264, 0x2265,
+  0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7, 0x03b8,
+  0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf, 0x03c0,
+  0x03c1, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7, 0x03c8, 0x03c9,
+  0x03a9, 0x221a, 0x00f7, 0x03a3, 0x2248, 0x0394, 0xfffd, 0x2260,
+  0xfffd, 0xfffd, 0xfffd, 0x221e, 0x2713, 0x00a7, 0xfffd, 0x00a9,
+  0x00a4, 0x00b6, 0x00a2, 0x00ae, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+  0xfffd, 0xfffd, 0x2640, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+};
+
+/* Unicode for a character on the screen, selected like trs_screen_write_char */
+static unsigned int screen_unicode(Uint8 data)
+{
+  int i;
+
+  if (trs_model == 1 && data >= 0xc0)
+    data -= 0x40;
+  if (data >= 0x80 && data <= 0xbf && !(currentmode & INVERSE)) {
+    /* Block graphics, the bits in the order of the Unicode sextants */
+    int const bits = data - 0x80;
+
+    switch (bits) {
+      case 0:
+        return ' ';
+      case 21:
+        return 0x258c;
+      case 42:
+        return 0x2590;
+      case 63:
+        return 0x2588;
+      default:
+        return 0x1fb00 + bits - 1 - (bits > 21) - (bits > 42);
+    }
+  }
+  if (trs_model > 1 && data >= 0xc0 &&
+      (currentmode & (ALTERNATE + INVERSE)) == 0)
+    data -= 0x40;
+  if ((currentmode & INVERSE) && (data & 0x80))
+    data &= 0x7f;
+
+  if (trs_model == 1) {
+    if (data < 0x20)
+      data += 0x40;
+    for (i = 0; i < (int)(sizeof(unicode_model1) / sizeof(unicode_model1[0])); i++)
+      if (unicode_model1[i].charset == trs_charset &&
+          unicode_model1[i].data == data)
+        return unicode_model1[i].unicode;
+    return data == 0x7f ? 0x2592 : data;
+  }
+
+  if (data < 0x20) {
+    if (trs_charset == 5 || trs_charset == 8)
+      return unicode_international[0][data];
+    return unicode_foreign[data];
+  }
+  if (data < 0x7f)
+    return data;
+  if (data == 0x7f)
+    return 0x00b1;
+  if (data < 0xc0)
+    return unicode_symbols[data - 0x80];
+  switch (trs_charset) {
+    case 4:
+    case 7:
+      /* Yen and JIS X 0201 katakana */
+      return data == 0xc0 ? 0x00a5 : 0xff61 + data - 0xc1;
+    case 5:
+    case 8:
+      return unicode_international[1][data - 0xc0];
+    default:
+      /* Bold set: inverse video copy of 0x20-0x5f */
+      return data - 0xa0;
+  }
+}
+
+static int utf8_put(char *buf, unsigned int c)
+{
+  if (c < 0x80) {
+    buf[0] = c;
+    return 1;
+  }
+  if (c < 0x800) {
+    buf[0] = 0xc0 | (c >> 6);
+    buf[1] = 0x80 | (c & 0x3f);
+    return 2;
+  }
+  if (c < 0x10000) {
+    buf[0] = 0xe0 | (c >> 12);
+    buf[1] = 0x80 | ((c >> 6) & 0x3f);
+    buf[2] = 0x80 | (c & 0x3f);
+    return 3;
+  }
+  buf[0] = 0xf0 | (c >> 18);
+  buf[1] = 0x80 | ((c >> 12) & 0x3f);
+  buf[2] = 0x80 | ((c >> 6) & 0x3f);
+  buf[3] = 0x80 | (c & 0x3f);
+  return 4;
+}
+
+/*
+ * A row of the text screen from column col in UTF-8, without trailing
+ * spaces.  Needs up to 4 bytes per column and the terminating NUL.
+ * Expanded characters count as one column.  Returns the length.
+ */
+static int screen_row_text(int row, int col, char *buf)
+{
+  int const step = (currentmode & EXPANDED) ? 2 : 1;
+  int len = 0;
+
+  if (!(grafyx_enable && !grafyx_overlay))
+    for (col *= step; col < row_chars; col += step)
+      len += utf8_put(buf + len, screen_unicode(trs_screen[row * row_chars + col]));
+  while (len > 0 && buf[len - 1] == ' ')
+    len--;
+  buf[len] = 0;
+  return len;
+}
+
+/*
+ * The text screen in UTF-8, one line per row.
+ * The buffer should hold TRS_SCREEN_TEXT bytes.  Returns the length.
+ */
+int trs_screen_text(char *buf, int size)
+{
+  char line[80 * 4 + 1];
+  int row, len = 0;
+
+  for (row = 0; row < col_chars; row++) {
+    int const n = screen_row_text(row, 0, line);
+
+    if (len + n + 2 > size)
+      break;
+    memcpy(buf + len, line, n);
+    len += n;
+    buf[len++] = '\n';
+  }
+  buf[len] = 0;
+  return len;
+}
+
+/*
+ * Wait for text on the screen.  Rows written by trs_screen_write_char
+ * are marked, and trs_screen_match only examines those again.
+ */
+static char *match_text;
+static int match_row, match_col;
+static Uint8 match_dirty[24];
+#ifndef _WIN32
+static regex_t match_regex;
+static int match_is_regex;
+#endif
+
+void trs_screen_match_stop(void)
+{
+  if (match_text == NULL)
+    return;
+#ifndef _WIN32
+  if (match_is_regex)
+    regfree(&match_regex);
+  match_is_regex = FALSE;
+#endif
+  free(match_text);
+  match_text = NULL;
+}
+
+/*
+ * Wait for text at row and col, or anywhere on the screen if row is -1.
+ * With regex, text is an extended regular expression that has to match
+ * a row, or the row from col on.
+ */
+int trs_screen_match_start(const char *text, int row, int col, int regex)
+{
+  trs_screen_match_stop();
+#ifdef _WIN32
+  if (regex) {
+    error("regular expressions are not supported on this platform");
+    return -1;
+  }
+#else
+  if (regex) {
+    int const err = regcomp(&match_regex, text, REG_EXTENDED | REG_NOSUB);
+
+    if (err != 0) {
+      char msg[256];
+
+      regerror(err, &match_regex, msg, sizeof(msg));
+      error("bad regular expression '%s': %s", text, msg);
+      return -1;
+    }
+    match_is_regex = TRUE;
+  }
+#endif
+  if ((match_text = strdup(text)) == NULL) {
+    error("failed to allocate screen match: %s", strerror(errno));
+    trs_screen_match_stop();
+    return -1;
+  }
+  match_row = row;
+  match_col = col;
+  memset(match_dirty, 1, sizeof(match_dirty));
+  return 0;
+}
+
+/* TRUE once the text is on the screen, or if there is nothing to wait for */
+int trs_screen_match(void)
+{
+  char line[80 * 4 + 1];
+  int row;
+
+  if (match_text == NULL)
+    return TRUE;
+  for (row = 0; row < col_chars; row++) {
+    if (!match_dirty[row] || (match_row >= 0 && row != match_row))
+      continue;
+    match_dirty[row] = 0;
+    screen_row_text(row, match_row >= 0 ? match_col : 0, line);
+#ifndef _WIN32
+    if (match_is_regex) {
+      if (regexec(&match_regex, line, 0, NULL, 0) == 0)
+        return TRUE;
+      continue;
+    }
+#endif
+    if (match_row >= 0 ? strncmp(line, match_text, strlen(match_text)) == 0
+                       : strstr(line, match_text) != NULL)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Fill a frame of the video recording, see trs_video.h */
+void trs_screen_capture(Uint8 *frame)
+{
+  frame[VIDEO_MODEL] = trs_model;
+  frame[VIDEO_CHARSET] = trs_charset;
+  frame[VIDEO_MODE] = currentmode;
+  frame[VIDEO_COLUMNS] = row_chars;
+  frame[VIDEO_ROWS] = col_chars;
+  frame[VIDEO_GRAFYX] = (grafyx_enable != 0) | (grafyx_overlay != 0) << 1;
+  frame[VIDEO_GXOFFSET] = grafyx_xoffset;
+  frame[VIDEO_GYOFFSET] = grafyx_yoffset;
+  frame[VIDEO_HRG] = hrg_enable != 0;
+  frame[VIDEO_CELL_W] = cur_char_width / scale;
+  frame[VIDEO_CELL_H] = cur_char_height / (scale * 2);
+  memcpy(frame + VIDEO_TEXT, trs_screen, VIDEO_TEXT_SIZE);
+  memcpy(frame + VIDEO_GRAFYX_MEM, grafyx_unscaled, VIDEO_GRAFYX_SIZE);
+  memcpy(frame + VIDEO_HRG_MEM, hrg_screen, VIDEO_HRG_SIZE);
+}
+
 /*
  * Get and process SDL event(s).
  *   If wait is true, process one event, blocking until one is available.
@@ -1714,53 +2228,6 @@ void trs_get_event(int wait)
   if (cpu_panel)
     trs_screen_caption();
 
-#if defined(SDL2) || !defined(NOX)
-  if (paste_state != PASTE_IDLE) {
-    static Uint8 paste_key;
-
-    if (SDL_PollEvent(&event)) {
-      if (event.type == SDL_KEYDOWN) {
-        if (paste_state == PASTE_KEYUP)
-          trs_xlate_keysym(0x10000 | paste_key);
-        paste_state = PASTE_KEYUP;
-        paste_lastkey = TRUE;
-      }
-    }
-
-    switch (paste_state) {
-      case PASTE_GETNEXT:
-        paste_lastkey = !PasteManagerGetChar(&paste_key);
-#ifndef _WIN32
-        if (paste_key == 0xa)
-          paste_key = 0xd;
-        else
-#endif
-        if (paste_key >= 0x5b && paste_key <= 0x60)
-          paste_key += 0x20;
-        else if (paste_key >= 0x7b && paste_key <= 0x7e)
-          paste_key -= 0x20;
-        trs_xlate_keysym(paste_key);
-        paste_state = PASTE_KEYDOWN;
-        break;
-      case PASTE_KEYDOWN:
-        trs_xlate_keysym(0x10000 | paste_key);
-        paste_state = PASTE_KEYUP;
-        break;
-      case PASTE_KEYUP:
-        if (paste_lastkey) {
-          paste_state = PASTE_IDLE;
-          if (turbo_paste)
-            trs_turbo_mode(timer_saved);
-          cycles_per_timer = cycles_saved;
-        }
-        else
-          paste_state = PASTE_GETNEXT;
-        break;
-    }
-    return;
-  }
-#endif
-
   do {
     if (wait)
       SDL_WaitEvent(&event);
@@ -1803,6 +2270,8 @@ void trs_get_event(int wait)
         debug("KeyDown: mod 0x%x, scancode 0x%x keycode 0x%x\n",
             keysym.mod, keysym.scancode, keysym.sym);
 #endif
+        /* Any key stops the text being typed */
+        trs_script_abort();
 #if defined(SDL2) || !defined(NOX)
         if (keysym.sym != SDLK_LALT) {
           if (copyStatus != COPY_IDLE) {
@@ -1884,14 +2353,7 @@ void trs_get_event(int wait)
               break;
             case SDLK_v:
             case SDLK_INSERT:
-              if (turbo_paste) {
-                timer_saved = timer_overclock;
-                trs_turbo_mode(1);
-              }
-              cycles_saved = cycles_per_timer;
-              cycles_per_timer *= 4;
-              PasteManagerStartPaste();
-              paste_state = PASTE_GETNEXT;
+              trs_paste();
               break;
             case SDLK_a:
               requestSelectAll = mousepointer = TRUE;
@@ -2289,6 +2751,11 @@ void trs_get_event(int wait)
         }
         break;
 
+      case SDL_USEREVENT:
+        /* Key from the web debugger, already a keysym */
+        trs_xlate_keysym(event.user.code);
+        break;
+
 #ifdef SDL2
       case SDL_TEXTINPUT:
         if (scancode) {
@@ -2567,6 +3034,8 @@ void trs_screen_refresh(void)
 #if XDEBUG
   debug("trs_screen_refresh\n");
 #endif
+  grafyx_clear_dirty();
+  memset(match_dirty, 1, sizeof(match_dirty));
   if (grafyx_enable && !grafyx_overlay) {
     int const srcx   = cur_char_width * grafyx_xoffset;
     int const srcy   = (scale * 2) * grafyx_yoffset;
@@ -2736,6 +3205,7 @@ void trs_screen_write_char(unsigned int position, Uint8 char_index)
   if (position >= (unsigned int)screen_chars)
     return;
   trs_screen[position] = char_index;
+  match_dirty[position / row_chars] = 1;
   if ((currentmode & EXPANDED) && (position & 1))
     return;
   if (grafyx_enable && !grafyx_overlay)
@@ -2801,8 +3271,11 @@ void trs_screen_write_char(unsigned int position, Uint8 char_index)
     }
   }
 
-  if (hrg_enable)
+  if (hrg_enable) {
+    if (hrg_dirty[position] == HRG_DIRTY)
+      hrg_dirty[position] = HRG_DRAWN;
     hrg_update_char(position);
+  }
 }
 
 void trs_screen_update(void)
@@ -2873,42 +3346,134 @@ void trs_gui_write_char(int col, int row, Uint8 char_index, int invert)
   }
 }
 
+/*
+ * Save the byte and its scaled bit pattern; it is drawn on the screen
+ * with the other bytes written in this frame by grafyx_update().
+ */
 static void grafyx_write_byte(int x, int y, char byte)
 {
-  int const screen_x = ((x - grafyx_xoffset + G_XSIZE) % G_XSIZE);
-  int const screen_y = ((y - grafyx_yoffset + G_YSIZE) % G_YSIZE);
-  int const on_screen = screen_x < row_chars &&
-    screen_y < col_chars * cur_char_height / (scale * 2);
-  SDL_Rect srcRect, dstRect;
-
-  if (grafyx_enable && grafyx_overlay && on_screen) {
-    srcRect.x = x * cur_char_width;
-    srcRect.y = y * (scale * 2);
-    srcRect.w = cur_char_width;
-    srcRect.h = scale * 2;
-    dstRect.x = left_margin + screen_x * cur_char_width;
-    dstRect.y = top_margin + screen_y * (scale * 2);
-    /* Erase old byte, preserving text */
-    TrsSoftBlit(image, &srcRect, screen, &dstRect, 1);
-  }
+  if (grafyx_unscaled[y][x] == (Uint8)byte)
+    return;
 
-  /* Save new byte in local memory */
   grafyx_unscaled[y][x] = byte;
   grafyx_rescale(y, x, byte);
 
-  if (grafyx_enable && on_screen) {
-    /* Draw new byte */
-    srcRect.x = x * cur_char_width;
-    srcRect.y = y * (scale * 2);
-    srcRect.w = cur_char_width;
-    srcRect.h = scale * 2;
-    dstRect.x = left_margin + screen_x * cur_char_width;
-    dstRect.y = top_margin + screen_y * (scale * 2);
-    TrsSoftBlit(image, &srcRect, screen, &dstRect, grafyx_overlay);
-    addToDrawList(&dstRect);
+  if (grafyx_enable && !grafyx_dirty[y][x]) {
+    grafyx_dirty[y][x] = 1;
+    grafyx_dirty_row[y] = 1;
+    grafyx_dirty_count++;
   }
 }
 
+static void grafyx_clear_dirty(void)
+{
+  int y;
+
+  if (grafyx_dirty_count == 0)
+    return;
+  for (y = 0; y < G_YSIZE; y++) {
+    if (grafyx_dirty_row[y]) {
+      memset(grafyx_dirty[y], 0, G_XSIZE);
+      grafyx_dirty_row[y] = 0;
+    }
+  }
+  grafyx_dirty_count = 0;
+}
+
+/*
+ * Draw the bytes written since the last frame.  Without text, runs of
+ * bytes on a line are copied with one blit; in overlay mode, each text
+ * cell with changed bytes is redrawn once, character and graphics.
+ */
+static void grafyx_update(void)
+{
+  int const lines = col_chars * cur_char_height / (scale * 2);
+  int const cell_lines = cur_char_height / (scale * 2);
+  int sx, sy, x, y, run;
+  int cells = 0;
+  SDL_Rect srcRect, dstRect;
+
+  if (grafyx_dirty_count == 0)
+    return;
+
+  if (grafyx_enable) {
+    for (sy = 0; sy < lines; sy++) {
+      y = (sy + grafyx_yoffset) % G_YSIZE;
+      if (!grafyx_dirty_row[y])
+        continue;
+      for (sx = 0; sx < row_chars; sx++) {
+        x = (sx + grafyx_xoffset) % G_XSIZE;
+        if (!grafyx_dirty[y][x])
+          continue;
+        if (grafyx_overlay) {
+          int position = (sy / cell_lines) * row_chars + sx;
+
+          if (currentmode & EXPANDED)
+            position &= ~1;
+          if (!grafyx_dirty_cell[position]) {
+            grafyx_dirty_cell[position] = 1;
+            cells++;
+          }
+          continue;
+        }
+        for (run = 1; sx + run < row_chars && x + run < G_XSIZE &&
+            grafyx_dirty[y][x + run]; run++)
+          ;
+        srcRect.x = x * cur_char_width;
+        srcRect.y = y * (scale * 2);
+        srcRect.w = run * cur_char_width;
+        srcRect.h = scale * 2;
+        dstRect.x = left_margin + sx * cur_char_width;
+        dstRect.y = top_margin + sy * (scale * 2);
+        TrsSoftBlit(image, &srcRect, screen, &dstRect, 0);
+        addToDrawList(&dstRect);
+        sx += run - 1;
+      }
+    }
+  }
+
+  for (x = 0; cells > 0 && x < screen_chars; x++) {
+    if (grafyx_dirty_cell[x]) {
+      grafyx_dirty_cell[x] = 0;
+      trs_screen_write_char(x, trs_screen[x]);
+      cells--;
+    }
+  }
+  grafyx_clear_dirty();
+}
+
+static void grafyx_init_expand(void)
+{
+  static int done = FALSE;
+  Uint8 *exp;
+  int byte;
+
+  if (done)
+    return;
+  for (byte = 0; byte < 256; byte++) {
+    exp = grafyx_expand[0][byte];
+    exp[1] =  ((byte & 0x01)       + ((byte & 0x02) << 1)
+           +  ((byte & 0x04) << 2) + ((byte & 0x08) << 3)) * 3;
+    exp[0] = (((byte & 0x10) >> 4) + ((byte & 0x20) >> 3)
+           +  ((byte & 0x40) >> 2) + ((byte & 0x80) >> 1)) * 3;
+
+    exp = grafyx_expand[1][byte];
+    exp[2] =  ((byte & 0x01)            + ((byte & 0x02) << 2)
+           +  ((byte & 0x04) << 4)) * 7;
+    exp[1] = (((byte & 0x08) >> 2)      +  (byte & 0x10)
+           +  ((byte & 0x20) << 2)) * 7 + ((byte & 0x04) >> 2);
+    exp[0] = (((byte & 0x40) >> 4)      + ((byte & 0x80) >> 2)) * 7
+           +  ((byte & 0x20) >> 5)  * 3;
+
+    exp = grafyx_expand[2][byte];
+    exp[3] =  ((byte & 0x01)       + ((byte & 0x02) << 3)) * 15;
+    exp[2] = (((byte & 0x04) >> 2) + ((byte & 0x08) << 1)) * 15;
+    exp[1] = (((byte & 0x10) >> 4) + ((byte & 0x20) >> 1)) * 15;
+    exp[0] = (((byte & 0x40) >> 6) + ((byte & 0x80) >> 3)) * 15;
+  }
+  done = TRUE;
+}
+
 static void grafyx_rescale(int y, int x, char byte)
 {
   if (scale == 1) {
@@ -2917,34 +3482,11 @@ static void grafyx_rescale(int y, int x, char byte)
     grafyx[p] = byte;
     grafyx[p + G_XSIZE] = byte;
   } else {
-    char exp[MAX_SCALE];
+    Uint8 const *exp = grafyx_expand[scale - 2][(Uint8)byte];
     int i, j;
     int p = y * (scale * 2) * (G_XSIZE * scale) + x * scale;
     int const s = (G_XSIZE * scale) - scale;
 
-    switch (scale) {
-      case 2:
-        exp[1] =  ((byte & 0x01)       + ((byte & 0x02) << 1)
-               +  ((byte & 0x04) << 2) + ((byte & 0x08) << 3)) * 3;
-        exp[0] = (((byte & 0x10) >> 4) + ((byte & 0x20) >> 3)
-               +  ((byte & 0x40) >> 2) + ((byte & 0x80) >> 1)) * 3;
-        break;
-      case 3:
-        exp[2] =  ((byte & 0x01)            + ((byte & 0x02) << 2)
-               +  ((byte & 0x04) << 4)) * 7;
-        exp[1] = (((byte & 0x08) >> 2)      +  (byte & 0x10)
-               +  ((byte & 0x20) << 2)) * 7 + ((byte & 0x04) >> 2);
-        exp[0] = (((byte & 0x40) >> 4)      + ((byte & 0x80) >> 2)) * 7
-               +  ((byte & 0x20) >> 5)  * 3;
-        break;
-      case 4:
-        exp[3] =  ((byte & 0x01)       + ((byte & 0x02) << 3)) * 15;
-        exp[2] = (((byte & 0x04) >> 2) + ((byte & 0x08) << 1)) * 15;
-        exp[1] = (((byte & 0x10) >> 4) + ((byte & 0x20) >> 1)) * 15;
-        exp[0] = (((byte & 0x40) >> 6) + ((byte & 0x80) >> 3)) * 15;
-        break;
-    }
-
     for (j = 0; j < scale * 2; j++) {
       for (i = 0; i < scale; i++)
         grafyx[p++] = exp[i];
@@ -3215,16 +3757,27 @@ hrg_init(void)
   for (i = 0; i <= 6; i++) {
     hrg_pixel_x[0][i] = cur_char_width * i / 6;
     hrg_pixel_x[1][i] = cur_char_width * 2 * i / 6;
-    if (i) {
-      hrg_pixel_width[0][i - 1] = hrg_pixel_x[0][i] - hrg_pixel_x[0][i - 1];
-      hrg_pixel_width[1][i - 1] = hrg_pixel_x[1][i] - hrg_pixel_x[1][i - 1];
-    }
   }
   for (i = 0; i <= 12; i++) {
     hrg_pixel_y[i] = cur_char_height * i / 12;
     if (i)
       hrg_pixel_height[i - 1] = hrg_pixel_y[i] - hrg_pixel_y[i - 1];
   }
+  for (i = 0; i < 64; i++) {
+    int j, n = 0;
+
+    for (j = 0; j < 6; j++) {
+      if (!(i & 1 << j))
+        continue;
+      if (j == 0 || !(i & 1 << (j - 1))) {
+        hrg_runs[i][n][0] = j;
+        hrg_runs[i][n][1] = 0;
+        n++;
+      }
+      hrg_runs[i][n - 1][1]++;
+    }
+    hrg_run_count[i] = n;
+  }
   if (cur_char_width % 6 != 0 || cur_char_height % 12 != 0)
     debug("character size %d*%d not a multiple of 6*12 HRG raster\n",
         cur_char_width, cur_char_height);
@@ -3253,101 +3806,44 @@ hrg_write_addr(int addr, int mask)
   hrg_addr = (hrg_addr & ~mask) | (addr & mask);
 }
 
-/* Write byte to HRG memory. */
+/* Write byte to HRG memory.  The cell is redrawn by hrg_update(). */
 void
 hrg_write_data(int data)
 {
-  int old_data;
-  int position, line;
-  int bits0, bits1;
+  int position;
 
   if (hrg_addr >= HRG_MEMSIZE) return; /* nonexistent address */
-  old_data = hrg_screen[hrg_addr];
+  if (((hrg_screen[hrg_addr] ^ data) & 0x3f) == 0) {
+    hrg_screen[hrg_addr] = data;
+    return;
+  }
   hrg_screen[hrg_addr] = data;
 
   if (!hrg_enable) return;
   if ((currentmode & EXPANDED) && (hrg_addr & 1)) return;
-  if ((data &= 0x3f) == (old_data &= 0x3f)) return;
 
   position = hrg_addr & 0x3ff; /* bits 0-9: "PRINT @" screen position */
-  line = hrg_addr >> 10;       /* vertical offset inside character cell */
-  bits0 = ~data & old_data;    /* pattern to clear */
-  bits1 = data & ~old_data;    /* pattern to set */
-
-  if (bits0 == 0
-      || trs_screen[position] == 0x20
-      || trs_screen[position] == 0x80
-      /*|| (trs_screen[position] < 0x80 && line >= 8 && !usefont)*/
-     ) {
-    /* Only additional bits set, or blank text character.
-       No need for update of text. */
-    int const destx = (position % row_chars) * cur_char_width + left_margin;
-    int const desty = (position / row_chars) * cur_char_height + top_margin
-      + hrg_pixel_y[line];
-    int const *x = hrg_pixel_x[(currentmode & EXPANDED) != 0];
-    int const *w = hrg_pixel_width[(currentmode & EXPANDED) != 0];
-    int const h = hrg_pixel_height[line];
-    int n0 = 0;
-    int n1 = 0;
-    int flag = 0;
-    int i, j, b;
-    SDL_Rect rect0[3];    /* 6 bits => max. 3 groups of adjacent "0" bits */
-    SDL_Rect rect1[3];
-
-    /* Compute arrays of rectangles to clear and to set. */
-    for (j = 0, b = 1; j < 6; j++, b <<= 1) {
-      if (bits0 & b) {
-        if (flag >= 0) {       /* Start new rectangle. */
-          rect0[n0].x = destx + x[j];
-          rect0[n0].y = desty;
-          rect0[n0].w = w[j];
-          rect0[n0].h = h;
-          n0++;
-          flag = -1;
-        }
-        else {                 /* Increase width of rectangle. */
-          rect0[n0 - 1].w += w[j];
-        }
-      }
-      else if (bits1 & b) {
-        if (flag <= 0) {
-          rect1[n1].x = destx + x[j];
-          rect1[n1].y = desty;
-          rect1[n1].w = w[j];
-          rect1[n1].h = h;
-          n1++;
-          flag = 1;
-        }
-        else {
-          rect1[n1 - 1].w += w[j];
-        }
-      }
-      else {
-        flag = 0;
-      }
-    }
-    if (n0 != 0) {
-      for (i = 0; i < n0; i++) {
-        SDL_FillRect(screen, &rect0[i], background);
-        addToDrawList(&rect0[i]);
-      }
-    }
-    if (n1 != 0) {
-      for (i = 0; i < n1; i++) {
-        SDL_FillRect(screen, &rect1[i], foreground);
-        addToDrawList(&rect1[i]);
-      }
-    }
-  }
-  else {
-    /* Unfortunately, HRG1B combines text and graphics with an
-       (inclusive) OR. Thus, in the general case, we cannot erase
-       the old graphics byte without losing the text information.
-       Call trs_screen_write_char to restore the text character
-       (erasing the graphics). This function will in turn call
-       hrg_update_char and restore 6*12 graphics pixels. Sigh. */
-    trs_screen_write_char(position, trs_screen[position]);
+  if (hrg_dirty[position] == HRG_CLEAN)
+    hrg_dirty_list[hrg_dirty_count++] = position;
+  hrg_dirty[position] = HRG_DIRTY;
+}
+
+/* Redraw the cells with graphics written since the last frame.
+   HRG1B combines text and graphics with an (inclusive) OR, so
+   trs_screen_write_char draws the text character and then calls
+   hrg_update_char for the 6*12 graphics pixels. */
+static void
+hrg_update(void)
+{
+  int i, position;
+
+  for (i = 0; i < hrg_dirty_count; i++) {
+    position = hrg_dirty_list[i];
+    if (hrg_dirty[position] == HRG_DIRTY)
+      trs_screen_write_char(position, trs_screen[position]);
+    hrg_dirty[position] = HRG_CLEAN;
   }
+  hrg_dirty_count = 0;
 }
 
 /* Read byte from HRG memory. */
@@ -3366,12 +3862,11 @@ hrg_update_char(int position)
   int const destx = (position % row_chars) * cur_char_width + left_margin;
   int const desty = (position / row_chars) * cur_char_height + top_margin;
   int const *x = hrg_pixel_x[(currentmode & EXPANDED) != 0];
-  int const *w = hrg_pixel_width[(currentmode & EXPANDED) != 0];
   int byte;
   int prev_byte = 0;
   int n = 0;
   int np = 0;
-  int i, j, flag;
+  int i, j;
   SDL_Rect rect[3 * 12];
 
   /* Compute array of rectangles. */
@@ -3380,22 +3875,15 @@ hrg_update_char(int position)
     }
     else if (byte != prev_byte) {
       np = n;
-      flag = 0;
-      for (j = 0; j < 6; j++) {
-        if (!(byte & 1 << j)) {
-          flag = 0;
-        }
-        else if (!flag) {     /* New rectangle. */
-          rect[n].x = destx + x[j];
-          rect[n].y = desty + hrg_pixel_y[i];
-          rect[n].w = w[j];
-          rect[n].h = hrg_pixel_height[i];
-          n++;
-          flag = 1;
-        }
-        else {                /* Increase width. */
-          rect[n - 1].w += w[j];
-        }
+      for (j = 0; j < hrg_run_count[byte]; j++) {
+        int const start = hrg_runs[byte][j][0];
+        int const end = start + hrg_runs[byte][j][1];
+
+        rect[n].x = destx + x[start];
+        rect[n].y = desty + hrg_pixel_y[i];
+        rect[n].w = x[end] - x[start];
+        rect[n].h = hrg_pixel_height[i];
+        n++;
       }
     }
     else {                    /* Increase heights. */
@@ -3566,6 +4054,8 @@ void trs_main_load(FILE *file)
 
 int trs_sdl_savebmp(const char *filename)
 {
+  grafyx_update();
+  hrg_update();
   if (SDL_SaveBMP(screen, filename) != 0) {
     error("failed to save Screenshot %s: %s", filename, strerror(errno));
     return -1;
@@ -44,6 +44,7 @@
 #include <SDL_joystick.h>
 #include "error.h"
 #include "trs.h"
+#include "trs_script.h"
 #include "trs_sdl_keyboard.h"
 
 static void queue_key(int state);
@@ -801,6 +802,12 @@ int trs_kb_mem_read(int address)
     } while (key >= 0);
   }
 
+  /* Feed scripted input only when the previous key has been taken */
+  if (key_queue_entries == 0 && (key = trs_script_key()) >= 0) {
+    trs_xlate_keysym(key);
+    key = -1;
+  }
+
   /* After each key state change, impose a timeout before the next one
      so that the Z80 program doesn't miss any by polling too rarely,
      and so that we don't tickle the bugs in some common TRS-80 keyboard
@@ -28,36 +28,75 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <SDL_types.h>
 
 #include "error.h"
+#include "trs_disk.h"
+#include "trs_hard.h"
 #include "trs_state_save.h"
+#include "trs_stringy.h"
 
 static const char stateFileBanner[] = "sldtrs State Save File";
 static int const stateFileBannerLen = sizeof(stateFileBanner) - 1;
 static unsigned stateVersionNumber = 2;
 
+static void trs_state_write(FILE *file)
+{
+  trs_save_uchar(file, (Uint8 *)stateFileBanner, stateFileBannerLen);
+  trs_save_uint32(file, &stateVersionNumber, 1);
+  trs_main_save(file);
+  trs_cassette_save(file);
+  trs_disk_save(file);
+  trs_hard_save(file);
+  trs_stringy_save(file);
+  trs_interrupt_save(file);
+  trs_io_save(file);
+  trs_mem_save(file);
+  trs_keyboard_save(file);
+  trs_uart_save(file);
+  trs_z80_save(file);
+  trs_imp_exp_save(file);
+}
+
+static int trs_state_read(FILE *file, const char *name)
+{
+  char banner[80];
+  unsigned version;
+
+  trs_load_uchar(file, (Uint8 *)banner, stateFileBannerLen);
+  if (strncmp(banner, stateFileBanner, stateFileBannerLen)) {
+    error("failed to get State Banner from %s", name);
+    return -1;
+  }
+  trs_load_uint32(file, &version, 1);
+  if (version != stateVersionNumber) {
+    error("unsupported version %d of State file", version);
+    return -1;
+  }
+  trs_main_load(file);
+  trs_cassette_load(file);
+  trs_disk_load(file);
+  trs_hard_load(file);
+  trs_stringy_load(file);
+  trs_interrupt_load(file);
+  trs_io_load(file);
+  trs_mem_load(file);
+  trs_keyboard_load(file);
+  trs_uart_load(file);
+  trs_z80_load(file);
+  trs_imp_exp_load(file);
+  return 0;
+}
+
 int trs_state_save(const char *filename)
 {
   FILE *file;
 
   file = fopen(filename, "wb");
   if (file) {
-    trs_save_uchar(file, (Uint8 *)stateFileBanner, stateFileBannerLen);
-    trs_save_uint32(file, &stateVersionNumber, 1);
-    trs_main_save(file);
-    trs_cassette_save(file);
-    trs_disk_save(file);
-    trs_hard_save(file);
-    trs_stringy_save(file);
-    trs_interrupt_save(file);
-    trs_io_save(file);
-    trs_mem_save(file);
-    trs_keyboard_save(file);
-    trs_uart_save(file);
-    trs_z80_save(file);
-    trs_imp_exp_save(file);
+    trs_state_write(file);
     fclose(file);
     return 0;
   }
@@ -68,42 +107,123 @@ int trs_state_save(const char *filename)
 int trs_state_load(const char *filename)
 {
   FILE *file;
-  char banner[80];
-  unsigned version;
+  int ret;
 
   file = fopen(filename, "rb");
   if (file) {
-    trs_load_uchar(file, (Uint8 *)banner, stateFileBannerLen);
-    if (strncmp(banner, stateFileBanner, stateFileBannerLen)) {
-      error("failed to get State Banner from %s", filename);
-      fclose(file);
-      return -1;
-    }
-    trs_load_uint32(file, &version, 1);
-    if (version != stateVersionNumber) {
-      error("unsupported version %d of State file", version);
-      fclose(file);
-      return -1;
-    }
-    trs_main_load(file);
-    trs_cassette_load(file);
-    trs_disk_load(file);
-    trs_hard_load(file);
-    trs_stringy_load(file);
-    trs_interrupt_load(file);
-    trs_io_load(file);
-    trs_mem_load(file);
-    trs_keyboard_load(file);
-    trs_uart_load(file);
-    trs_z80_load(file);
-    trs_imp_exp_load(file);
+    ret = trs_state_read(file, filename);
     fclose(file);
-    return 0;
+    return ret;
   }
   error("failed to load State %s: %s", filename, strerror(errno));
   return -1;
 }
 
+#ifndef _WIN32
+/*
+ * In-memory snapshots: an image of the CPU, memory and devices held in
+ * memory, in the same format as a State file.  The emulator core keeps
+ * its state in module globals, so restoring a snapshot replaces the
+ * current machine.  The media are not part of a State: a disk written
+ * after the snapshot would no longer match the DOS's cached directory
+ * in memory, so restoring is refused while a writable drive is mounted.
+ * Scripts use this to return to a booted machine (see trs_script.c).
+ */
+struct trs_snapshot {
+  char *data;
+  size_t size;
+};
+
+trs_snapshot *trs_snapshot_new(void)
+{
+  trs_snapshot *snapshot = (trs_snapshot *)calloc(1, sizeof(trs_snapshot));
+
+  if (snapshot == NULL)
+    error("failed to allocate snapshot: %s", strerror(errno));
+  return snapshot;
+}
+
+void trs_snapshot_free(trs_snapshot *snapshot)
+{
+  if (snapshot) {
+    free(snapshot->data);
+    free(snapshot);
+  }
+}
+
+int trs_snapshot_save(trs_snapshot *snapshot)
+{
+  FILE *file;
+  char *data = NULL;
+  size_t size = 0;
+
+  if ((file = open_memstream(&data, &size)) == NULL) {
+    error("failed to save snapshot: %s", strerror(errno));
+    return -1;
+  }
+  trs_state_write(file);
+  if (ferror(file) | fclose(file)) {
+    error("failed to save snapshot: %s", strerror(errno));
+    free(data);
+    return -1;
+  }
+  free(snapshot->data);
+  snapshot->data = data;
+  snapshot->size = size;
+  return 0;
+}
+
+/* Return the name of a mounted drive that is not write protected */
+static const char *writable_drive(void)
+{
+  static char name[16];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    if (trs_disk_getfilename(i)[0] && !trs_disk_getwriteprotect(i)) {
+      snprintf(name, sizeof(name), "disk %d", i);
+      return name;
+    }
+  }
+  for (i = 0; i < TRS_HARD_MAXDRIVES; i++) {
+    if (trs_hard_getfilename(i)[0] && !trs_hard_getwriteprotect(i)) {
+      snprintf(name, sizeof(name), "hard disk %d", i);
+      return name;
+    }
+  }
+  for (i = 0; i < 8; i++) {
+    if (stringy_get_name(i)[0] && !stringy_get_writeprotect(i)) {
+      snprintf(name, sizeof(name), "wafer %d", i);
+      return name;
+    }
+  }
+  return NULL;
+}
+
+int trs_snapshot_restore(const trs_snapshot *snapshot)
+{
+  FILE *file;
+  const char *drive;
+  int ret;
+
+  if (snapshot->data == NULL) {
+    error("snapshot is empty");
+    return -1;
+  }
+  if ((drive = writable_drive()) != NULL) {
+    error("failed to restore snapshot: %s is not write protected", drive);
+    return -1;
+  }
+  if ((file = fmemopen(snapshot->data, snapshot->size, "rb")) == NULL) {
+    error("failed to restore snapshot: %s", strerror(errno));
+    return -1;
+  }
+  ret = trs_state_read(file, "snapshot");
+  fclose(file);
+  return ret;
+}
+#endif
+
 void trs_save_uchar(FILE *file, Uint8 *buffer, int count)
 {
   fwrite(buffer, count, 1, file);
@@ -24,6 +24,19 @@
 
 int  trs_state_save(const char *filename);
 int  trs_state_load(const char *filename);
+
+#ifndef _WIN32
+/* In-memory snapshots; restoring one replaces the current machine, the
+   caller is responsible for refreshing the display afterwards.  Restoring
+   fails while a writable disk, hard disk or wafer is mounted. */
+typedef struct trs_snapshot trs_snapshot;
+
+trs_snapshot *trs_snapshot_new(void);
+void trs_snapshot_free(trs_snapshot *snapshot);
+int  trs_snapshot_save(trs_snapshot *snapshot);
+int  trs_snapshot_restore(const trs_snapshot *snapshot);
+#endif
+
 void trs_save_uchar(FILE *file, Uint8 *buffer, int count);
 void trs_load_uchar(FILE *file, Uint8 *buffer, int count);
 void trs_save_uint16(FILE *file, Uint16 *buffer, int count);
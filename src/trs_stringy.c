@@ -30,6 +30,10 @@
  * XXX Check if I am exactly duplicating TRS32 output now.  However,
  * TRS32 seems to drop one bit on wrap, which might be a bug in
  * TRS32 that I don't need to duplicate.
+ *
+ * The data of an ESF wafer is read into memory when it is inserted.
+ * The bytes changed by writing are stored back into the file when the
+ * write gate closes, when the wafer is removed and on state save.
  */
 
 #include <assert.h>
@@ -92,6 +96,9 @@ typedef struct {
   long esf_bytepos;
   Uint8 esf_bytebuf;
   Uint8 esf_bitpos;
+  Uint8 *esf_data;
+  long esf_dirty_start; /* range of bytes not yet in the file */
+  long esf_dirty_end;
 #if STRINGYDEBUG_IN
   int prev_in_port;
 #endif
@@ -283,17 +290,78 @@ stringy_read_header(stringy_info_t *s)
   return ires;
 }
 
-/* Returns 0 if OK, -1 if invalid header, errno value otherwise. */
+/* Read the data of an ESF wafer, a short file is padded with zeroes */
 static int
-stringy_change(int unit)
+stringy_esf_load(stringy_info_t *s)
 {
-  stringy_info_t *s = &stringy_info[unit];
-  int ires;
+  free(s->esf_data);
+  s->esf_data = calloc(s->esf_bytelen + 1, 1);
+  if (s->esf_data == NULL) {
+    error("failed to allocate wafer %s: %s", s->name, strerror(errno));
+    s->format = 0;
+    return errno;
+  }
+  fseek(s->file, stringy_esf_header_length, SEEK_SET);
+  if (fread(s->esf_data, 1, s->esf_bytelen, s->file) < (size_t)s->esf_bytelen &&
+      ferror(s->file)) {
+    error("failed to read wafer %s: %s", s->name, strerror(errno));
+    clearerr(s->file);
+  }
+  s->esf_dirty_start = s->esf_bytelen;
+  s->esf_dirty_end = 0;
+  return 0;
+}
+
+/* Write the bytes changed since the last store back to the file */
+static void
+stringy_esf_store(stringy_info_t *s)
+{
+  long const len = s->esf_dirty_end - s->esf_dirty_start;
 
+  if (s->file == NULL || s->esf_data == NULL || len <= 0) return;
+
+  if (fseek(s->file, stringy_esf_header_length + s->esf_dirty_start,
+	    SEEK_SET) != 0 ||
+      fwrite(s->esf_data + s->esf_dirty_start, 1, len, s->file) < (size_t)len ||
+      fflush(s->file) != 0) {
+    error("failed to write wafer %s: %s", s->name, strerror(errno));
+    clearerr(s->file);
+  }
+  s->esf_dirty_start = s->esf_bytelen;
+  s->esf_dirty_end = 0;
+}
+
+static void
+stringy_esf_put(stringy_info_t *s, Uint8 byte)
+{
+  s->esf_data[s->esf_bytepos] = byte;
+  if (s->esf_bytepos < s->esf_dirty_start)
+    s->esf_dirty_start = s->esf_bytepos;
+  if (s->esf_bytepos >= s->esf_dirty_end)
+    s->esf_dirty_end = s->esf_bytepos + 1;
+}
+
+static void
+stringy_close(stringy_info_t *s)
+{
   if (s->file) {
+    if (s->format == STRINGY_FMT_ESF)
+      stringy_esf_store(s);
     fclose(s->file);
     s->file = NULL;
   }
+  free(s->esf_data);
+  s->esf_data = NULL;
+}
+
+/* Returns 0 if OK, -1 if invalid header, errno value otherwise. */
+static int
+stringy_change(int unit)
+{
+  stringy_info_t *s = &stringy_info[unit];
+  int ires;
+
+  stringy_close(s);
   if (s->name[0] == 0) {
     s->in_port = STRINGY_NO_WAFER;
     return 0;
@@ -313,8 +381,11 @@ stringy_change(int unit)
     s->in_port = 0;
   }  
   s->out_port = 0;
+  s->format = 0;
 
   ires = stringy_read_header(s);
+  if (ires == 0 && s->format == STRINGY_FMT_ESF)
+    ires = stringy_esf_load(s);
 
   s->pos = 0;
   s->pos_time = z80_state.t_count;
@@ -358,7 +429,6 @@ stringy_insert(int drive, const char *name)
 void
 stringy_remove(int drive)
 {
-  stringy_info[drive].file = NULL;
   stringy_info[drive].name[0] = 0;
   stringy_change(drive);
 }
@@ -380,24 +450,16 @@ stringy_reset(void)
 static void
 stringy_byte_flush(stringy_info_t *s)
 {
-  int ires;
   Uint8 mask;
 
   if (s->format != STRINGY_FMT_ESF ||
       stringy_state(s->out_port) != STRINGY_WRITING ||
-      s->esf_bitpos == 0) return;
+      s->esf_bitpos == 0 || s->esf_bytelen == 0) return;
 
-  fseek(s->file, 0, SEEK_CUR);
-  ires = fgetc(s->file);
-  if (ires == EOF) {
-    ires = 0;
-  }
-  fseek(s->file, -1, SEEK_CUR);
   mask = 0xff << s->esf_bitpos;
-  s->esf_bytebuf = (ires & mask) | (s->esf_bytebuf & ~mask);
-  if (fputc(s->esf_bytebuf, s->file) == EOF)
-    error("stringy byte flush: %s", strerror(errno));
-  fseek(s->file, -1, SEEK_CUR);
+  s->esf_bytebuf = (s->esf_data[s->esf_bytepos] & mask) |
+    (s->esf_bytebuf & ~mask);
+  stringy_esf_put(s, s->esf_bytebuf);
 }
 
 static void
@@ -407,11 +469,10 @@ stringy_bit_write(stringy_info_t *s, int flux)
   s->esf_bytebuf |= flux << s->esf_bitpos;
   s->esf_bitpos++;
   if (s->esf_bitpos == 8) {
-    if (fputc(s->esf_bytebuf, s->file) == EOF)
-      error("stringy bit write: %s", strerror(errno));
-    if (++s->esf_bytepos >= s->esf_bytelen) {
-      fseek(s->file, stringy_esf_header_length, SEEK_SET);
-      s->esf_bytepos = 0;
+    if (s->esf_bytelen > 0) {
+      stringy_esf_put(s, s->esf_bytebuf);
+      if (++s->esf_bytepos >= s->esf_bytelen)
+	s->esf_bytepos = 0;
     }
     s->esf_bitpos = 0;
     s->esf_bytebuf = 0;
@@ -460,30 +521,20 @@ stringy_flux_write(stringy_info_t *s, int flux, stringy_pos_t delta)
   }
 }
 
-static int
+static void
 stringy_bit_read(stringy_info_t *s, int *bit)
 {
-  int ires;
-
   if (s->esf_bitpos == 0) {
-    if (s->esf_bytepos++ >= s->esf_bytelen) {
-      fseek(s->file, stringy_esf_header_length, SEEK_SET);
-      s->esf_bytepos = 0;
-    }
-    if ((ires = fgetc(s->file)) == EOF)
-      if (ferror(s->file) != 0) {
-        error("stringy bit read: %s", strerror(errno));
-        clearerr(s->file);
-        return FALSE;
-    }
-    if (ires < 0) {
-      ires = 0;
+    if (s->esf_bytelen > 0) {
+      s->esf_bytebuf = s->esf_data[s->esf_bytepos];
+      if (++s->esf_bytepos >= s->esf_bytelen)
+	s->esf_bytepos = 0;
+    } else {
+      s->esf_bytebuf = 0;
     }
-    s->esf_bytebuf = ires;
   }
   *bit = (s->esf_bytebuf & (1 << s->esf_bitpos)) != 0;
   s->esf_bitpos = (s->esf_bitpos + 1) % 8;
-  return TRUE;
 }
 
 static int
@@ -504,8 +555,7 @@ stringy_flux_read(stringy_info_t *s, int *flux, stringy_pos_t *delta)
     return TRUE;
 
   case STRINGY_FMT_ESF:
-    bres = stringy_bit_read(s, &bit);
-    if (!bres) return bres;
+    stringy_bit_read(s, &bit);
     /*
      * This calls for some explanation.  Our caller wants the delta to
      * the next flux change and the resulting flux value, as in "xtrs
@@ -627,7 +677,13 @@ stringy_out(int unit, int value)
        */
       s->pos = 0;
       s->in_port &= ~STRINGY_END_OF_TAPE;
-      stringy_read_header(s);
+      if (s->format == STRINGY_FMT_ESF) {
+	s->esf_bytepos = 0;
+	s->esf_bytebuf = 0;
+	s->esf_bitpos = 0;
+      } else {
+	stringy_read_header(s);
+      }
     }
 
     s->pos_time = z80_state.t_count;
@@ -646,8 +702,8 @@ stringy_out(int unit, int value)
       fflush(s->file);
       res = ftruncate(fileno(s->file), ftell(s->file));
       assert(res == 0);
+      fseek(s->file, 0, SEEK_CUR);
     }
-    fseek(s->file, 0, SEEK_CUR);
     stringy_flux_write(s, 1, 0); /* XXX needed?  bad? */
   }
 
@@ -661,7 +717,10 @@ stringy_out(int unit, int value)
 
     if (new_state != STRINGY_WRITING) {
       stringy_byte_flush(s);
-      fflush(s->file);
+      if (s->format == STRINGY_FMT_ESF)
+	stringy_esf_store(s);
+      else
+	fflush(s->file);
     }
   }
 
@@ -727,8 +786,11 @@ void trs_stringy_save(FILE *file)
 {
   int i;
 
-  for (i = 0; i < STRINGY_MAX_UNITS; i++)
+  for (i = 0; i < STRINGY_MAX_UNITS; i++) {
+    if (stringy_info[i].format == STRINGY_FMT_ESF)
+      stringy_esf_store(&stringy_info[i]);
     trs_save_stringy(file, &stringy_info[i]);
+  }
 }
 
 void trs_stringy_load(FILE *file)
@@ -736,6 +798,7 @@ void trs_stringy_load(FILE *file)
   int i;
 
   for (i = 0; i < STRINGY_MAX_UNITS; i++) {
+    stringy_close(&stringy_info[i]);
     trs_load_stringy(file, &stringy_info[i]);
     if (stringy_info[i].file != NULL) {
       stringy_info[i].file = fopen(stringy_info[i].name, "rb+");
@@ -752,6 +815,17 @@ void trs_stringy_load(FILE *file)
       } else {
         stringy_info[i].in_port &= ~(1 << 0);;
       }
+      if (stringy_info[i].format == STRINGY_FMT_ESF) {
+        if (stringy_esf_load(&stringy_info[i]) != 0) {
+          fclose(stringy_info[i].file);
+          stringy_info[i].file = NULL;
+          stringy_info[i].name[0] = 0;
+          stringy_info[i].in_port = STRINGY_NO_WAFER;
+          continue;
+        }
+        if (stringy_info[i].esf_bytepos >= stringy_info[i].esf_bytelen)
+          stringy_info[i].esf_bytepos = 0;
+      }
     }
   }
 }
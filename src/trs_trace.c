@@ -0,0 +1,139 @@
+/*
+ * trs_trace.c -- binary Z80 instruction trace
+ *
+ * Records the registers and opcode bytes of every executed instruction
+ * into a ring buffer, so the last instructions before a rare crash can
+ * be kept at close to full speed.  Nothing is decoded while recording:
+ * the ring is written to a file on request or at exit, and turned into
+ * text offline by trstrace.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_trace.h"
+
+typedef struct {
+  tstate_t t_count;
+  Uint16 reg[8];
+  Uint8 bytes[4];
+  Uint8 flags;
+} TraceRecord;
+
+int trs_trace = 0;
+
+static TraceRecord *ring;
+static unsigned long ring_size;
+static unsigned long ring_next;
+static char trace_file[FILENAME_MAX];
+
+void trs_trace_instruction(void)
+{
+  TraceRecord *r = &ring[ring_next++ % ring_size];
+
+  r->t_count = z80_state.t_count;
+  r->reg[0] = Z80_PC;
+  r->reg[1] = Z80_AF;
+  r->reg[2] = Z80_BC;
+  r->reg[3] = Z80_DE;
+  r->reg[4] = Z80_HL;
+  r->reg[5] = Z80_IX;
+  r->reg[6] = Z80_IY;
+  r->reg[7] = Z80_SP;
+  r->bytes[0] = mem_peek(Z80_PC);
+  r->bytes[1] = mem_peek(Z80_PC + 1);
+  r->bytes[2] = mem_peek(Z80_PC + 2);
+  r->bytes[3] = mem_peek(Z80_PC + 3);
+  r->flags = z80_state.iff1 | (z80_state.iff2 << 1) |
+             (z80_state.interrupt_mode << 2);
+}
+
+static void put_word(Uint8 *p, Uint16 value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+/* Write the recorded instructions to filename, oldest first */
+static int trace_save(const char *filename)
+{
+  FILE *file;
+  Uint8 buf[TRACE_RECORD];
+  unsigned long i, n;
+  int j;
+
+  if (ring == NULL) {
+    error("no instruction trace has been recorded");
+    return -1;
+  }
+  if ((file = fopen(filename, "wb")) == NULL) {
+    error("failed to write trace %s: %s", filename, strerror(errno));
+    return -1;
+  }
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, TRACE_MAGIC, 8);
+  put_word(buf + 8, TRACE_VERSION);
+  put_word(buf + 10, TRACE_RECORD);
+  fwrite(buf, 1, TRACE_HEADER, file);
+
+  n = ring_next < ring_size ? ring_next : ring_size;
+  for (i = ring_next - n; i != ring_next; i++) {
+    TraceRecord *r = &ring[i % ring_size];
+
+    memset(buf, 0, sizeof(buf));
+    for (j = 0; j < 8; j++)
+      buf[j] = (r->t_count >> (j * 8)) & 0xff;
+    for (j = 0; j < 8; j++)
+      put_word(buf + 8 + j * 2, r->reg[j]);
+    memcpy(buf + 24, r->bytes, 4);
+    buf[28] = r->flags;
+    fwrite(buf, 1, TRACE_RECORD, file);
+  }
+
+  if (fclose(file) != 0) {
+    error("failed to write trace %s: %s", filename, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void trace_exit(void)
+{
+  if (ring != NULL && trace_file[0] != '\0')
+    trace_save(trace_file);
+}
+
+/*
+ * Start recording the last records instructions; they are written to
+ * filename at exit, if given.
+ */
+int trs_trace_start(const char *filename, long records)
+{
+  static int registered;
+
+  if (records <= 0)
+    records = 1 << 20;
+  if (ring == NULL || ring_size != (unsigned long)records) {
+    free(ring);
+    ring_next = 0;
+    if ((ring = malloc(records * sizeof(TraceRecord))) == NULL) {
+      error("failed to allocate instruction trace: %s", strerror(errno));
+      ring_size = 0;
+      trs_trace = 0;
+      return -1;
+    }
+    ring_size = records;
+  }
+  if (filename != NULL) {
+    snprintf(trace_file, FILENAME_MAX, "%s", filename);
+    if (!registered) {
+      atexit(trace_exit);
+      registered = 1;
+    }
+  }
+  trs_trace = 1;
+  return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * trs_trace.h -- binary Z80 instruction trace
+ *
+ * A trace file starts with a header of TRACE_HEADER bytes: the magic
+ * "SDLTRACE", a 16-bit version and a 16-bit record size.  It is followed
+ * by one record of TRACE_RECORD bytes per executed instruction, oldest
+ * first, all numbers in little-endian byte order:
+ *
+ *    0  T-state counter before the instruction (64 bits)
+ *    8  PC, AF, BC, DE, HL, IX, IY, SP (16 bits each)
+ *   24  first four bytes at PC
+ *   28  IFF1 (bit 0), IFF2 (bit 1), interrupt mode (bits 2-3)
+ *   29  unused, zero
+ */
+#ifndef _TRS_TRACE_H
+#define _TRS_TRACE_H
+
+#define TRACE_MAGIC	"SDLTRACE"
+#define TRACE_VERSION	1
+#define TRACE_HEADER	12
+#define TRACE_RECORD	32
+
+/* Non-zero while recording, checked by z80_run for every instruction */
+extern int trs_trace;
+
+extern int trs_trace_start(const char *filename, long records);
+extern void trs_trace_instruction(void);
+
+#endif /* _TRS_TRACE_H */
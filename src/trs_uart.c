@@ -24,28 +24,43 @@
 
 /*
  * Emulation of the Radio Shack TRS-80 Model I/III/4/4P serial port.
+ *
+ * The port is connected to a tty device, to a pseudo-terminal created
+ * for it ("pty"), or to a client of a local socket ("tcp:port" or
+ * "unix:path").  An I/O thread waits for the host side with poll() and
+ * moves the bytes through two rings, so the emulator neither reads the
+ * descriptor on every tick nor blocks while writing to it.
  */
 
+/* for posix_openpt() and ptsname() on glibc */
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
 #ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <termios.h>
 #endif
 #include <unistd.h>
+#include <SDL.h>
 #include "error.h"
 #include "trs.h"
 #include "trs_uart.h"
 #include "trs_state_save.h"
 
-#ifndef FNONBLOCK
-#define FNONBLOCK O_NONBLOCK
-#endif
-
 #define BUFSIZE 256
+#define RINGSIZE 4096 /* must be a power of two */
 /*#define UARTDEBUG 1*/
 /*#define UARTDEBUG2 1*/
 
@@ -73,15 +88,42 @@ static struct {
   Uint8* bufp;
   int bufleft;
   int tstates;
+  tstate_t sent;		/* when the last byte is shifted out */
 
   int fd;
-  int fdflags;
 #ifndef _WIN32
   struct termios t;
 #endif
 } uart;
 
 #ifndef _WIN32
+enum { UART_DEVICE, UART_PTY, UART_TCP, UART_UNIX };
+
+/*
+ * Bytes passed between the emulator and the I/O thread.  Each ring has
+ * one producer, which only writes head, and one consumer, which only
+ * writes tail, so neither needs a lock.
+ */
+typedef struct {
+  Uint8 data[RINGSIZE];
+  volatile unsigned int head;
+  volatile unsigned int tail;
+} Ring;
+
+#ifdef __GNUC__
+#define ring_barrier() __sync_synchronize()
+#else
+#define ring_barrier()
+#endif
+
+static Ring uart_in, uart_out;
+static SDL_Thread *uart_thread;
+static volatile int uart_stop;
+static int uart_wake[2] = { -1, -1 };
+static int uart_kind;
+static int uart_listen = -1;
+static char uart_path[FILENAME_MAX];
+
 static int trs_uart_wordbits[] = TRS_UART_WORDBITS_TABLE;
 static float trs_uart_baud[] = TRS_UART_BAUD_TABLE;
 
@@ -139,6 +181,288 @@ xlate_baud(int trs_baud)
 }
 #endif
 
+#ifndef _WIN32
+static int
+ring_used(const Ring *r)
+{
+  return r->head - r->tail;
+}
+
+static int
+ring_put(Ring *r, const Uint8 *buf, int n)
+{
+  unsigned int head = r->head;
+  int i;
+
+  if (n > RINGSIZE - ring_used(r)) n = RINGSIZE - ring_used(r);
+  for (i = 0; i < n; i++) {
+    r->data[head++ & (RINGSIZE - 1)] = buf[i];
+  }
+  ring_barrier();
+  r->head = head;
+  return n;
+}
+
+/* Copy up to n bytes without taking them out of the ring */
+static int
+ring_peek(const Ring *r, Uint8 *buf, int n)
+{
+  unsigned int tail = r->tail;
+  int i;
+
+  if (n > ring_used(r)) n = ring_used(r);
+  ring_barrier();
+  for (i = 0; i < n; i++) {
+    buf[i] = r->data[tail++ & (RINGSIZE - 1)];
+  }
+  return n;
+}
+
+static void
+ring_skip(Ring *r, int n)
+{
+  ring_barrier();
+  r->tail += n;
+}
+
+static int
+ring_get(Ring *r, Uint8 *buf, int n)
+{
+  n = ring_peek(r, buf, n);
+  ring_skip(r, n);
+  return n;
+}
+
+/* Only devices and pseudo-terminals have line settings */
+static int
+uart_tty(void)
+{
+  return uart.fd != -1 && (uart_kind == UART_DEVICE || uart_kind == UART_PTY);
+}
+
+static void
+uart_unlink(void)
+{
+  if (uart_path[0]) {
+    unlink(uart_path);
+    uart_path[0] = '\0';
+  }
+}
+
+/* The socket client went away or the device failed */
+static void
+uart_hangup(void)
+{
+  if (uart_kind == UART_TCP || uart_kind == UART_UNIX) {
+    close(uart.fd);
+    uart.fd = -1;
+    uart.modem &= ~TRS_UART_CD;
+  }
+  /* Nobody is listening, so the pending output is lost */
+  ring_skip(&uart_out, ring_used(&uart_out));
+}
+
+static int
+uart_io(void *data)
+{
+  struct pollfd fds[2];
+  Uint8 buf[BUFSIZE];
+  int hungup = 0;
+  int n, rc;
+
+  while (!uart_stop) {
+    fds[0].fd = uart_wake[0];
+    fds[0].events = POLLIN;
+    fds[1].events = 0;
+    if (uart.fd == -1) {
+      fds[1].fd = uart_listen;
+      fds[1].events = POLLIN;
+    } else {
+      fds[1].fd = hungup ? -1 : uart.fd;
+      if (ring_used(&uart_in) < RINGSIZE) fds[1].events |= POLLIN;
+      if (ring_used(&uart_out) > 0) fds[1].events |= POLLOUT;
+    }
+    /* A full input ring or a closed pty is looked at again later */
+    rc = poll(fds, 2, (hungup || ring_used(&uart_in) == RINGSIZE) ? 100 : -1);
+    if (rc < 0) {
+      if (errno == EINTR) continue;
+      error("can't poll %s: %s", trs_uart_name, strerror(errno));
+      break;
+    }
+    hungup = 0;
+    if (fds[0].revents & POLLIN) {
+      while (read(uart_wake[0], buf, BUFSIZE) > 0);
+    }
+
+    if (uart.fd == -1) {
+      if (fds[1].revents & POLLIN) {
+	uart.fd = accept(uart_listen, NULL, NULL);
+	if (uart.fd != -1) {
+	  fcntl(uart.fd, F_SETFL, O_NONBLOCK);
+	  ring_skip(&uart_out, ring_used(&uart_out));
+	  uart.modem |= TRS_UART_CD;
+	}
+      }
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      n = RINGSIZE - ring_used(&uart_in);
+      do {
+	rc = read(uart.fd, buf, n < BUFSIZE ? n : BUFSIZE);
+      } while (rc < 0 && errno == EINTR);
+#if UARTDEBUG
+      debug("trs_uart read returns %d, errno %d\n", rc, errno);
+#endif
+      if (rc > 0) {
+	ring_put(&uart_in, buf, rc);
+      } else if (rc == 0 || errno != EAGAIN) {
+	/* EIO just means that the other side of the pty is closed */
+	if (rc < 0 && uart_kind == UART_DEVICE)
+	  error("can't read from %s: %s", trs_uart_name, strerror(errno));
+	uart_hangup();
+	hungup = 1;
+	continue;
+      }
+    }
+    if (fds[1].revents & POLLOUT) {
+      n = ring_peek(&uart_out, buf, BUFSIZE);
+      do {
+	rc = write(uart.fd, buf, n);
+      } while (rc < 0 && errno == EINTR);
+      if (rc >= 0) {
+	ring_skip(&uart_out, rc);
+      } else if (errno != EAGAIN) {
+	if (uart_kind == UART_DEVICE)
+	  error("can't write to %s: %s", trs_uart_name, strerror(errno));
+	uart_hangup();
+	hungup = 1;
+	continue;
+      }
+    }
+    if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+      uart_hangup();
+      hungup = 1;
+    }
+  }
+  return 0;
+}
+
+static int
+uart_open_pty(void)
+{
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (fd == -1 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    error("can't create a pseudo-terminal: %s", strerror(errno));
+    if (fd != -1) close(fd);
+    return -1;
+  }
+  printf("Serial port is connected to %s\n", ptsname(fd));
+  fflush(stdout);
+  return fd;
+}
+
+static int
+uart_open_socket(void)
+{
+  struct sockaddr_in in;
+  struct sockaddr_un un;
+  struct sockaddr *addr;
+  socklen_t len;
+  struct stat st;
+  int const one = 1;
+  int fd;
+
+  if (uart_kind == UART_TCP) {
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(atoi(trs_uart_name + 4));
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr = (struct sockaddr *)&in;
+    len = sizeof(in);
+  } else {
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    snprintf(un.sun_path, sizeof(un.sun_path), "%s", trs_uart_name + 5);
+    /* Remove the socket left by an earlier run, but nothing else */
+    if (stat(un.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(un.sun_path);
+    addr = (struct sockaddr *)&un;
+    len = sizeof(un);
+  }
+  fd = socket(addr->sa_family, SOCK_STREAM, 0);
+  if (fd == -1) {
+    error("can't create socket for %s: %s", trs_uart_name, strerror(errno));
+    return -1;
+  }
+  if (uart_kind == UART_TCP)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, addr, len) != 0 || listen(fd, 1) != 0) {
+    error("can't listen on %s: %s", trs_uart_name, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if (uart_kind == UART_UNIX) {
+    snprintf(uart_path, FILENAME_MAX, "%s", un.sun_path);
+    atexit(uart_unlink);
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+/* Stop the I/O thread and close the descriptors */
+static void
+uart_close(void)
+{
+  if (uart_thread == NULL && initialized != 1) return;
+  if (uart_thread != NULL) {
+    uart_stop = 1;
+    if (write(uart_wake[1], "", 1) < 0) {
+      /* the pipe is full, so the thread is woken up anyway */
+    }
+    SDL_WaitThread(uart_thread, NULL);
+    uart_thread = NULL;
+    uart_stop = 0;
+  }
+  if (uart_wake[0] != -1) {
+    close(uart_wake[0]);
+    close(uart_wake[1]);
+    uart_wake[0] = uart_wake[1] = -1;
+  }
+  if (uart.fd != -1) close(uart.fd);
+  if (uart_listen != -1) close(uart_listen);
+  uart.fd = uart_listen = -1;
+  uart_unlink();
+  uart_in.head = uart_in.tail = 0;
+  uart_out.head = uart_out.tail = 0;
+}
+
+static int
+uart_start(void)
+{
+  if (pipe(uart_wake) != 0) {
+    error("can't create pipe for %s: %s", trs_uart_name, strerror(errno));
+    uart_wake[0] = uart_wake[1] = -1;
+    return -1;
+  }
+  fcntl(uart_wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(uart_wake[1], F_SETFL, O_NONBLOCK);
+  /* A client that goes away is noticed by the thread, not by a signal */
+  signal(SIGPIPE, SIG_IGN);
+#ifdef SDL2
+  uart_thread = SDL_CreateThread(uart_io, "Serial port", NULL);
+#else
+  uart_thread = SDL_CreateThread(uart_io, NULL);
+#endif
+  if (uart_thread == NULL) {
+    error("can't create thread for %s: %s", trs_uart_name, SDL_GetError());
+    return -1;
+  }
+  return 0;
+}
+#endif
+
 void
 trs_uart_init(int reset_button)
 {
@@ -152,20 +476,37 @@ trs_uart_init(int reset_button)
   initialized = -1;
   return;
 #else
-  if (initialized == 1 && uart.fd != -1) close(uart.fd);
+  uart_close();
   if (trs_uart_name[0] == '\000') {
     /* Emulate having no serial port */
     initialized = -1;
     return;
   }
   initialized = 1;
-  uart.fd = open(trs_uart_name, O_RDWR|O_NOCTTY|O_NONBLOCK);
-  if (uart.fd == -1) {
-    error("can't open %s: %s", trs_uart_name, strerror(errno));
+  uart.fd = uart_listen = -1;
+  /* Not readable from a user process on unix */
+  uart.modem = TRS_UART_CTS | TRS_UART_DSR | TRS_UART_CD;
+
+  if (strcmp(trs_uart_name, "pty") == 0) {
+    uart_kind = UART_PTY;
+    uart.fd = uart_open_pty();
+  } else if (strncmp(trs_uart_name, "tcp:", 4) == 0 ||
+	     strncmp(trs_uart_name, "unix:", 5) == 0) {
+    uart_kind = trs_uart_name[0] == 't' ? UART_TCP : UART_UNIX;
+    uart_listen = uart_open_socket();
+    /* Carrier detect is on while a client is connected */
+    uart.modem &= ~TRS_UART_CD;
+  } else {
+    uart_kind = UART_DEVICE;
+    uart.fd = open(trs_uart_name, O_RDWR|O_NOCTTY|O_NONBLOCK);
+    if (uart.fd == -1)
+      error("can't open %s: %s", trs_uart_name, strerror(errno));
+  }
+  if (uart.fd == -1 && uart_listen == -1) {
     initialized = -1;
     return;
-  } else {
-    uart.fdflags = FNONBLOCK;
+  }
+  if (uart_tty()) {
     err = tcgetattr(uart.fd, &uart.t);
     if (err < 0) {
       error("can't get attributes of %s: %s", trs_uart_name, strerror(errno));
@@ -180,9 +521,6 @@ trs_uart_init(int reset_button)
   uart.t.c_lflag = 0;
   memset(uart.t.c_cc, 0, sizeof(uart.t.c_cc));
 
-  /* Not readable from a user process on unix */
-  uart.modem = TRS_UART_CTS | TRS_UART_DSR | TRS_UART_CD;
-
   uart.switches = (trs_model == 1) ? trs_uart_switches : 0xff;
 
   /* arbitrary default */
@@ -199,6 +537,11 @@ trs_uart_init(int reset_button)
 
   uart.bufp = uart.buf;
   uart.bufleft = 0;
+
+  if (uart_start() != 0) {
+    uart_close();
+    initialized = -1;
+  }
 #endif
 }
 
@@ -269,7 +612,7 @@ trs_uart_baud_out(int value)
   debug("total bits %d; tstates per word %d\n", bits, uart.tstates);
 #endif
 
-  if (uart.fd != -1) {
+  if (uart_tty()) {
     err = tcsetattr(uart.fd, TCSADRAIN, &uart.t);
     if (err == -1) {
       error("can't set attributes of %s: %s", trs_uart_name, strerror(errno));
@@ -292,40 +635,29 @@ trs_uart_set_empty(int dummy)
   trs_uart_snd_interrupt(1);
 }
 
+#ifndef _WIN32
+/* Checked when polled instead of taking over the single event slot */
+static void
+trs_uart_check_sent(void)
+{
+  if (!(uart.status & TRS_UART_SENT) && z80_state.t_count >= uart.sent)
+    trs_uart_set_empty(0);
+}
+#endif
+
 int
 trs_uart_check_avail(void)
 {
 #ifdef _WIN32
   return 0;
 #else
-  if (initialized == 1 && uart.bufleft == 0 && uart.fd != -1) {
-    /* check for data available */
-    int rc;
-    if (!(uart.fdflags & FNONBLOCK)) {
-#if UARTDEBUG
-      debug("trs_uart nonblocking\n");
-#endif
-      uart.fdflags |= FNONBLOCK;
-      fcntl(uart.fd, F_SETFL, uart.fdflags);
-    }
-    do {
-      rc = read(uart.fd, uart.buf, BUFSIZE);
-    } while (rc < 0 && errno == EINTR);
-#if UARTDEBUG
-#if !UARTDEBUG2
-    if (rc >= 0 || errno != EAGAIN)
-#endif
-      debug("trs_uart read returns %d, errno %d\n", rc, errno);
-#endif
-    if (rc < 0) {
-      if (errno != EAGAIN) {
-	error("can't read from %s: %s", trs_uart_name, strerror(errno));
-      }
-      rc = 0;
-    }
+  if (initialized == 1)
+    trs_uart_check_sent();
+  if (initialized == 1 && uart.bufleft == 0) {
+    /* take what the I/O thread has read */
     uart.bufp = uart.buf;
-    uart.bufleft = rc;
-    if (rc > 0) {
+    uart.bufleft = ring_get(&uart_in, uart.buf, BUFSIZE);
+    if (uart.bufleft > 0) {
       /* be sure events don't happen too fast */
       trs_schedule_event(trs_uart_set_avail, 1, uart.tstates);
     }
@@ -388,14 +720,14 @@ trs_uart_control_out(int value)
   if (value & TRS_UART_STOP2) cflag |= CSTOPB;
   if (!(value & TRS_UART_NOPAR)) cflag |= PARENB;
   uart.t.c_cflag = cflag;
-  if (uart.fd != -1) {
+  if (uart_tty()) {
     err = tcsetattr(uart.fd, TCSADRAIN, &uart.t);
     if (err == -1) {
       error("can't set attributes of %s: %s", trs_uart_name, strerror(errno));
     }
   }
 
-  if (!(value & TRS_UART_NOTBREAK) && uart.fd != -1) {
+  if (!(value & TRS_UART_NOTBREAK) && uart_tty()) {
     err = tcsendbreak(uart.fd, 0);
     if (err == -1) {
       error("can't send break on %s: %s", trs_uart_name, strerror(errno));
@@ -431,7 +763,7 @@ trs_uart_data_out(int value)
 #ifdef _WIN32
   return;
 #else
-  int err;
+  Uint8 const byte = value;
 
 #if UARTDEBUG
   debug("trs_uart_data_out 0x%02x\n", value);
@@ -439,24 +771,22 @@ trs_uart_data_out(int value)
   if (initialized == 0) trs_uart_init(0);
   if (initialized == -1) return;
   uart.odata = value;
+  /* Without a socket client the byte is lost, as on an open line */
   if (uart.fd != -1) {
-    for (;;) {
-      err = write(uart.fd, &uart.odata, 1);
-      if (err >= 0) return;
-      if (errno != EAGAIN) {
-	error("can't read from %s: %s", trs_uart_name, strerror(errno));
-	return;
-      }
-      /* Oops, here we didn't really want nonblocking i/o */
+    /* Wait for the host only if it has not taken the last RINGSIZE bytes */
+    while (ring_put(&uart_out, &byte, 1) == 0) {
 #if UARTDEBUG
       debug("trs_uart blocking\n");
 #endif
-      uart.fdflags &= ~FNONBLOCK;
-      fcntl(uart.fd, F_SETFL, uart.fdflags);
+      SDL_Delay(1);
+    }
+    if (ring_used(&uart_out) == 1 && write(uart_wake[1], "", 1) < 0) {
+      /* the pipe is full, so the thread is woken up anyway */
     }
-    trs_uart_snd_interrupt(0);
-    trs_schedule_event(trs_uart_set_empty, 1, uart.tstates);
   }
+  uart.status &= ~TRS_UART_SENT;
+  uart.sent = z80_state.t_count + uart.tstates;
+  trs_uart_snd_interrupt(0);
 #endif
 }
 
@@ -0,0 +1,161 @@
+/*
+ * trs_video.c -- lossless recording of the emulated display
+ *
+ * Once per timer tick the state of the display is captured at the
+ * resolution of the TRS-80: the text screen, the display mode and the
+ * memory of the Grafyx and HRG boards, not the scaled window.  Only the
+ * bytes that changed since the previous tick are written, so a frame
+ * costs a comparison of some 46K and usually a few bytes of output.
+ * The recording is turned into images or a video by trsvideo.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "trs.h"
+#include "trs_video.h"
+
+/* Ranges of equal bytes shorter than this are included in a range */
+#define VIDEO_GAP	8
+/* Bytes compared at once to skip unchanged parts quickly */
+#define VIDEO_BLOCK	64
+
+int trs_video = 0;
+
+static FILE *video_file;
+static char video_name[FILENAME_MAX];
+static Uint8 *frame, *previous;
+static Uint8 *ranges;
+static Uint32 repeat;
+
+static void put_word(Uint8 *p, Uint16 value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+static void video_write(const Uint8 *data, size_t size)
+{
+  if (fwrite(data, 1, size, video_file) != size) {
+    error("failed to write video %s: %s", video_name, strerror(errno));
+    fclose(video_file);
+    video_file = NULL;
+    trs_video = 0;
+  }
+}
+
+static void video_repeat(void)
+{
+  Uint8 buf[3];
+
+  while (repeat > 0 && video_file) {
+    Uint16 const count = repeat > 0xffff ? 0xffff : repeat;
+
+    buf[0] = VIDEO_REPEAT;
+    put_word(buf + 1, count);
+    video_write(buf, 3);
+    repeat -= count;
+  }
+}
+
+void trs_video_stop(void)
+{
+  if (video_file == NULL)
+    return;
+  video_repeat();
+  if (video_file && fclose(video_file) != 0)
+    error("failed to write video %s: %s", video_name, strerror(errno));
+  video_file = NULL;
+  trs_video = 0;
+}
+
+/* Start recording to filename; any recording in progress is closed */
+int trs_video_start(const char *filename)
+{
+  static int registered;
+  Uint8 header[VIDEO_HEADER];
+
+  trs_video_stop();
+  if (frame == NULL) {
+    frame = malloc(VIDEO_FRAME);
+    previous = malloc(VIDEO_FRAME);
+    /* Ranges are at least VIDEO_GAP bytes apart, 4 bytes of overhead each */
+    ranges = malloc(VIDEO_FRAME * 2);
+    if (frame == NULL || previous == NULL || ranges == NULL) {
+      error("failed to allocate video buffers: %s", strerror(errno));
+      free(frame);
+      free(previous);
+      free(ranges);
+      frame = previous = ranges = NULL;
+      return -1;
+    }
+  }
+  if ((video_file = fopen(filename, "wb")) == NULL) {
+    error("failed to create video %s: %s", filename, strerror(errno));
+    return -1;
+  }
+  snprintf(video_name, FILENAME_MAX, "%s", filename);
+  setvbuf(video_file, NULL, _IOFBF, 1 << 16);
+
+  memcpy(header, VIDEO_MAGIC, 8);
+  put_word(header + 8, VIDEO_VERSION);
+  put_word(header + 10, timer_hz);
+  put_word(header + 12, VIDEO_FRAME);
+  video_write(header, VIDEO_HEADER);
+
+  memset(previous, 0, VIDEO_FRAME);
+  repeat = 0;
+  if (!registered) {
+    atexit(trs_video_stop);
+    registered = 1;
+  }
+  trs_video = 1;
+  return 0;
+}
+
+/* Called once per timer tick while recording */
+void trs_video_frame(void)
+{
+  Uint8 *p = ranges + 3;
+  int count = 0;
+  int start, end, i;
+
+  trs_screen_capture(frame);
+
+  for (i = 0; i < VIDEO_FRAME; ) {
+    if (frame[i] == previous[i]) {
+      if (i % VIDEO_BLOCK == 0 && i + VIDEO_BLOCK <= VIDEO_FRAME &&
+          memcmp(frame + i, previous + i, VIDEO_BLOCK) == 0)
+        i += VIDEO_BLOCK;
+      else
+        i++;
+      continue;
+    }
+    start = i;
+    end = ++i;
+    while (i < VIDEO_FRAME && i - end < VIDEO_GAP) {
+      if (frame[i] != previous[i])
+        end = i + 1;
+      i++;
+    }
+    put_word(p, start);
+    put_word(p + 2, end - start);
+    memcpy(p + 4, frame + start, end - start);
+    p += 4 + end - start;
+    count++;
+    i = end;
+  }
+
+  if (count == 0) {
+    repeat++;
+    return;
+  }
+  video_repeat();
+  if (video_file == NULL)
+    return;
+  ranges[0] = VIDEO_DELTA;
+  put_word(ranges + 1, count);
+  video_write(ranges, p - ranges);
+  memcpy(previous, frame, VIDEO_FRAME);
+}
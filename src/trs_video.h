@@ -0,0 +1,68 @@
+/*
+ * trs_video.h -- lossless recording of the emulated display
+ *
+ * A recording starts with a header of VIDEO_HEADER bytes: the magic
+ * "SDLVIDEO", a 16-bit version, the 16-bit frame rate in Hz and the
+ * 16-bit frame size.  Each frame is the state of the display, laid out
+ * as below, and is stored as the byte ranges that differ from the
+ * previous frame; the frame before the first is all zeroes.  Numbers
+ * are in little-endian byte order.
+ *
+ *   VIDEO_DELTA, 16-bit number of ranges, then for each range
+ *     a 16-bit offset, a 16-bit length and the bytes
+ *   VIDEO_REPEAT, 16-bit count: the previous frame count times more
+ *
+ * Frame layout:
+ *
+ *      0  model
+ *      1  character set, index into trs_chars.c
+ *      2  display mode: expanded (1), inverse (2), alternate (4)
+ *      3  characters per row
+ *      4  rows
+ *      5  Grafyx: enabled (1), overlay (2)
+ *      6  Grafyx X offset
+ *      7  Grafyx Y offset
+ *      8  HRG enabled
+ *      9  character cell width in pixels
+ *     10  character cell height in pixels
+ *     16  text screen
+ *   2064  Grafyx memory, 256 lines of 128 bytes
+ *  34832  HRG memory
+ */
+#ifndef _TRS_VIDEO_H
+#define _TRS_VIDEO_H
+
+#define VIDEO_MAGIC	"SDLVIDEO"
+#define VIDEO_VERSION	1
+#define VIDEO_HEADER	14
+
+#define VIDEO_DELTA	1
+#define VIDEO_REPEAT	2
+
+#define VIDEO_MODEL	0
+#define VIDEO_CHARSET	1
+#define VIDEO_MODE	2
+#define VIDEO_COLUMNS	3
+#define VIDEO_ROWS	4
+#define VIDEO_GRAFYX	5
+#define VIDEO_GXOFFSET	6
+#define VIDEO_GYOFFSET	7
+#define VIDEO_HRG	8
+#define VIDEO_CELL_W	9
+#define VIDEO_CELL_H	10
+#define VIDEO_TEXT	16
+#define VIDEO_TEXT_SIZE	2048
+#define VIDEO_GRAFYX_MEM (VIDEO_TEXT + VIDEO_TEXT_SIZE)
+#define VIDEO_GRAFYX_SIZE (256 * 128)
+#define VIDEO_HRG_MEM	(VIDEO_GRAFYX_MEM + VIDEO_GRAFYX_SIZE)
+#define VIDEO_HRG_SIZE	(12 * 1024)
+#define VIDEO_FRAME	(VIDEO_HRG_MEM + VIDEO_HRG_SIZE)
+
+/* Non-zero while recording, checked by z80_run once per timer tick */
+extern int trs_video;
+
+extern int trs_video_start(const char *filename);
+extern void trs_video_stop(void);
+extern void trs_video_frame(void);
+
+#endif /* _TRS_VIDEO_H */
@@ -0,0 +1,103 @@
+/*
+ * trstrace.c -- decode a binary instruction trace written by sdltrs
+ *
+ * Usage: trstrace [-n count] tracefile
+ *
+ * Prints one line per recorded instruction: the T-state counter, the
+ * registers before the instruction and its disassembly.  With -n, only
+ * the last count instructions are printed.
+ */
+
+#ifndef ZBX
+#define ZBX
+#endif
+#include "dis.c"
+#include "trs_trace.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Uint8 record[TRACE_RECORD];
+
+static unsigned int get_word(const Uint8 *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+/* Opcode bytes of the current record, read by the disassembler */
+static int record_byte(int address)
+{
+  unsigned int offset = (address - get_word(record + 8)) & 0xffff;
+
+  return offset < 4 ? record[24 + offset] : 0;
+}
+
+int mem_peek(int address)
+{
+  return record_byte(address);
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *file;
+  Uint8 header[TRACE_HEADER];
+  long count = -1;
+  int size;
+  int i;
+
+  if (argc == 4 && strcmp(argv[1], "-n") == 0) {
+    count = atol(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc != 2) {
+    fprintf(stderr, "Usage: trstrace [-n count] tracefile\n");
+    return EXIT_FAILURE;
+  }
+  if ((file = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "trstrace: %s: %s\n", argv[1], strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (fread(header, 1, TRACE_HEADER, file) != TRACE_HEADER ||
+      memcmp(header, TRACE_MAGIC, 8) != 0 ||
+      get_word(header + 8) != TRACE_VERSION) {
+    fprintf(stderr, "trstrace: %s: not a trace file\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  size = get_word(header + 10);
+  if (size < TRACE_RECORD) {
+    fprintf(stderr, "trstrace: %s: bad record size %d\n", argv[1], size);
+    return EXIT_FAILURE;
+  }
+
+  if (count >= 0 && fseek(file, 0, SEEK_END) == 0) {
+    long records = (ftell(file) - TRACE_HEADER) / size;
+
+    if (records > count)
+      fseek(file, TRACE_HEADER + (records - count) * size, SEEK_SET);
+    else
+      fseek(file, TRACE_HEADER, SEEK_SET);
+  }
+
+  while (fread(record, 1, TRACE_RECORD, file) == TRACE_RECORD) {
+    Uint64 t_count = 0;
+
+    if (size > TRACE_RECORD)
+      fseek(file, size - TRACE_RECORD, SEEK_CUR);
+    for (i = 7; i >= 0; i--)
+      t_count = (t_count << 8) | record[i];
+    printf("%12" TSTATE_T_LEN " af=%04x bc=%04x de=%04x hl=%04x "
+           "ix=%04x iy=%04x sp=%04x %c%c im%d  ", t_count,
+           get_word(record + 10), get_word(record + 12),
+           get_word(record + 14), get_word(record + 16),
+           get_word(record + 18), get_word(record + 20),
+           get_word(record + 22),
+           (record[28] & 1) ? 'I' : '-', (record[28] & 2) ? 'I' : '-',
+           (record[28] >> 2) & 3);
+    disassemble_to(stdout, get_word(record + 8), record_byte);
+  }
+
+  fclose(file);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/*
+ * trsvideo.c -- convert a display recording written by sdltrs
+ *
+ * Usage: trsvideo recording output
+ *
+ * Renders each frame of the recording at the resolution of the TRS-80,
+ * with lines doubled as sdltrs shows them at scale 1.  If output ends
+ * in .y4m, the frames are written as a YUV4MPEG2 stream, which most
+ * video tools read (ffmpeg -i output.y4m video.mp4).  Otherwise output
+ * is a printf pattern such as frame%05d.pgm for one PGM image per frame.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL_types.h>
+#include "trs_chars.c"
+#include "trs_video.h"
+
+#define MAX_WIDTH	640
+#define MAX_HEIGHT	240
+
+static Uint8 frame[VIDEO_FRAME];
+static Uint8 image[MAX_HEIGHT][MAX_WIDTH];
+static int width, height;
+static int y4m;
+static const char *output;
+static FILE *file;
+static unsigned long frames;
+
+static unsigned int get_word(const Uint8 *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static void set_pixel(int x, int y, int mode)
+{
+  if (x < 0 || x >= width || y < 0 || y >= height)
+    return;
+  if (mode == 1)
+    image[y][x] = 255;
+  else if (mode == 2)
+    image[y][x] ^= 255;
+}
+
+/* Draw the cell like trs_screen_write_char, lines are not doubled here */
+static void render_char(int left, int top, int cw, int ch, Uint8 c)
+{
+  int const model = frame[VIDEO_MODEL];
+  int const mode = frame[VIDEO_MODE];
+  int const expanded = (mode & 1) != 0;
+  int const w = cw * (expanded + 1);
+  int x, y;
+
+  if (model == 1 && c >= 0xc0)
+    c -= 0x40;
+  if (c >= 0x80 && c <= 0xbf && !(mode & 2)) {
+    /* 2*3 box graphics */
+    for (y = 0; y < ch; y++) {
+      int const row = y < ch / 3 ? 0 : y < (ch * 2) / 3 ? 1 : 2;
+
+      for (x = 0; x < w; x++)
+        if ((c - 0x80) & (1 << (row * 2 + (x >= w / 2))))
+          set_pixel(left + x, top + y, 1);
+    }
+  } else {
+    int inverse = 0;
+
+    if (model > 1 && c >= 0xc0 && (mode & (4 + 2)) == 0)
+      c -= 0x40;
+    if ((mode & 2) && (c & 0x80)) {
+      inverse = 1;
+      c &= 0x7f;
+    }
+    for (y = 0; y < ch && y < TRS_CHAR_HEIGHT; y++) {
+      Uint8 const bits = trs_char_data[frame[VIDEO_CHARSET]][c][y];
+
+      for (x = 0; x < w; x++)
+        if (((bits >> (x >> expanded)) & 1) != inverse)
+          set_pixel(left + x, top + y, 1);
+    }
+  }
+}
+
+/* Graphics of the HRG1B, ORed into the cell */
+static void render_hrg(int left, int top, int w, int ch, int position)
+{
+  int i, j, x, y;
+
+  for (i = 0; i < 12; i++) {
+    Uint8 const byte = frame[VIDEO_HRG_MEM + position + (i << 10)] & 0x3f;
+
+    if (byte == 0)
+      continue;
+    for (j = 0; j < 6; j++) {
+      if (!(byte & (1 << j)))
+        continue;
+      for (y = ch * i / 12; y < ch * (i + 1) / 12; y++)
+        for (x = w * j / 6; x < w * (j + 1) / 6; x++)
+          set_pixel(left + x, top + y, 1);
+    }
+  }
+}
+
+/* Grafyx screen, drawn alone or XORed over the text */
+static void render_grafyx(int left, int top, int w, int h, int mode)
+{
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    Uint8 const *line = frame + VIDEO_GRAFYX_MEM +
+      ((y + frame[VIDEO_GYOFFSET]) % 256) * 128;
+
+    for (x = 0; x < w; x++)
+      if (line[(x / 8 + frame[VIDEO_GXOFFSET]) % 128] & (0x80 >> (x % 8)))
+        set_pixel(left + x, top + y, mode);
+  }
+}
+
+static void render(void)
+{
+  int const columns = frame[VIDEO_COLUMNS];
+  int const rows = frame[VIDEO_ROWS];
+  int const cw = frame[VIDEO_CELL_W];
+  int const ch = frame[VIDEO_CELL_H];
+  int const expanded = (frame[VIDEO_MODE] & 1) != 0;
+  int const left = (width - columns * cw) / 2;
+  int const top = (height - rows * ch) / 2;
+  int position;
+
+  memset(image, 0, sizeof(image));
+  if (frame[VIDEO_CHARSET] >= sizeof(trs_char_data) / sizeof(trs_char_data[0]))
+    return;
+
+  if ((frame[VIDEO_GRAFYX] & 3) == 1) {
+    render_grafyx(left, top, columns * cw, rows * ch, 1);
+    return;
+  }
+  for (position = 0; position < columns * rows && position < 2048;
+       position += expanded + 1) {
+    int const x = left + (position % columns) * cw;
+    int const y = top + (position / columns) * ch;
+
+    render_char(x, y, cw, ch, frame[VIDEO_TEXT + position]);
+    if (frame[VIDEO_HRG] && position < 1024)
+      render_hrg(x, y, cw * (expanded + 1), ch, position);
+  }
+  if (frame[VIDEO_GRAFYX] & 1)
+    render_grafyx(left, top, columns * cw, rows * ch, 2);
+}
+
+static void write_frame(void)
+{
+  static Uint8 *chroma;
+  char name[FILENAME_MAX];
+  int y;
+
+  if (y4m) {
+    /* Two chroma planes of width/2 x height for the doubled lines */
+    if (chroma == NULL) {
+      if ((chroma = malloc(width * height)) == NULL) {
+        fprintf(stderr, "trsvideo: out of memory\n");
+        exit(EXIT_FAILURE);
+      }
+      memset(chroma, 128, width * height);
+    }
+    fputs("FRAME\n", file);
+  } else {
+    snprintf(name, FILENAME_MAX, output, (int)frames);
+    if ((file = fopen(name, "wb")) == NULL) {
+      fprintf(stderr, "trsvideo: %s: %s\n", name, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    fprintf(file, "P5\n%d %d\n255\n", width, height * 2);
+  }
+  for (y = 0; y < height; y++) {
+    fwrite(image[y], 1, width, file);
+    fwrite(image[y], 1, width, file);
+  }
+  if (y4m)
+    fwrite(chroma, 1, width * height, file);
+  if (ferror(file) || (!y4m && fclose(file) != 0)) {
+    fprintf(stderr, "trsvideo: %s: %s\n", output, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  frames++;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *input;
+  Uint8 header[VIDEO_HEADER];
+  Uint8 buf[4];
+  unsigned int count, offset, length, rate;
+  int type;
+  int damaged = 0;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: trsvideo recording output\n");
+    return EXIT_FAILURE;
+  }
+  if ((input = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "trsvideo: %s: %s\n", argv[1], strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (fread(header, 1, VIDEO_HEADER, input) != VIDEO_HEADER ||
+      memcmp(header, VIDEO_MAGIC, 8) != 0 ||
+      get_word(header + 8) != VIDEO_VERSION ||
+      get_word(header + 12) != VIDEO_FRAME) {
+    fprintf(stderr, "trsvideo: %s: not a recording\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  rate = get_word(header + 10);
+  output = argv[2];
+  y4m = strlen(output) > 4 &&
+    strcmp(output + strlen(output) - 4, ".y4m") == 0;
+  if (!y4m && strchr(output, '%') == NULL) {
+    fprintf(stderr, "trsvideo: %s: needs a frame number like %%05d\n", output);
+    return EXIT_FAILURE;
+  }
+
+  while ((type = fgetc(input)) != EOF) {
+    if (fread(buf, 1, 2, input) != 2)
+      break;
+    count = get_word(buf);
+    if (type == VIDEO_REPEAT) {
+      if (frames == 0)
+        break;
+      while (count--)
+        write_frame();
+      continue;
+    }
+    if (type != VIDEO_DELTA)
+      break;
+    while (count-- && !damaged) {
+      if (fread(buf, 1, 4, input) != 4) {
+        damaged = 1;
+        break;
+      }
+      offset = get_word(buf);
+      length = get_word(buf + 2);
+      if (offset + length > VIDEO_FRAME ||
+          fread(frame + offset, 1, length, input) != length)
+        damaged = 1;
+    }
+    if (damaged)
+      break;
+
+    if (frames == 0) {
+      /* The size of the first frame is kept for the whole video */
+      if (frame[VIDEO_MODEL] >= 4) {
+        width = 640;
+        height = 240;
+      } else {
+        width = 64 * (frame[VIDEO_CELL_W] ? frame[VIDEO_CELL_W] : 8);
+        height = 16 * TRS_CHAR_HEIGHT;
+      }
+      if (y4m) {
+        if ((file = fopen(output, "wb")) == NULL) {
+          fprintf(stderr, "trsvideo: %s: %s\n", output, strerror(errno));
+          return EXIT_FAILURE;
+        }
+        fprintf(file, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C420jpeg\n",
+                width, height * 2, rate);
+      }
+    }
+    render();
+    write_frame();
+  }
+  if (type != EOF)
+    fprintf(stderr, "trsvideo: %s: truncated or damaged recording\n", argv[1]);
+
+  fclose(input);
+  if (y4m && file && fclose(file) != 0) {
+    fprintf(stderr, "trsvideo: %s: %s\n", output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  printf("%lu frames at %u Hz\n", frames, rate);
+  return EXIT_SUCCESS;
+}
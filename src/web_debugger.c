@@ -15,7 +15,64 @@ static struct mg_connection* status_conn = NULL;
 static TRX_Context* ctx = NULL;
 static bool trx_running = true;
 
-static TRX_MemorySegment memory_query_cache;
+// Copy of the memory as last sent to the frontend, compared page by page.
+#define MEMORY_PAGE_SIZE 256
+static uint8_t memory_snapshot[0x10000];
+static bool memory_page_modified[0x10000 / MEMORY_PAGE_SIZE];
+static bool memory_snapshot_valid = false;
+// Binary frame with two bytes of start address, reused for every send.
+static uint8_t* memory_frame = NULL;
+static char* last_registers_json = NULL;
+// Range sent while the emulation runs, as last requested by the frontend.
+static int watch_start = 0;
+static int watch_end = 0x10000;
+#define VIDEO_RAM_START 0x3C00
+#define VIDEO_RAM_END 0x4000
+
+// Binary protocol. The frontend side is in trs_xray/src/protocol.ts, keep
+// both in sync. Multi-byte values are little-endian.
+//
+// Frontend to emulator: one command per WebSocket message, the command byte
+// followed by its arguments.
+typedef enum {
+  TRX_CMD_REFRESH = 0x01,
+  TRX_CMD_STEP = 0x02,
+  TRX_CMD_CONTINUE = 0x03,
+  TRX_CMD_STOP = 0x04,
+  TRX_CMD_SOFT_RESET = 0x05,
+  TRX_CMD_HARD_RESET = 0x06,
+  TRX_CMD_GET_MEMORY = 0x07,         // start u16, length u32
+  TRX_CMD_FORCE_MEMORY = 0x08,
+  TRX_CMD_SET_MEMORY = 0x09,         // address u16, value u8
+  TRX_CMD_ADD_BREAKPOINT = 0x0A,     // type u8, address u16
+  TRX_CMD_REMOVE_BREAKPOINT = 0x0B,  // id u16
+  TRX_CMD_CLEAR_BREAKPOINTS = 0x0C,
+  TRX_CMD_KEY_EVENT = 0x0D,          // down u8, shift u8, key (UTF-8)
+  TRX_CMD_INJECT_DEMO = 0x0E
+} TRX_Command;
+
+// Emulator to frontend: all that is produced during one poll of www_looper
+// goes out as a single message, a sequence of records made of a type byte,
+// the u32 length of the payload and the payload.
+typedef enum {
+  TRX_MSG_CONTEXT = 0x01,      // model u8, flags u8 (1: running,
+                               // 2: alt single step), system name
+  TRX_MSG_REGISTERS = 0x02,    // see append_registers()
+  TRX_MSG_BREAKPOINTS = 0x03,  // per breakpoint: id u16, address u16, type u8
+  TRX_MSG_MEMORY = 0x04,       // start u16, data
+  TRX_MSG_SCREEN = 0x05,       // start u16, data; memory within video RAM
+  TRX_MSG_STOPPED = 0x06       // pc u16, breakpoint id u16 or 0xFFFF
+} TRX_Message;
+
+// Set once the frontend talks the binary protocol. Until then the text
+// commands and JSON state of the original protocol are used.
+static bool binary_protocol = false;
+static uint8_t* batch = NULL;
+static size_t batch_length = 0;
+static size_t batch_size = 0;
+static size_t batch_record_start = 0;
+static uint8_t* last_state = NULL;
+static size_t last_state_length = 0;
 
 static bool init_webserver(void);
 static char* get_registers_json(const TRX_StatusRegistersAndFlags* registers);
@@ -58,6 +115,7 @@ TRX_Context* get_default_trx_context() {
   ctx->get_resource = NULL;
   ctx->get_state_update = NULL;
   ctx->set_pc = NULL;
+  ctx->key_event = NULL;
   return ctx;
 }
 
@@ -84,7 +142,7 @@ bool init_trs_xray(TRX_Context* ctx_param) {
   }
 
   // Pre-allocate for performance to max required size.
-  memory_query_cache.data = (uint8_t*) malloc(sizeof(uint8_t) * ctx->capabilities.memory_range.length);
+  memory_frame = (uint8_t*) malloc(sizeof(uint8_t) * (ctx->capabilities.memory_range.length + 2));
 
   emu_run_thread =
       SDL_CreateThread(emu_run_looper, "TRX Emu Run Thread", (void *)NULL);
@@ -114,55 +172,149 @@ static void inject_demo_program(void) {
   ctx->set_pc(0x8000);
 }
 
-static void send_update_to_web_debugger() {
-  if (status_conn == NULL) return;
+static void batch_put(const void* data, size_t length) {
+  if (batch_length + length > batch_size) {
+    size_t size = batch_size ? batch_size : 4096;
+    while (size < batch_length + length) size *= 2;
+    batch = realloc(batch, size);
+    if (batch == NULL) {
+      puts("[TRX] ERROR: Out of memory.");
+      abort();
+    }
+    batch_size = size;
+  }
+  memcpy(batch + batch_length, data, length);
+  batch_length += length;
+}
 
-  TRX_SystemState state;
-  ctx->get_state_update(&state);
+static void batch_put_u8(uint8_t value) {
+  batch_put(&value, 1);
+}
 
-  // Send registers.
-  char* message = get_registers_json(&state.registers);
-  mg_ws_send(status_conn, message, strlen(message), WEBSOCKET_OP_TEXT);
-  free(message);
+static void batch_put_u16(uint16_t value) {
+  uint8_t bytes[2] = { value & 0xFF, value >> 8 };
+  batch_put(bytes, 2);
+}
+
+static void batch_put_u32(uint32_t value) {
+  uint8_t bytes[4] = { value & 0xFF, (value >> 8) & 0xFF,
+                       (value >> 16) & 0xFF, value >> 24 };
+  batch_put(bytes, 4);
+}
+
+static void batch_begin_record(TRX_Message type) {
+  batch_put_u8(type);
+  batch_record_start = batch_length;
+  batch_put_u32(0);
+}
+
+static void batch_end_record() {
+  uint32_t length = batch_length - batch_record_start - 4;
+  uint8_t* p = batch + batch_record_start;
+  p[0] = length & 0xFF;
+  p[1] = (length >> 8) & 0xFF;
+  p[2] = (length >> 16) & 0xFF;
+  p[3] = length >> 24;
 }
 
-void get_memory_segment(int start, int length,
-                        TRX_MemorySegment* segment,
-                        bool force_full_update) {
-  // Only send a range of data that changed (within the given params).
-  static uint8_t* previous_memory_ = NULL;
-  if (previous_memory_ == NULL) {
-      previous_memory_ = (uint8_t*) malloc(sizeof(uint8_t) * ctx->capabilities.memory_range.length);
+// Sends all records of this poll as one message.
+static void flush_batch() {
+  if (status_conn != NULL && batch_length > 0) {
+    mg_ws_send(status_conn, (const char*)batch, batch_length, WEBSOCKET_OP_BINARY);
   }
+  batch_length = 0;
+}
 
-  int start_actual = start;
-  if (!force_full_update) {
-    for (int i = start; i < start + length; ++i) {
-      int data = ctx->read_memory(i);
-      if (previous_memory_[i - start] != data) {
-        start_actual = i;
-        break;
-      }
-    }
+// 12 register pairs, i, r, r7, iff1, iff2, interrupt mode, the T-state
+// counter as u64 and the clock speed in MHz as float32.
+static void append_registers(const TRX_StatusRegistersAndFlags* regs) {
+  union { float f; uint32_t u; } clock_mhz;
+
+  batch_begin_record(TRX_MSG_REGISTERS);
+  batch_put_u16(regs->pc);
+  batch_put_u16(regs->sp);
+  batch_put_u16(regs->af);
+  batch_put_u16(regs->bc);
+  batch_put_u16(regs->de);
+  batch_put_u16(regs->hl);
+  batch_put_u16(regs->af_prime);
+  batch_put_u16(regs->bc_prime);
+  batch_put_u16(regs->de_prime);
+  batch_put_u16(regs->hl_prime);
+  batch_put_u16(regs->ix);
+  batch_put_u16(regs->iy);
+  batch_put_u8(regs->i);
+  batch_put_u8(regs->r);
+  batch_put_u8(regs->r7 & 0x7f);
+  batch_put_u8(regs->iff1);
+  batch_put_u8(regs->iff2);
+  batch_put_u8(regs->interrupt_mode);
+  batch_put_u32(regs->t_count & 0xFFFFFFFF);
+  batch_put_u32(regs->t_count >> 32);
+  clock_mhz.f = regs->clock_mhz;
+  batch_put_u32(clock_mhz.u);
+  batch_end_record();
+}
+
+// Context, breakpoints and registers, the binary form of get_registers_json().
+static void append_state(const TRX_StatusRegistersAndFlags* regs) {
+  batch_begin_record(TRX_MSG_CONTEXT);
+  batch_put_u8(ctx->model);
+  batch_put_u8((emulation_running ? 1 : 0) |
+               (ctx->capabilities.alt_single_step_mode ? 2 : 0));
+  batch_put(ctx->system_name, strlen(ctx->system_name));
+  batch_end_record();
+
+  batch_begin_record(TRX_MSG_BREAKPOINTS);
+  for (int i = 0; i < max_breakpoints_; ++i) {
+    if (!breakpoints_[i].enabled) continue;
+    batch_put_u16(i);
+    batch_put_u16(breakpoints_[i].address);
+    batch_put_u8(breakpoints_[i].type);
   }
+  batch_end_record();
 
-  int length_actual = length;
-  if (!force_full_update) {
-    for (int i = start + length - 1; i >= start; --i) {
-      int data = ctx->read_memory(i);
-      if (previous_memory_[i - start] != data) {
-        length_actual = (i - start_actual) + 1;
-        break;
-      }
+  append_registers(regs);
+}
+
+static void send_registers(bool only_if_changed) {
+  if (status_conn == NULL) return;
+
+  TRX_SystemState state;
+  ctx->get_state_update(&state);
+
+  if (binary_protocol) {
+    size_t state_start = batch_length;
+    size_t state_length;
+
+    append_state(&state.registers);
+    state_length = batch_length - state_start;
+    if (only_if_changed && last_state != NULL &&
+        state_length == last_state_length &&
+        memcmp(batch + state_start, last_state, state_length) == 0) {
+      batch_length = state_start;
+      return;
     }
+    last_state = realloc(last_state, state_length);
+    memcpy(last_state, batch + state_start, state_length);
+    last_state_length = state_length;
+    return;
   }
-  segment->range.start = start_actual;
-  segment->range.length = length_actual;
-  for (int i = start_actual; i < start_actual + length_actual; ++i) {
-    int data = ctx->read_memory(i);
-    segment->data[i - start_actual] = data;
-    previous_memory_[i - start] = data;
+
+  // Send registers, unless they are the same as last time.
+  char* message = get_registers_json(&state.registers);
+  if (only_if_changed && last_registers_json != NULL &&
+      strcmp(message, last_registers_json) == 0) {
+    free(message);
+    return;
   }
+  mg_ws_send(status_conn, message, strlen(message), WEBSOCKET_OP_TEXT);
+  free(last_registers_json);
+  last_registers_json = message;
+}
+
+static void send_update_to_web_debugger() {
+  send_registers(false);
 }
 
 // Params: [addr]/[value]"
@@ -181,66 +333,103 @@ static void set_memory_segment(const char* params) {
   ctx->write_memory(addr, value);
 }
 
-// Params: [start]/[length], e.g. "0/65536"
-static void send_memory_segment(const char* params) {
-  if (status_conn == NULL) return;
-  // printf("TRX: MemorySegment request: '%s'.", params);
-
-  int param_start = 0;
-  int param_length = 0xFFFF;
-  bool force_update = true; //strcmp("force_update", params) == 0;
-
-  if (!force_update) {
-    // Extract parameters
-    int delim_pos = strchr(params, '/') - params;
-    char param_start_str[delim_pos + 1];
-    memcpy(param_start_str, params, delim_pos);
-    param_start_str[delim_pos] = '\0';
-    param_start = atoi(param_start_str);
-
-    int substr_length = strlen(params) - delim_pos;
-    char param_length_str[substr_length];
-    memcpy(param_length_str, params + delim_pos + 1, substr_length - 1);
-    param_length_str[substr_length - 1] = '\0';
-    param_length = atoi(param_length_str);
-    // printf("Parameters: start(%d) length(%d)\n", param_start, param_length);
+// Sends [start, start + length) of the snapshot as a memory record or, in the
+// original protocol, as one binary frame prefixed by the big-endian start
+// address.
+static void send_memory_frame(int start, int length) {
+  if (binary_protocol) {
+    bool screen = start >= VIDEO_RAM_START && start < VIDEO_RAM_END;
+    batch_begin_record(screen ? TRX_MSG_SCREEN : TRX_MSG_MEMORY);
+    batch_put_u16(start);
+    batch_put(memory_snapshot + start, length);
+    batch_end_record();
+    return;
   }
+  memory_frame[0] = (start & 0xFF00) >> 8;
+  memory_frame[1] = start & 0x00FF;
+  memcpy(memory_frame + 2, memory_snapshot + start, length);
+  mg_ws_send(status_conn, (const char*)memory_frame, length + 2, WEBSOCKET_OP_BINARY);
+}
+
+// Sends the memory in [start, end) that changed since it was last sent, one
+// frame per run of adjacent pages. A page is sent once more after it stopped
+// changing, so that the frontend drops its change markers. The video RAM is
+// kept apart from the rest, so the frontend can tell screen updates.
+static void send_memory_range(int start, int end, bool force_update) {
+  if (status_conn == NULL) return;
 
   // Limit to range supported by SUT.
-  if (param_start < ctx->capabilities.memory_range.start) {
-    param_start = ctx->capabilities.memory_range.start;
+  if (start < (int) ctx->capabilities.memory_range.start) {
+    start = ctx->capabilities.memory_range.start;
   }
-
-  if (param_length > ctx->capabilities.memory_range.length) {
-    param_length = ctx->capabilities.memory_range.length;
+  if (end > (int) (ctx->capabilities.memory_range.start +
+                   ctx->capabilities.memory_range.length)) {
+    end = ctx->capabilities.memory_range.start +
+          ctx->capabilities.memory_range.length;
   }
+  if (start >= end) return;
+  if (!memory_snapshot_valid) force_update = true;
+  memory_snapshot_valid = true;
+
+  int run_start = -1;
+  bool run_screen = false;
+  for (int page = start / MEMORY_PAGE_SIZE;
+       page <= (end - 1) / MEMORY_PAGE_SIZE; ++page) {
+    int page_start = page * MEMORY_PAGE_SIZE;
+    int page_end = page_start + MEMORY_PAGE_SIZE;
+    bool screen = page_start >= VIDEO_RAM_START && page_start < VIDEO_RAM_END;
+    if (page_start < start) page_start = start;
+    if (page_end > end) page_end = end;
+
+    bool modified = false;
+    for (int addr = page_start; addr < page_end; ++addr) {
+      uint8_t data = ctx->read_memory(addr);
+      if (memory_snapshot[addr] != data) {
+        memory_snapshot[addr] = data;
+        modified = true;
+      }
+    }
+    bool send = force_update || modified || memory_page_modified[page];
+    memory_page_modified[page] = modified;
 
-  get_memory_segment(param_start, param_length, &memory_query_cache,
-                     force_update);
-  const TRX_MemorySegment* seg = &memory_query_cache;
-
-  // // Add start metadata.
-  uint8_t* data_to_send = (uint8_t*) malloc(sizeof(uint8_t) * (seg->range.length + 2));
-  uint8_t param_start_1 = (seg->range.start & 0xFF00) >> 8;
-  uint8_t param_start_2 = seg->range.start & 0x00FF;
-  data_to_send[0] = param_start_1;
-  data_to_send[1] = param_start_2;
-  // printf("Start param pieces: %d %d\n", param_start_1, param_start_2);
-  memcpy(data_to_send + 2, seg->data, seg->range.length);
+    if (run_start >= 0 && (!send || screen != run_screen)) {
+      send_memory_frame(run_start, page_start - run_start);
+      run_start = -1;
+    }
+    if (send && run_start < 0) {
+      run_start = page_start;
+      run_screen = screen;
+    }
+  }
+  if (run_start >= 0) {
+    send_memory_frame(run_start, end - run_start);
+  }
+}
 
-  // Send registers.
-  mg_ws_send(status_conn, (const char*)data_to_send, seg->range.length + 2, WEBSOCKET_OP_BINARY);
-  free(data_to_send);
+// Sends the requested range, which is also the range kept up to date while
+// the emulation runs.
+static void get_memory(int start, int length) {
+  watch_start = start;
+  watch_end = start + length;
+  send_memory_range(watch_start, watch_end, false);
 }
 
-// Params: [address in decimal]. e.g. "1254"
-static void add_breakpoint(const char* params, TRX_BREAK_TYPE type) {
-  int addr = atoi(params);
-  if (addr == 0 && strcmp("0", params) != 0) {
-    puts("[TRX] Error: Cannot parse address.");
+// Params: [start]/[length], e.g. "0/65536", or "force_update" for the whole
+// memory range.
+static void send_memory_segment(const char* params) {
+  if (strcmp("force_update", params) == 0) {
+    send_memory_range(0, 0x10000, true);
+    return;
+  }
+  int param_start, param_length;
+  if (sscanf(params, "%d/%d", &param_start, &param_length) != 2) {
+    puts("[TRX] Error: Cannot parse memory range.");
     return;
   }
+  get_memory(param_start, param_length);
+}
 
+static void add_breakpoint_at(int addr, TRX_BREAK_TYPE type) {
   int id = 0;
   for (id = 0; id < max_breakpoints_; ++id) {
     if (!breakpoints_[id].enabled) break;
@@ -257,6 +446,16 @@ static void add_breakpoint(const char* params, TRX_BREAK_TYPE type) {
   send_update_to_web_debugger();
 }
 
+// Params: [address in decimal]. e.g. "1254"
+static void add_breakpoint(const char* params, TRX_BREAK_TYPE type) {
+  int addr = atoi(params);
+  if (addr == 0 && strcmp("0", params) != 0) {
+    puts("[TRX] Error: Cannot parse address.");
+    return;
+  }
+  add_breakpoint_at(addr, type);
+}
+
 static void remove_breakpoint_with_id(int id) {
   if (id >= max_breakpoints_) {
     puts("[TRX] Error: Breakpoint ID too large.");
@@ -288,11 +487,16 @@ static void clear_breakpoints() {
 
 
 static void key_event(const char* params) {
-  printf("Key Event: '%s'\n", params);
-  // bool down = params[0] == '1';
-  // bool shift = params[2] == '1';
-  // const char* key = params + 4;
-  // TODO: Pipe into SDL keyboard queue.
+  // Format: "<down>/<shift>/<key>", e.g. "1/0/a".
+  if (strlen(params) < 5 || params[1] != '/' || params[3] != '/') {
+    printf("[TRX] Error: Cannot parse key event: '%s'\n", params);
+    return;
+  }
+  if (ctx->key_event == NULL) {
+    puts("[TRX] WARNING: Key events are not supported.");
+    return;
+  }
+  ctx->key_event(params + 4, params[0] == '1', params[2] == '1');
 }
 
 static bool handle_http_request(struct mg_connection *conn,
@@ -309,6 +513,15 @@ static bool handle_http_request(struct mg_connection *conn,
   } else if (mg_http_match_uri(message, "/channel")) {
 		mg_ws_upgrade(conn, message, NULL);
 		status_conn = conn;
+		// A new frontend has none of the memory and registers yet.
+		memory_snapshot_valid = false;
+		free(last_registers_json);
+		last_registers_json = NULL;
+		last_state_length = 0;
+		binary_protocol = false;
+		batch_length = 0;
+		watch_start = 0;
+		watch_end = 0x10000;
   } else {
     // Resource not found.
     mg_http_reply(conn, 404, "Content-Type: text/html\r\nConnection: close\r\n", "");
@@ -407,11 +620,13 @@ static void on_frontend_message(const char* msg) {
     add_breakpoint(msg + 25, TRX_BREAK_PC);
   } else if (strncmp("action/add_breakpoint/mem", msg, 25) == 0) {
     add_breakpoint(msg + 26, TRX_BREAK_MEMORY);
+  } else if (strncmp("action/add_breakpoint/io", msg, 24) == 0) {
+    add_breakpoint(msg + 25, TRX_BREAK_IO);
   } else if (strncmp("action/remove_breakpoint", msg, 24) == 0) {
     remove_breakpoint(msg + 25);
   } else if (strcmp("action/clear_breakpoints", msg) == 0) {
     clear_breakpoints();
-  } else if (strncmp("action/key_event", msg, 16) == 0) {
+  } else if (strncmp("action/key_event/", msg, 17) == 0) {
     key_event(msg + 17);
   } else if (strncmp("action/inject_demo", msg, 16) == 0) {
     inject_demo_program();
@@ -420,6 +635,95 @@ static void on_frontend_message(const char* msg) {
   }
 }
 
+static uint16_t get_u16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// A command of the binary protocol, see TRX_Command.
+static void on_frontend_command(const uint8_t* cmd, size_t length) {
+  // Length of the arguments of each command, up to TRX_CMD_INJECT_DEMO.
+  static const size_t arg_length[] = {
+    0, 0, 0, 0, 0, 0, 0, 6, 0, 3, 3, 2, 0, 2, 0
+  };
+
+  if (length == 0 || cmd[0] >= sizeof(arg_length) / sizeof(arg_length[0]) ||
+      length - 1 < arg_length[cmd[0]]) {
+    printf("[TRX] WARNING: Bad command of %d bytes.\n", (int) length);
+    return;
+  }
+  const uint8_t* args = cmd + 1;
+  switch (cmd[0]) {
+  case TRX_CMD_REFRESH:
+    send_update_to_web_debugger();
+    break;
+  case TRX_CMD_STEP:
+    ctx->control_callback(TRX_CONTROL_TYPE_STEP);
+    send_update_to_web_debugger();
+    break;
+  case TRX_CMD_CONTINUE:
+    // Running is done asynchronously to not block the main TRX thread.
+    next_async_action = TRX_CONTROL_TYPE_CONTINUE;
+    break;
+  case TRX_CMD_STOP:
+    ctx->control_callback(TRX_CONTROL_TYPE_HALT);
+    break;
+  case TRX_CMD_SOFT_RESET:
+    ctx->control_callback(TRX_CONTROL_TYPE_SOFT_RESET);
+    break;
+  case TRX_CMD_HARD_RESET:
+    ctx->control_callback(TRX_CONTROL_TYPE_HARD_RESET);
+    break;
+  case TRX_CMD_GET_MEMORY:
+    get_memory(get_u16(args), get_u32(args + 2));
+    break;
+  case TRX_CMD_FORCE_MEMORY:
+    send_memory_range(0, 0x10000, true);
+    break;
+  case TRX_CMD_SET_MEMORY:
+    ctx->write_memory(get_u16(args), args[2]);
+    break;
+  case TRX_CMD_ADD_BREAKPOINT:
+    if (args[0] > TRX_BREAK_IO) {
+      puts("[TRX] Error: Unknown breakpoint type.");
+      break;
+    }
+    add_breakpoint_at(get_u16(args + 1), args[0]);
+    break;
+  case TRX_CMD_REMOVE_BREAKPOINT:
+    remove_breakpoint_with_id(get_u16(args));
+    break;
+  case TRX_CMD_CLEAR_BREAKPOINTS:
+    clear_breakpoints();
+    break;
+  case TRX_CMD_KEY_EVENT: {
+    char key[16];
+    size_t key_length = length - 3;
+
+    if (key_length == 0 || key_length >= sizeof(key)) {
+      puts("[TRX] Error: Bad key event.");
+      break;
+    }
+    if (ctx->key_event == NULL) {
+      puts("[TRX] WARNING: Key events are not supported.");
+      break;
+    }
+    memcpy(key, args + 2, key_length);
+    key[key_length] = '\0';
+    ctx->key_event(key, args[0] != 0, args[1] != 0);
+    break;
+  }
+  case TRX_CMD_INJECT_DEMO:
+    inject_demo_program();
+    break;
+  default:
+    printf("[TRX] WARNING: Unknown command: %d\n", cmd[0]);
+  }
+}
+
 static void www_handler(struct mg_connection *conn,
                         int ev, void *ev_data, void *fn_data) {
   switch(ev) {
@@ -428,11 +732,21 @@ static void www_handler(struct mg_connection *conn,
 		break;
 	}
   case MG_EV_WS_MSG: {
-    static char message[50];
     struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
-    strncpy(message, wm->data.ptr, wm->data.len);
-    message[wm->data.len] = '\0';
-    on_frontend_message(message);
+    if ((wm->flags & WEBSOCKET_FLAGS_MASK_OP) == WEBSOCKET_OP_BINARY) {
+      binary_protocol = true;
+      on_frontend_command((const uint8_t*) wm->data.ptr, wm->data.len);
+    } else {
+      char* message = malloc(wm->data.len + 1);
+      if (message == NULL) {
+        puts("[TRX] Error: Out of memory for frontend message.");
+        break;
+      }
+      memcpy(message, wm->data.ptr, wm->data.len);
+      message[wm->data.len] = '\0';
+      on_frontend_message(message);
+      free(message);
+    }
     break;
   }
 	case MG_EV_CLOSE: {
@@ -444,6 +758,25 @@ static void www_handler(struct mg_connection *conn,
 	}
 }
 
+// Tells the frontend where the emulation stopped and which breakpoint, if
+// any, is at that address.
+static void send_stopped() {
+  TRX_SystemState state;
+  ctx->get_state_update(&state);
+  uint16_t id = 0xFFFF;
+  for (int i = 0; i < max_breakpoints_; ++i) {
+    if (breakpoints_[i].enabled && breakpoints_[i].type == TRX_BREAK_PC &&
+        breakpoints_[i].address == state.registers.pc) {
+      id = i;
+      break;
+    }
+  }
+  batch_begin_record(TRX_MSG_STOPPED);
+  batch_put_u16(state.registers.pc);
+  batch_put_u16(id);
+  batch_end_record();
+}
+
 static void handleDynamicUpdate() {
   // We want to send one last update when the running emulation shut down so
   // that the frontend has the latest state.
@@ -456,8 +789,14 @@ static void handleDynamicUpdate() {
   uint32_t diff_millis = now_millis - last_update_sent;
 
   if (diff_millis < 40 && !emulation_is_halting) return;
-  send_update_to_web_debugger();
-  send_memory_segment("0/65536");
+  send_registers(true);
+  send_memory_range(watch_start, watch_end, false);
+  if (watch_end <= VIDEO_RAM_START || watch_start >= VIDEO_RAM_END) {
+    send_memory_range(VIDEO_RAM_START, VIDEO_RAM_END, false);
+  }
+  if (emulation_is_halting && binary_protocol && status_conn != NULL) {
+    send_stopped();
+  }
   last_update_sent = now_millis;
   emulation_is_halting = false;
 }
@@ -466,6 +805,7 @@ static int www_looper(void *ptr) {
   while (trx_running) {
     mg_mgr_poll(&www_mgr, 40);
     handleDynamicUpdate();
+    flush_batch();
   }
   mg_mgr_free(&www_mgr);
   return 0;
@@ -58,10 +58,17 @@
  * have not implemented.
  */
 
+#ifndef Z80_STANDALONE
 #include "error.h"
 #include "trs.h"
 #include "trs_imp_exp.h"
+#include "trs_perf.h"
+#include "trs_profile.h"
+#include "trs_script.h"
 #include "trs_state_save.h"
+#include "trs_trace.h"
+#include "trs_video.h"
+#endif
 #include "z80.h"
 
 extern void trs_timer_sync_with_host(void);
@@ -3080,6 +3087,10 @@ static int do_ED_instruction(void)
 }
 
 int trs_continuous;
+#ifdef ZBX
+/* Per-address breakpoint flags, NULL when no breakpoints are armed */
+Uint8 *z80_breakpoints;
+#endif
 
 int z80_run(int continuous)
      /*
@@ -3092,6 +3103,8 @@ int z80_run(int continuous)
     Uint16 address; /* generic temps */
     int ret = 0;
     tstate_t t_delta;
+    int profile_pc = 0, profile_sp = 0;
+    tstate_t profile_t = 0;
     trs_continuous = continuous;
 
     /* loop to do a z80 instruction */
@@ -3103,15 +3116,42 @@ int z80_run(int continuous)
 	  t_delta = last_t_count - z80_state.t_count;
 
 	if (t_delta >= cycles_per_timer) {
+	  Uint32 event_start = trs_perf_time();
+
 	  trs_get_event(0);
 	  if (trs_paused) {
+	    Uint32 paused = trs_perf_time();
+
 	    while (trs_paused)
 	      trs_get_event(1);
+	    /* Count neither the pause as event time nor in the second */
+	    paused = trs_perf_time() - paused;
+	    event_start += paused;
+	    trs_perf_pause(paused);
 	  }
+	  trs_perf.event_us += trs_perf_time() - event_start;
 	  trs_timer_sync_with_host();
+	  trs_perf_tick();
+	  if (trs_video)
+	    trs_video_frame();
+	  trs_fork_check();
+	  trs_script_tick();
 	  last_t_count = z80_state.t_count;
 	}
 
+	if (Z80_PC == trs_script_pc)
+	  trs_script_pc_reached();
+
+	if (trs_trace)
+	  trs_trace_instruction();
+
+	if (trs_profile) {
+	  profile_pc = Z80_PC;
+	  profile_sp = Z80_SP;
+	  profile_t = z80_state.t_count;
+	}
+
+	trs_perf.instructions++;
 	Z80_R++;
 	instruction = mem_read(Z80_PC++);
 
@@ -4391,6 +4431,10 @@ int z80_run(int continuous)
 	    error("unsupported instruction");
 	}
 
+	if (trs_profile)
+	  trs_profile_instruction(profile_pc, instruction, profile_sp,
+	      z80_state.t_count - profile_t);
+
 	/* Event scheduler */
 	if (z80_state.sched &&
 	    (z80_state.sched - z80_state.t_count > TSTATE_T_MID)) {
@@ -4409,6 +4453,7 @@ int z80_run(int continuous)
 		    Z80_PC++;
 		}
 	        do_nmi();
+	        if (trs_profile) trs_profile_call(Z80_PC);
 	        z80_state.nmi_seen = TRUE;
                 if (trs_model == 1) {
 		  /* Simulate releasing the pushbutton here; ugh. */
@@ -4424,8 +4469,14 @@ int z80_run(int continuous)
 		    Z80_PC++;
 		}
 	        do_int();
+	        if (trs_profile) trs_profile_call(Z80_PC);
 	    }
 	}
+#ifdef ZBX
+	/* Stop before the next fetch if it hits a breakpoint */
+	if (z80_breakpoints != NULL && z80_breakpoints[Z80_PC])
+	    break;
+#endif
     } while (trs_continuous > 0);
     return ret;
 }
@@ -43,7 +43,9 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <sys/time.h>
+#ifndef Z80_STANDALONE
 #include <SDL_types.h>
+#endif
 
 #ifndef TRUE
 #define TRUE	(1)
@@ -251,6 +253,7 @@ extern unsigned int cycles_per_timer;
 extern void z80_reset(void);
 extern int z80_run(int continuous);
 extern int mem_read(int address);
+extern int mem_peek(int address);
 extern void mem_write(int address, int value);
 extern void mem_write_rom(unsigned int address, int value);
 extern int mem_read_word(int address);
@@ -261,7 +264,15 @@ extern void z80_out(int port, int value);
 extern int z80_in(int port);
 
 #ifdef ZBX
+#define MEM_WATCH_READ	(0x1)
+#define MEM_WATCH_WRITE	(0x2)
+/* Watched accesses per 256-byte page, checked by mem_read and mem_write */
+extern Uint8 mem_watch_pages[256];
+extern void debug_watch(int address, int value, int access);
+extern void debug_io(int port, int value, int access);
+extern Uint8 *z80_breakpoints;
 extern int disassemble(Uint16 pc);
+extern int disassemble_to(FILE *file, Uint16 pc, int (*read_byte)(int address));
 extern void debug_init(void);
 extern void debug_shell(void);
 #endif /* ZBX */
@@ -0,0 +1,900 @@
+/*
+ * z80bench.c -- benchmark and conformance test for the Z80 core
+ *
+ * Usage: z80bench [-c] [-s seconds] [program.com ...]
+ *
+ * Builds z80.c against 64K of flat RAM, without SDL or the rest of the
+ * emulator, and runs three kinds of checks:
+ *
+ *   timing     T-states of the documented instructions against the data
+ *              sheet, with conditional jumps, calls, returns and block
+ *              repeats taken and not taken; the known deviations of the
+ *              core are reported separately and don't fail the check
+ *   exercise   a hash of the registers, flags, memory operands and T-states
+ *              after each instruction of a group over a range of operands,
+ *              compared with a regression baseline recorded from this core
+ *   benchmark  synthetic workloads timed on the host, reported in
+ *              instructions and T-states per second
+ *
+ * With -c only the checks are run.  Programs given on the command line
+ * are run as CP/M .COM files with the console BDOS calls, so instruction
+ * exercisers like ZEXDOC and ZEXALL can be used unmodified.  The exit
+ * status is non-zero if any check fails or a program prints "ERROR".
+ *
+ * The baselines only catch changes in behaviour, not errors the core
+ * already had: correctness is up to the timing check and the exercisers.
+ * After a change to the core that is meant to alter the results of an
+ * exercise group, update its baseline from the output of this program.
+ */
+
+#ifdef ZBX
+#undef ZBX
+#endif
+#define Z80_STANDALONE	/* z80.c without the emulator and SDL headers */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t Uint8;
+typedef int8_t Sint8;
+typedef uint16_t Uint16;
+typedef int16_t Sint16;
+typedef uint32_t Uint32;
+typedef int32_t Sint32;
+typedef uint64_t Uint64;
+typedef int64_t Sint64;
+
+#include "z80.h"
+
+#define CODE		0x8000	/* where single instructions are placed */
+#define STACK		0xF000
+#define BDOS_PORT	0xFE
+
+static Uint8 ram[Z80_ADDRESS_LIMIT];
+static int in_value;
+static int cpm_running;
+static int cpm_errors;
+static int failures;
+
+/*
+ * Stubs for the parts of the emulator the core calls into
+ */
+
+unsigned int cycles_per_timer = 50000;	/* about 40 Hz at 2 MHz */
+int trs_model = 1;			/* HALT resets, which stops the run */
+int trs_paused;
+int trs_script_pc = -1;
+int trs_profile;
+int trs_trace;
+int trs_video;
+struct {
+  Uint64 instructions;
+  Uint32 event_us;
+} trs_perf;				/* the counters the core updates */
+extern int trs_continuous;		/* defined in z80.c */
+
+int mem_read(int address)
+{
+  return ram[address & 0xffff];
+}
+
+void mem_write(int address, int value)
+{
+  ram[address & 0xffff] = value;
+}
+
+int mem_read_word(int address)
+{
+  return ram[address & 0xffff] | (ram[(address + 1) & 0xffff] << 8);
+}
+
+void mem_write_word(int address, int value)
+{
+  ram[address & 0xffff] = value & 0xff;
+  ram[(address + 1) & 0xffff] = value >> 8;
+}
+
+static void cpm_putchar(int c)
+{
+  static const char error_text[] = "ERROR";
+  static unsigned int matched;
+
+  putchar(c);
+  if (c == error_text[matched]) {
+    if (++matched == sizeof(error_text) - 1) {
+      cpm_errors++;
+      matched = 0;
+    }
+  } else {
+    matched = (c == error_text[0]);
+  }
+}
+
+/* The console calls of the CP/M BDOS, entered through an OUT */
+static void bdos(void)
+{
+  int address;
+
+  switch (Z80_C) {
+    case 0:
+      trs_continuous = 0;
+      break;
+    case 2:
+      cpm_putchar(Z80_E);
+      break;
+    case 9:
+      for (address = Z80_DE; ram[address] != '$'; address = (address + 1) & 0xffff)
+        cpm_putchar(ram[address]);
+      break;
+  }
+  fflush(stdout);
+}
+
+void z80_out(int port, int value)
+{
+  if (cpm_running && port == BDOS_PORT)
+    bdos();
+}
+
+int z80_in(int port)
+{
+  return in_value;
+}
+
+void trs_reset(int poweron)
+{
+  trs_continuous = 0;
+}
+
+void trs_do_event(void)
+{
+  z80_state.sched = 0;
+  trs_continuous = 0;
+}
+
+void error(const char *fmt, ...)
+{
+  va_list args;
+
+  va_start(args, fmt);
+  fprintf(stderr, "z80bench: ");
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  failures++;
+}
+
+void trs_get_event(int wait) { }
+void trs_timer_sync_with_host(void) { }
+void trs_fork_check(void) { }
+void trs_script_tick(void) { }
+void trs_script_pc_reached(void) { }
+void trs_reset_button_interrupt(int state) { }
+Uint32 trs_perf_time(void) { return 0; }
+void trs_perf_tick(void) { }
+void trs_perf_pause(Uint32 paused_us) { }
+void trs_profile_instruction(int pc, int opcode, int sp, tstate_t t) { }
+void trs_profile_call(int routine) { }
+void trs_trace_instruction(void) { }
+void trs_video_frame(void) { }
+
+void trs_save_uchar(FILE *file, Uint8 *buffer, int count) { }
+void trs_load_uchar(FILE *file, Uint8 *buffer, int count) { }
+void trs_save_uint16(FILE *file, Uint16 *buffer, int count) { }
+void trs_load_uint16(FILE *file, Uint16 *buffer, int count) { }
+void trs_save_uint64(FILE *file, Uint64 *buffer, int count) { }
+void trs_load_uint64(FILE *file, Uint64 *buffer, int count) { }
+void trs_save_int(FILE *file, int *buffer, int count) { }
+void trs_load_int(FILE *file, int *buffer, int count) { }
+void trs_save_float(FILE *file, float *buffer, int count) { }
+void trs_load_float(FILE *file, float *buffer, int count) { }
+
+#define EMT(name) void name(void) { }
+EMT(do_emt_system) EMT(do_emt_mouse) EMT(do_emt_getddir) EMT(do_emt_setddir)
+EMT(do_emt_open) EMT(do_emt_close) EMT(do_emt_read) EMT(do_emt_write)
+EMT(do_emt_lseek) EMT(do_emt_strerror) EMT(do_emt_time) EMT(do_emt_opendir)
+EMT(do_emt_closedir) EMT(do_emt_readdir) EMT(do_emt_chdir) EMT(do_emt_getcwd)
+EMT(do_emt_misc) EMT(do_emt_ftruncate) EMT(do_emt_opendisk)
+EMT(do_emt_closedisk)
+
+#include "z80.c"
+
+/*
+ * Helpers
+ */
+
+static Uint32 host_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Put an instruction at CODE and load the registers with a fixed state */
+static void setup(const Uint8 *code, int length)
+{
+  memcpy(ram + CODE, code, length);
+  Z80_AF = 0x0000;
+  Z80_BC = 0x0001;
+  Z80_DE = 0x5000;
+  Z80_HL = 0x4000;
+  Z80_IX = 0x4080;
+  Z80_IY = 0x40C0;
+  Z80_SP = STACK;
+  Z80_PC = CODE;
+  Z80_I = 0;
+  Z80_R = 0;
+  Z80_R7 = 0;
+  z80_state.iff1 = z80_state.iff2 = 0;
+  z80_state.irq = z80_state.nmi = FALSE;
+  z80_state.sched = 0;
+}
+
+/* Execute one instruction and return its T-states */
+static int step(void)
+{
+  tstate_t start = z80_state.t_count;
+
+  z80_run(-1);
+  return (int)(z80_state.t_count - start);
+}
+
+/*
+ * Timing
+ */
+
+/* T-states of the data sheet */
+
+/* Unprefixed instructions, conditional ones not taken; 0 is not tested */
+static const Uint8 base_tstates[256] = {
+   4, 10,  7,  6,  4,  4,  7,  4,  4, 11,  7,  6,  4,  4,  7,  4,
+   8, 10,  7,  6,  4,  4,  7,  4, 12, 11,  7,  6,  4,  4,  7,  4,
+   7, 10, 16,  6,  4,  4,  7,  4,  7, 11, 16,  6,  4,  4,  7,  4,
+   7, 10, 13,  6, 11, 11, 10,  4,  7, 11, 13,  6,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   7,  7,  7,  7,  7,  7,  0,  7,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+   5, 10, 10, 10, 10, 11,  7, 11,  5, 10, 10,  0, 10, 17,  7, 11,
+   5, 10, 10, 11, 10, 11,  7, 11,  5,  4, 10, 11, 10,  0,  7, 11,
+   5, 10, 10, 19, 10, 11,  7, 11,  5,  4, 10,  4, 10,  0,  7, 11,
+   5, 10, 10,  4, 10, 11,  7, 11,  5,  6, 10,  4, 10,  0,  7, 11,
+};
+
+typedef struct {
+  Uint8 op;
+  Uint8 tstates;
+} Timing;
+
+static const Timing ed_tstates[] = {
+  { 0x40, 12 }, { 0x41, 12 }, { 0x42, 15 }, { 0x43, 20 }, { 0x44,  8 },
+  { 0x45, 14 }, { 0x46,  8 }, { 0x47,  9 }, { 0x48, 12 }, { 0x49, 12 },
+  { 0x4A, 15 }, { 0x4B, 20 }, { 0x4D, 14 }, { 0x4F,  9 }, { 0x50, 12 },
+  { 0x51, 12 }, { 0x52, 15 }, { 0x53, 20 }, { 0x56,  8 }, { 0x57,  9 },
+  { 0x58, 12 }, { 0x59, 12 }, { 0x5A, 15 }, { 0x5B, 20 }, { 0x5E,  8 },
+  { 0x5F,  9 }, { 0x60, 12 }, { 0x61, 12 }, { 0x62, 15 }, { 0x63, 20 },
+  { 0x67, 18 }, { 0x68, 12 }, { 0x69, 12 }, { 0x6A, 15 }, { 0x6B, 20 },
+  { 0x6F, 18 }, { 0x72, 15 }, { 0x73, 20 }, { 0x78, 12 }, { 0x79, 12 },
+  { 0x7A, 15 }, { 0x7B, 20 }, { 0xA0, 16 }, { 0xA1, 16 }, { 0xA2, 16 },
+  { 0xA3, 16 }, { 0xA8, 16 }, { 0xA9, 16 }, { 0xAA, 16 }, { 0xAB, 16 },
+};
+
+/* Documented IX instructions, the same for IY, and a few undocumented */
+static const Timing dd_tstates[] = {
+  { 0x09, 15 }, { 0x19, 15 }, { 0x21, 14 }, { 0x22, 20 }, { 0x23, 10 },
+  { 0x24,  8 }, { 0x25,  8 }, { 0x26, 11 }, { 0x29, 15 }, { 0x2A, 20 },
+  { 0x2B, 10 }, { 0x2C,  8 }, { 0x2D,  8 }, { 0x2E, 11 }, { 0x34, 23 },
+  { 0x35, 23 }, { 0x36, 19 }, { 0x39, 15 }, { 0x46, 19 }, { 0x4E, 19 },
+  { 0x56, 19 }, { 0x5E, 19 }, { 0x66, 19 }, { 0x6E, 19 }, { 0x70, 19 },
+  { 0x71, 19 }, { 0x72, 19 }, { 0x73, 19 }, { 0x74, 19 }, { 0x75, 19 },
+  { 0x77, 19 }, { 0x7C,  8 }, { 0x7D,  8 }, { 0x7E, 19 }, { 0x84,  8 },
+  { 0x85,  8 }, { 0x86, 19 }, { 0x8E, 19 }, { 0x96, 19 }, { 0x9E, 19 },
+  { 0xA6, 19 }, { 0xAE, 19 }, { 0xB6, 19 }, { 0xBE, 19 }, { 0xE1, 14 },
+  { 0xE3, 23 }, { 0xE5, 15 }, { 0xE9,  8 }, { 0xF9, 10 },
+};
+
+static const Uint8 cc_masks[4] = {
+  ZERO_MASK, CARRY_MASK, PARITY_MASK, SIGN_MASK
+};
+
+static int timing_checked;
+static int timing_deviations;
+
+/*
+ * Known deviation of the core from the data sheet: it charges the
+ * instructions that read a port, and the block I/O instructions, one
+ * T-state less.  Remove this once the core is fixed.
+ */
+static int known_deviation(const Uint8 *code)
+{
+  if (code[0] == 0xDB)				/* in a,(n) */
+    return -1;
+  if (code[0] == 0xED && ((code[1] & 0xC7) == 0x40 ||	/* in r,(c) */
+                          (code[1] & 0xE6) == 0xA2))	/* ini...otdr */
+    return -1;
+  return 0;
+}
+
+static void check_timing(const Uint8 *code, int length, int flags, int bc,
+                         int a, int expected)
+{
+  int deviation = known_deviation(code);
+  int tstates;
+  int i;
+
+  setup(code, length);
+  Z80_F = flags;
+  Z80_BC = bc;
+  Z80_A = a;
+  tstates = step();
+  timing_checked++;
+  if (tstates == expected)
+    return;
+  printf("timing: ");
+  for (i = 0; i < length; i++)
+    printf("%02x ", code[i]);
+  printf("took %d T-states, expected %d", tstates, expected);
+  if (deviation != 0 && tstates == expected + deviation) {
+    printf(" (known deviation)\n");
+    timing_deviations++;
+  } else {
+    printf("\n");
+    failures++;
+  }
+}
+
+/* Flags that make condition cc true or false */
+static int cc_flags(int cc, int taken)
+{
+  int mask = cc_masks[cc >> 1];
+
+  return ((cc & 1) != 0) == (taken != 0) ? mask : 0;
+}
+
+static void test_timing(void)
+{
+  Uint8 code[4];
+  int before = failures;
+  int i, op;
+
+  memset(code, 0, sizeof(code));
+  for (op = 0; op < 256; op++) {
+    if (base_tstates[op] == 0)
+      continue;
+    code[0] = op;
+    if ((op & 0xC7) == 0xC0 || (op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4) {
+      int cc = (op >> 3) & 7;
+
+      check_timing(code, 1, cc_flags(cc, 0), 0x0001, 0, base_tstates[op]);
+      check_timing(code, 1, cc_flags(cc, 1), 0x0001, 0,
+                   (op & 7) == 0 ? 11 : (op & 7) == 2 ? 10 : 17);
+    } else if ((op & 0xE7) == 0x20) {
+      int cc = (op >> 3) & 3;
+
+      check_timing(code, 1, cc_flags(cc, 0), 0x0001, 0, 7);
+      check_timing(code, 1, cc_flags(cc, 1), 0x0001, 0, 12);
+    } else if (op == 0x10) {
+      check_timing(code, 1, 0, 0x0100, 0, 8);
+      check_timing(code, 1, 0, 0x0200, 0, 13);
+    } else {
+      check_timing(code, 1, 0, 0x0001, 0, base_tstates[op]);
+    }
+  }
+
+  code[0] = 0xCB;
+  for (op = 0; op < 256; op++) {
+    code[1] = op;
+    check_timing(code, 2, 0, 0x0001, 0,
+                 (op & 7) != 6 ? 8 : (op & 0xC0) == 0x40 ? 12 : 15);
+  }
+
+  code[0] = 0xED;
+  for (i = 0; i < (int)(sizeof(ed_tstates) / sizeof(ed_tstates[0])); i++) {
+    code[1] = ed_tstates[i].op;
+    check_timing(code, 2, 0, 0x0001, 0, ed_tstates[i].tstates);
+  }
+  /* Block repeats: ld/cp count BC, in/out count B */
+#ifndef FAST_MOVE
+  code[1] = 0xB0; check_timing(code, 2, 0, 0x0002, 0x55, 21);
+  code[1] = 0xB8; check_timing(code, 2, 0, 0x0002, 0x55, 21);
+  code[1] = 0xB2; check_timing(code, 2, 0, 0x0201, 0x55, 21);
+  code[1] = 0xB3; check_timing(code, 2, 0, 0x0201, 0x55, 21);
+  code[1] = 0xBA; check_timing(code, 2, 0, 0x0201, 0x55, 21);
+  code[1] = 0xBB; check_timing(code, 2, 0, 0x0201, 0x55, 21);
+  code[1] = 0xB1; check_timing(code, 2, 0, 0x0002, 0x55, 21);
+  code[1] = 0xB9; check_timing(code, 2, 0, 0x0002, 0x55, 21);
+#endif
+  code[1] = 0xB0; check_timing(code, 2, 0, 0x0001, 0x55, 16);
+  code[1] = 0xB8; check_timing(code, 2, 0, 0x0001, 0x55, 16);
+  code[1] = 0xB1; check_timing(code, 2, 0, 0x0001, 0x55, 16);
+  code[1] = 0xB9; check_timing(code, 2, 0, 0x0001, 0x55, 16);
+  code[1] = 0xB2; check_timing(code, 2, 0, 0x0101, 0x55, 16);
+  code[1] = 0xB3; check_timing(code, 2, 0, 0x0101, 0x55, 16);
+  code[1] = 0xBA; check_timing(code, 2, 0, 0x0101, 0x55, 16);
+  code[1] = 0xBB; check_timing(code, 2, 0, 0x0101, 0x55, 16);
+
+  for (code[0] = 0xDD; ; code[0] = 0xFD) {
+    for (i = 0; i < (int)(sizeof(dd_tstates) / sizeof(dd_tstates[0])); i++) {
+      code[1] = dd_tstates[i].op;
+      check_timing(code, 4, 0, 0x0001, 0, dd_tstates[i].tstates);
+    }
+    code[1] = 0xCB;
+    code[2] = 0x05;
+    for (op = 0; op < 256; op++) {
+      code[3] = op;
+      check_timing(code, 4, 0, 0x0001, 0, (op & 0xC0) == 0x40 ? 20 : 23);
+    }
+    code[2] = 0;
+    if (code[0] == 0xFD)
+      break;
+  }
+
+  printf("timing:    %d instructions, %d wrong, %d known deviations\n",
+         timing_checked, failures - before, timing_deviations);
+}
+
+/*
+ * Exercise groups
+ */
+
+static Uint32 hash;
+
+static void fold(Uint32 value)
+{
+  hash = (hash ^ value) * 16777619;	/* FNV-1a */
+}
+
+static void exercise(void)
+{
+  int tstates = step();
+
+  fold(Z80_AF);
+  fold(Z80_BC);
+  fold(Z80_DE);
+  fold(Z80_HL);
+  fold(Z80_IX);
+  fold(Z80_IY);
+  fold(Z80_SP);
+  fold(Z80_PC);
+  fold(Z80_R & 0x7F);
+  fold(ram[0x4000]);
+  fold(ram[0x4085]);
+  fold(ram[0x5000]);
+  fold(tstates);
+}
+
+/* Operands that exercise carries out of both bytes of a word */
+static int word_operand(int i)
+{
+  return (i << 8) | ((i * 37 + 11) & 0xFF);
+}
+
+static void exercise_alu(void)
+{
+  static const Uint8 ops[] = { 0x80, 0x88, 0x90, 0x98, 0xA0, 0xA8, 0xB0, 0xB8 };
+  Uint8 code[1];
+  int i, a, v, f;
+
+  for (i = 0; i < (int)sizeof(ops); i++)
+    for (a = 0; a < 256; a++)
+      for (v = 0; v < 256; v++)
+        for (f = 0; f < 256; f += 255) {
+          code[0] = ops[i];
+          setup(code, 1);
+          Z80_A = a;
+          Z80_B = v;
+          Z80_F = f;
+          exercise();
+        }
+}
+
+static void exercise_alu_indexed(void)
+{
+  Uint8 code[3];
+  int op, a, v;
+
+  code[0] = 0xDD;
+  code[2] = 0x05;
+  for (op = 0x86; op < 0xC0; op += 8)
+    for (a = 0; a < 256; a++)
+      for (v = 0; v < 256; v++) {
+        code[1] = op;
+        setup(code, 3);
+        Z80_A = a;
+        Z80_F = (a & 1) ? 0xFF : 0x00;
+        ram[0x4085] = v;
+        exercise();
+      }
+}
+
+static void exercise_inc_dec(void)
+{
+  static const Uint8 ops[][3] = {
+    { 0x04 }, { 0x05 }, { 0x34 }, { 0x35 },
+    { 0xDD, 0x34, 0x05 }, { 0xDD, 0x35, 0x05 }, { 0xDD, 0x24 }, { 0xDD, 0x2D }
+  };
+  int i, v, f;
+
+  for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    for (v = 0; v < 256; v++)
+      for (f = 0; f < 256; f += 255) {
+        setup(ops[i], 3);
+        Z80_B = v;
+        Z80_IX_HIGH = v;
+        Z80_IX_LOW = v ^ 0x80;
+        Z80_F = f;
+        ram[0x4000] = v;
+        ram[0x4085] = v;
+        exercise();
+      }
+}
+
+static void exercise_accumulator(void)
+{
+  static const Uint8 ops[][2] = {
+    { 0x27 }, { 0x2F }, { 0x37 }, { 0x3F }, { 0xED, 0x44 },
+    { 0x07 }, { 0x0F }, { 0x17 }, { 0x1F }
+  };
+  int i, af;
+
+  for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    for (af = 0; af < 0x10000; af++) {
+      setup(ops[i], 2);
+      Z80_AF = af;
+      exercise();
+    }
+}
+
+static void exercise_shift(void)
+{
+  Uint8 code[4];
+  int op, v, f;
+
+  for (op = 0; op < 0x40; op++) {
+    if ((op & 7) != 0 && (op & 7) != 6)
+      continue;
+    for (v = 0; v < 256; v++)
+      for (f = 0; f < 256; f += 255) {
+        code[0] = 0xCB;
+        code[1] = op;
+        setup(code, 2);
+        Z80_B = v;
+        Z80_F = f;
+        ram[0x4000] = v;
+        exercise();
+        if ((op & 7) == 6) {
+          code[0] = 0xDD;
+          code[1] = 0xCB;
+          code[2] = 0x05;
+          code[3] = op;
+          setup(code, 4);
+          Z80_F = f;
+          ram[0x4085] = v;
+          exercise();
+        }
+      }
+  }
+}
+
+static void exercise_bit(void)
+{
+  Uint8 code[4];
+  int op, v, f;
+
+  for (op = 0x40; op < 0x100; op++)
+    for (v = 0; v < 256; v++)
+      for (f = 0; f < 256; f += 255) {
+        code[0] = 0xCB;
+        code[1] = op;
+        setup(code, 2);
+        Z80_B = v;
+        Z80_F = f;
+        ram[0x4000] = v;
+        exercise();
+        if ((op & 0xC7) == 0x46) {
+          code[0] = 0xDD;
+          code[1] = 0xCB;
+          code[2] = 0x05;
+          code[3] = op;
+          setup(code, 4);
+          Z80_F = f;
+          ram[0x4085] = v;
+          exercise();
+        }
+      }
+}
+
+static void exercise_word(void)
+{
+  static const Uint8 ops[][2] = {
+    { 0x09 }, { 0xED, 0x4A }, { 0xED, 0x42 }, { 0xDD, 0x09 }
+  };
+  int i, x, y, f;
+
+  for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    for (x = 0; x < 256; x++)
+      for (y = 0; y < 256; y++)
+        for (f = 0; f < 256; f += 255) {
+          setup(ops[i], 2);
+          Z80_HL = word_operand(x);
+          Z80_IX = word_operand(x);
+          Z80_BC = word_operand(y);
+          Z80_F = f;
+          exercise();
+        }
+}
+
+static void exercise_rld(void)
+{
+  static const Uint8 ops[][2] = { { 0xED, 0x67 }, { 0xED, 0x6F } };
+  int i, a, v;
+
+  for (i = 0; i < 2; i++)
+    for (a = 0; a < 256; a++)
+      for (v = 0; v < 256; v++) {
+        setup(ops[i], 2);
+        Z80_A = a;
+        Z80_F = (v & 1) ? 0xFF : 0x00;
+        ram[0x4000] = v;
+        exercise();
+      }
+}
+
+static void exercise_block(void)
+{
+  static const Uint8 ops[][2] = {
+    { 0xED, 0xA0 }, { 0xED, 0xA8 }, { 0xED, 0xA1 }, { 0xED, 0xA9 },
+    { 0xED, 0xA2 }, { 0xED, 0xAA }, { 0xED, 0xA3 }, { 0xED, 0xAB }
+  };
+  int i, a, v, bc;
+
+  for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    for (a = 0; a < 256; a++)
+      for (v = 0; v < 256; v++)
+        for (bc = 1; bc <= 2; bc++) {
+          setup(ops[i], 2);
+          Z80_A = a;
+          Z80_F = (a & 1) ? 0xFF : 0x00;
+          Z80_BC = (bc << 8) | (v ^ a);
+          ram[0x4000] = v;
+          in_value = a ^ 0x5A;
+          exercise();
+        }
+}
+
+static void exercise_in(void)
+{
+  Uint8 code[2];
+  int op, v, f;
+
+  code[0] = 0xED;
+  for (op = 0x40; op < 0x80; op += 8)
+    for (v = 0; v < 256; v++)
+      for (f = 0; f < 256; f += 255) {
+        code[1] = op;
+        setup(code, 2);
+        Z80_F = f;
+        in_value = v;
+        exercise();
+      }
+}
+
+static void exercise_ld_ir(void)
+{
+  static const Uint8 ops[][2] = { { 0xED, 0x57 }, { 0xED, 0x5F } };
+  int i, v, iff, f;
+
+  for (i = 0; i < 2; i++)
+    for (v = 0; v < 256; v++)
+      for (iff = 0; iff < 2; iff++)
+        for (f = 0; f < 256; f += 255) {
+          setup(ops[i], 2);
+          Z80_I = v;
+          Z80_R = v;
+          Z80_R7 = v & 0x80;
+          z80_state.iff2 = iff;
+          Z80_F = f;
+          exercise();
+        }
+}
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+  Uint32 baseline;
+} Exercise;
+
+/*
+ * Regression baselines recorded from the core, not reference values.
+ * The T-states are part of the hash, so the block and "in" groups also
+ * record the known timing deviation and change when it is fixed.
+ */
+static const Exercise exercises[] = {
+  { "add/adc/sub/sbc/and/xor/or/cp a,r", exercise_alu,		0x222DF045 },
+  { "alu a,(ix+d)",			exercise_alu_indexed,	0xF527DE45 },
+  { "inc/dec r,(hl),(ix+d),ixh,ixl",	exercise_inc_dec,	0xE2DA50C5 },
+  { "daa/cpl/scf/ccf/neg/rlca/rrca/rla/rra", exercise_accumulator, 0xC38582C5 },
+  { "rotate/shift r,(hl),(ix+d)",	exercise_shift,		0x08956BB2 },
+  { "bit/res/set r,(hl),(ix+d)",	exercise_bit,		0x90CE9AD6 },
+  { "add/adc/sbc hl,rr and add ix,rr",	exercise_word,		0xFD011CC9 },
+  { "rld/rrd",				exercise_rld,		0x535A00C5 },
+  { "ldi/ldd/cpi/cpd/ini/ind/outi/outd", exercise_block,	0x0C8747C5 },
+  { "in r,(c)",				exercise_in,		0x271F96C5 },
+  { "ld a,i/ld a,r",			exercise_ld_ir,		0xD5F8FD45 },
+};
+
+static void test_exercises(void)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(exercises) / sizeof(exercises[0])); i++) {
+    memset(ram, 0, sizeof(ram));
+    hash = 2166136261U;
+    exercises[i].run();
+    if (hash == exercises[i].baseline) {
+      printf("exercise:  %-40s ok\n", exercises[i].name);
+    } else {
+      printf("exercise:  %-40s hash %08x, baseline %08x\n",
+             exercises[i].name, (unsigned int)hash,
+             (unsigned int)exercises[i].baseline);
+      failures++;
+    }
+  }
+  in_value = 0;
+}
+
+/*
+ * Benchmarks: endless loops, stopped by the event scheduler
+ */
+
+typedef struct {
+  const char *name;
+  Uint8 code[32];
+} Workload;
+
+static const Workload workloads[] = {
+  { "alu", {
+    0x21, 0x00, 0x40,		/* 8000 ld hl,4000h */
+    0x06, 0x00,			/* 8003 ld b,0 */
+    0x7E,			/* 8005 ld a,(hl) */
+    0x8E,			/* 8006 adc a,(hl) */
+    0x23,			/* 8007 inc hl */
+    0xA9,			/* 8008 xor c */
+    0x4F,			/* 8009 ld c,a */
+    0xCB, 0x11,			/* 800A rl c */
+    0x10, 0xF7,			/* 800C djnz 8005h */
+    0x18, 0xF0,			/* 800E jr 8000h */
+  } },
+  { "block", {
+    0x21, 0x00, 0x40,		/* 8000 ld hl,4000h */
+    0x11, 0x00, 0x50,		/* 8003 ld de,5000h */
+    0x01, 0x00, 0x04,		/* 8006 ld bc,0400h */
+    0xED, 0xB0,			/* 8009 ldir */
+    0x18, 0xF3,			/* 800B jr 8000h */
+  } },
+  { "call", {
+    0xDD, 0x21, 0x00, 0x40,	/* 8000 ld ix,4000h */
+    0x06, 0x00,			/* 8004 ld b,0 */
+    0xCD, 0x10, 0x80,		/* 8006 call 8010h */
+    0x10, 0xFB,			/* 8009 djnz 8006h */
+    0x18, 0xF3,			/* 800B jr 8000h */
+    0x00, 0x00, 0x00,
+    0xDD, 0x7E, 0x05,		/* 8010 ld a,(ix+5) */
+    0xDD, 0x86, 0x06,		/* 8013 add a,(ix+6) */
+    0xDD, 0x77, 0x07,		/* 8016 ld (ix+7),a */
+    0xC5,			/* 8019 push bc */
+    0xC1,			/* 801A pop bc */
+    0xDD, 0x23,			/* 801B inc ix */
+    0xC9,			/* 801D ret */
+  } },
+};
+
+static void benchmark(double seconds)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+    Uint32 start, elapsed;
+    Uint64 instructions;
+    tstate_t tstates;
+
+    memset(ram, 0, sizeof(ram));
+    setup(workloads[i].code, sizeof(workloads[i].code));
+    memset(&trs_perf, 0, sizeof(trs_perf));
+    tstates = z80_state.t_count;
+    start = host_time();
+    do {
+      z80_state.sched = z80_state.t_count + 10000000;
+      z80_run(1);
+      elapsed = host_time() - start;
+    } while (elapsed < seconds * 1000000);
+    instructions = trs_perf.instructions;
+    tstates = z80_state.t_count - tstates;
+    printf("benchmark: %-8s %8.2f M instructions/s %8.2f MHz %6.2f ns/instruction\n",
+           workloads[i].name, instructions / (double)elapsed,
+           tstates / (double)elapsed, elapsed * 1000.0 / instructions);
+  }
+}
+
+/*
+ * CP/M programs
+ */
+
+static int run_cpm(const char *filename)
+{
+  FILE *file;
+  Uint32 start, elapsed;
+  tstate_t tstates;
+  size_t size;
+
+  if ((file = fopen(filename, "rb")) == NULL) {
+    fprintf(stderr, "z80bench: %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  memset(ram, 0, sizeof(ram));
+  size = fread(ram + 0x100, 1, 0xFF00 - 0x100, file);
+  fclose(file);
+
+  ram[0x0000] = 0x76;			/* halt: warm boot ends the run */
+  ram[0x0005] = 0xC3;			/* jp FF00h, also the top of memory */
+  ram[0x0006] = 0x00;
+  ram[0x0007] = 0xFF;
+  ram[0xFF00] = 0xD3;			/* out (BDOS_PORT),a */
+  ram[0xFF01] = BDOS_PORT;
+  ram[0xFF02] = 0xC9;			/* ret */
+
+  setup(ram + 0x100, 0);
+  Z80_PC = 0x100;
+  Z80_SP = 0xFF00 - 2;
+  mem_write_word(Z80_SP, 0x0000);	/* ret warm boots */
+  cpm_running = 1;
+  cpm_errors = 0;
+  tstates = z80_state.t_count;
+  start = host_time();
+  z80_run(1);
+  elapsed = host_time() - start;
+  cpm_running = 0;
+  tstates = z80_state.t_count - tstates;
+  printf("\n%s: %lu bytes, %" TSTATE_T_LEN " T-states in %.2f s, %d errors\n",
+         filename, (unsigned long)size, tstates, elapsed / 1000000.0,
+         cpm_errors);
+  failures += cpm_errors;
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  double seconds = 1.0;
+  int checks_only = 0;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-c") == 0) {
+      checks_only = 1;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: z80bench [-c] [-s seconds] [program.com ...]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  z80_reset();
+  test_timing();
+  test_exercises();
+  if (!checks_only)
+    benchmark(seconds);
+  for (; i < argc; i++)
+    if (run_cpm(argv[i]) != 0)
+      failures++;
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+import { ISUT_Context, ISUT_Registers, ISUT_Breakpoint } from "./data_structures";
+
+// Binary protocol between the frontend and the emulator. See web_debugger.c
+// for the emulator side, keep both in sync. Multi-byte values are
+// little-endian.
+
+/** Commands, sent as one WebSocket message each. */
+export enum Command {
+  REFRESH = 0x01,
+  STEP = 0x02,
+  CONTINUE = 0x03,
+  STOP = 0x04,
+  SOFT_RESET = 0x05,
+  HARD_RESET = 0x06,
+  GET_MEMORY = 0x07,         // start u16, length u32
+  FORCE_MEMORY = 0x08,
+  SET_MEMORY = 0x09,         // address u16, value u8
+  ADD_BREAKPOINT = 0x0A,     // type u8, address u16
+  REMOVE_BREAKPOINT = 0x0B,  // id u16
+  CLEAR_BREAKPOINTS = 0x0C,
+  KEY_EVENT = 0x0D,          // down u8, shift u8, key (UTF-8)
+  INJECT_DEMO = 0x0E,
+}
+
+/** Record types in the batched messages from the emulator. */
+enum RecordType {
+  CONTEXT = 0x01,
+  REGISTERS = 0x02,
+  BREAKPOINTS = 0x03,
+  MEMORY = 0x04,
+  SCREEN = 0x05,
+  STOPPED = 0x06,
+}
+
+/** Breakpoint types, see TRX_BREAK_TYPE in web_debugger.h. */
+export const BREAKPOINT_TYPES: { [name: string]: number } = {
+  "pc": 0,
+  "mem": 1,
+  "io": 2,
+};
+
+/** Receives the records of a message from the emulator. */
+export interface IProtocolHandler {
+  onContext(context: ISUT_Context): void;
+  onRegisters(registers: ISUT_Registers): void;
+  onBreakpoints(breakpoints: Array<ISUT_Breakpoint>): void;
+  /** Memory starting at 'start'; 'screen' if it is within video RAM. */
+  onMemory(start: number, data: Uint8Array, screen: boolean): void;
+  /** Emulation stopped at 'pc', on the given breakpoint or -1. */
+  onStopped(pc: number, breakpointId: number): void;
+}
+
+/** Encodes a command with its arguments. */
+export function encodeCommand(command: Command, ...args: Array<number>): Uint8Array {
+  let length = 1;
+  switch (command) {
+    case Command.GET_MEMORY:
+      length += 6;
+      break;
+    case Command.SET_MEMORY:
+    case Command.ADD_BREAKPOINT:
+      length += 3;
+      break;
+    case Command.REMOVE_BREAKPOINT:
+      length += 2;
+      break;
+  }
+  const msg = new Uint8Array(length);
+  const view = new DataView(msg.buffer);
+  msg[0] = command;
+  switch (command) {
+    case Command.GET_MEMORY:
+      view.setUint16(1, args[0], true);
+      view.setUint32(3, args[1], true);
+      break;
+    case Command.SET_MEMORY:
+      view.setUint16(1, args[0], true);
+      view.setUint8(3, args[1]);
+      break;
+    case Command.ADD_BREAKPOINT:
+      view.setUint8(1, args[0]);
+      view.setUint16(2, args[1], true);
+      break;
+    case Command.REMOVE_BREAKPOINT:
+      view.setUint16(1, args[0], true);
+      break;
+  }
+  return msg;
+}
+
+/** Encodes a key event. */
+export function encodeKeyEvent(down: boolean, shift: boolean, key: string): Uint8Array {
+  const keyBytes = new TextEncoder().encode(key);
+  const msg = new Uint8Array(3 + keyBytes.length);
+  msg[0] = Command.KEY_EVENT;
+  msg[1] = down ? 1 : 0;
+  msg[2] = shift ? 1 : 0;
+  msg.set(keyBytes, 3);
+  return msg;
+}
+
+/** Parses a batched message and hands each record to the handler. */
+export function parseMessage(buffer: ArrayBuffer, handler: IProtocolHandler): void {
+  const view = new DataView(buffer);
+  const bytes = new Uint8Array(buffer);
+  let pos = 0;
+  while (pos + 5 <= bytes.length) {
+    const type = view.getUint8(pos);
+    const length = view.getUint32(pos + 1, true);
+    const start = pos + 5;
+    pos = start + length;
+    if (pos > bytes.length) {
+      console.error(`Truncated record of type ${type}`);
+      return;
+    }
+
+    switch (type) {
+      case RecordType.CONTEXT:
+        handler.onContext({
+          model: view.getUint8(start),
+          running: (view.getUint8(start + 1) & 1) != 0,
+          alt_single_step_mode: (view.getUint8(start + 1) & 2) != 0,
+          system_name: new TextDecoder().decode(bytes.subarray(start + 2, pos)),
+        });
+        break;
+      case RecordType.REGISTERS:
+        handler.onRegisters(parseRegisters(view, start));
+        break;
+      case RecordType.BREAKPOINTS: {
+        const breakpoints = Array<ISUT_Breakpoint>(0);
+        for (let i = start; i + 5 <= pos; i += 5) {
+          breakpoints.push({
+            id: view.getUint16(i, true),
+            address: view.getUint16(i + 2, true),
+            type: view.getUint8(i + 4),
+          });
+        }
+        handler.onBreakpoints(breakpoints);
+        break;
+      }
+      case RecordType.MEMORY:
+      case RecordType.SCREEN:
+        handler.onMemory(view.getUint16(start, true),
+                         bytes.subarray(start + 2, pos),
+                         type == RecordType.SCREEN);
+        break;
+      case RecordType.STOPPED: {
+        const id = view.getUint16(start + 2, true);
+        handler.onStopped(view.getUint16(start, true), id == 0xFFFF ? -1 : id);
+        break;
+      }
+      default:
+        console.log(`Unknown record type: ${type}`);
+    }
+  }
+}
+
+function parseRegisters(view: DataView, start: number): ISUT_Registers {
+  const reg16 = (n: number) => view.getUint16(start + 2 * n, true);
+  const reg8 = (n: number) => view.getUint8(start + 24 + n);
+  return {
+    pc: reg16(0),
+    sp: reg16(1),
+    af: reg16(2),
+    bc: reg16(3),
+    de: reg16(4),
+    hl: reg16(5),
+    af_prime: reg16(6),
+    bc_prime: reg16(7),
+    de_prime: reg16(8),
+    hl_prime: reg16(9),
+    ix: reg16(10),
+    iy: reg16(11),
+    i: reg8(0),
+    r_1: reg8(1),
+    r_2: reg8(2),
+    z80_iff1: reg8(3),
+    z80_iff2: reg8(4),
+    z80_interrupt_mode: reg8(5),
+    z80_t_state_counter: view.getUint32(start + 30, true) +
+                         view.getUint32(start + 34, true) * 0x100000000,
+    z80_clockspeed: view.getFloat32(start + 38, true),
+  };
+}
@@ -8,6 +8,7 @@ import { Screen } from "./screen";
 import { MemoryView } from "./memory_view";
 import { MemoryRegions } from "./memory_regions";
 import { Disassembler } from "./disassembler";
+import { Command, BREAKPOINT_TYPES, IProtocolHandler, encodeCommand, encodeKeyEvent, parseMessage } from "./protocol";
 
 // See web_debugger.h for definitions.
 const BP_TYPE_TEXT = ["Program Counter", "Memory Watch", "IO Watch"];
@@ -53,7 +54,7 @@ class TrsXray {
   }
 
   private writeMem(addr: number, value: number): void {
-    this.onControl(`set_memory/${addr}/${value}`);
+    this.onControl(Command.SET_MEMORY, addr, value);
   }
 
   private createMemoryRegions(): void {
@@ -74,15 +75,19 @@ class TrsXray {
     if (json.registers) this.onRegisterUpdate(json.registers);
   }
 
-  private onControl(action: string): void {
-    if (this.socket != undefined) this.socket.send("action/" + action);
+  private onControl(command: Command, ...args: Array<number>): void {
+    this.send(encodeCommand(command, ...args));
+  }
+
+  private send(msg: Uint8Array): void {
+    if (this.socket != undefined) this.socket.send(msg);
   }
 
   private requestMemoryUpdate(): void {
     if (this.enableFullMemoryUpdate) {
-      this.onControl("get_memory/0/65536");
+      this.onControl(Command.GET_MEMORY, 0, 0x10000);
     } else {
-      this.onControl(`get_memory/${0x3C00}/${0x3FFF-0x3C00}`);
+      this.onControl(Command.GET_MEMORY, 0x3C00, 0x400);
     }
   }
 
@@ -91,9 +96,7 @@ class TrsXray {
     evt.preventDefault();
     if (evt.repeat) return;
 
-    let shift = evt.shiftKey ? "1" : "0";
-    let dir = direction == "down" ? "1" : "0";
-    this.onControl(`key_event/${dir}/${shift}/${evt.key}`);
+    this.send(encodeKeyEvent(direction == "down", evt.shiftKey, evt.key));
   }
 
   private onControlStep(): void {
@@ -101,20 +104,20 @@ class TrsXray {
 
     console.log("altSingleStepMode: " + this.altSingleStepMode);
     if (!this.altSingleStepMode) {
-      this.onControl("step");
+      this.onControl(Command.STEP);
       this.requestMemoryUpdate();
     } else {
       // TODO: Only remove synthetic breakpoints.
-      this.onControl("clear_breakpoints");
+      this.onControl(Command.CLEAR_BREAKPOINTS);
 
       // In alt mode we predict where the next instruction is and set
       // breakpoints there to simulate single stepping.
       const nextPCs = this.disassembler.predictNextPC();
       for (var addr of nextPCs) {
         // Add synthetic PC breakpoint.
-        this.onControl(`add_breakpoint/pc/${addr}`);
+        this.onControl(Command.ADD_BREAKPOINT, BREAKPOINT_TYPES["pc"], addr);
       }
-      this.onControl("continue");
+      this.onControl(Command.CONTINUE);
     }
   }
 
@@ -129,19 +132,19 @@ class TrsXray {
             this.onControlStep();
             break;
           case '2':
-            this.onControl("continue");
+            this.onControl(Command.CONTINUE);
             this.requestMemoryUpdate();
             break;
           case '3':
-            this.onControl("stop");
+            this.onControl(Command.STOP);
             this.requestMemoryUpdate();
             break;
           case '4':
-            this.onControl("soft_reset")
+            this.onControl(Command.SOFT_RESET)
             this.requestMemoryUpdate();
             break;
           case '$': // Shift-4
-            this.onControl("hard_reset")
+            this.onControl(Command.HARD_RESET)
             this.requestMemoryUpdate();
             break;
           case '+':
@@ -179,7 +182,7 @@ class TrsXray {
             this.openImportDialog();
             break;
           case 'I':
-            this.onControl("inject_demo");
+            this.onControl(Command.INJECT_DEMO);
             break;
           default:
           console.log(`Unhandled key event: ${evt.key}`);
@@ -193,10 +196,10 @@ class TrsXray {
     $("#step-btn").on("click", () => {
       this.onControlStep();
     });
-    $("#play-btn").on("click", () => { this.onControl("continue") });
-    $("#stop-btn").on("click", () => { this.onControl("stop") });
+    $("#play-btn").on("click", () => { this.onControl(Command.CONTINUE) });
+    $("#stop-btn").on("click", () => { this.onControl(Command.STOP) });
     $("#reset-btn").on("click", (ev) => {
-      this.onControl(ev.shiftKey ? "hard_reset" : "soft_reset")
+      this.onControl(ev.shiftKey ? Command.HARD_RESET : Command.SOFT_RESET)
     });
 
     const addBreakpointHandler = (ev: JQuery.ClickEvent) => {
@@ -209,7 +212,7 @@ class TrsXray {
         alert("Invalid address");
         return;
       }
-      this.onControl(`add_breakpoint/${type}/${addr}`)
+      this.onControl(Command.ADD_BREAKPOINT, BREAKPOINT_TYPES[type as string], addr)
     };
     $("#selected-val").on("keyup", (evt) => {
       if (evt.key == "Enter") {
@@ -296,11 +299,11 @@ class TrsXray {
         z80_t_state_counter: 0
       }
       this.onRegisterUpdate(registers);
-      // Add start address information.
-      const memory = Uint8Array.from([0, 0].concat(json.mem));
+      const memory = Uint8Array.from(json.mem);
       // Doing this twice to discard modified markers.
-      this.onMemoryUpdate(memory);
-      this.onMemoryUpdate(memory);
+      this.onMemory(0, memory);
+      this.onMemory(0, memory);
+      this.renderMemory(true);
 
       // For this mode, switch viz.
       this.memoryView.toggleDataViz();
@@ -318,8 +321,8 @@ class TrsXray {
   }
 
   private forceRefresh(): void {
-    this.onControl("refresh");
-    this.onControl("get_memory/force_update");
+    this.onControl(Command.REFRESH);
+    this.onControl(Command.FORCE_MEMORY);
   }
 
   private updateSelectionFromTextField(): void {
@@ -373,6 +376,7 @@ class TrsXray {
     console.log("Creating new Websocket");
     // FIXME: Make this a URL parameter!
     this.socket = new WebSocket(`ws://${this.sutHostname}/channel`);
+    this.socket.binaryType = "arraybuffer";
     this.socket.onerror = (evt) => {
       console.log("Unable to connect to websocket.");
       $("h1").addClass("errorTitle");
@@ -382,18 +386,39 @@ class TrsXray {
       this.forceRefresh();
     }
     this.socket.onmessage = (evt) =>  {
-      if (evt.data instanceof Blob) {
-        evt.data.arrayBuffer().then((data) => {
-          this.onMemoryUpdate(new Uint8Array(data));
-        });
+      if (evt.data instanceof ArrayBuffer) {
+        this.onBatchFromEmulator(evt.data);
       } else {
-        var json = JSON.parse(evt.data);
-        this.onMessageFromEmulator(json);
-        this.memoryView.renderMemoryRegions();
+        console.log(`Unexpected text message: ${evt.data}`);
       }
     };
   }
 
+  /** Handles all records the emulator sent in one poll, then renders once. */
+  private onBatchFromEmulator(data: ArrayBuffer): void {
+    let memoryUpdated = false;
+    let screenUpdated = false;
+    const handler: IProtocolHandler = {
+      onContext: (ctx) => this.onContextUpdate(ctx),
+      onRegisters: (registers) => this.onRegisterUpdate(registers),
+      onBreakpoints: (breakpoints) => this.onBreakpointUpdate(breakpoints),
+      onMemory: (start, data, screen) => {
+        this.onMemory(start, data);
+        if (screen) screenUpdated = true;
+        else memoryUpdated = true;
+      },
+      onStopped: (pc, breakpointId) => {
+        if (breakpointId >= 0) console.log(`Breakpoint ${breakpointId} hit at ${numToHex(pc)}`);
+      },
+    };
+    parseMessage(data, handler);
+    if (memoryUpdated || screenUpdated) {
+      this.renderMemory(memoryUpdated);
+    } else {
+      this.memoryView.renderMemoryRegions();
+    }
+  }
+
   private onContextUpdate(ctx: ISUT_Context): void {
     $("#sut-name").text(ctx.system_name);
     $("#sut-model-no").text(`M${ctx.model}`);
@@ -431,17 +456,15 @@ class TrsXray {
       $(`<div class="remove-breakpoint" data="${bp.id}"></div>`)
           .on("click", (evt) => {
             const id = $(evt.currentTarget).attr("data");
-            this.onControl(`remove_breakpoint/${id}`);
+            this.onControl(Command.REMOVE_BREAKPOINT, Number(id));
           })
           .appendTo("#breakpoints");
     }
   }
 
-  private onMemoryUpdate(memory: Uint8Array): void {
-    // The first two bytes are the start offset address.
-    let startAddr = (memory[0] << 8) + memory[1];
-    for (let i = 2; i < memory.length; ++i) {
-      let addr = startAddr + i - 2;
+  private onMemory(startAddr: number, memory: Uint8Array): void {
+    for (let i = 0; i < memory.length; ++i) {
+      let addr = startAddr + i;
       if (this.memoryData[addr] != memory[i]) {
         this.memoryChanged[addr] = 1;
         this.memoryData[addr] = memory[i];
@@ -449,10 +472,14 @@ class TrsXray {
         this.memoryChanged[addr] = 0;
       }
     }
+  }
+
+  /** Renders after memory updates; the disassembly only if outside video RAM. */
+  private renderMemory(disassemble: boolean): void {
     this.onSelectionUpdate(-1);
     this.screenView.render(this.memoryData);
     this.memoryView.renderMemoryRegions();
-    this.updateDisassembly();
+    if (disassemble) this.updateDisassembly();
   }
 
   private onSelectionUpdate(addr: number): void {